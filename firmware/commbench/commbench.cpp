@@ -0,0 +1,168 @@
+#include <Arduino.h>
+#include "constants.hpp"
+
+#include <stdio.h>
+
+#include "comm.hpp"
+
+/*
+ * Host-side benchmark for `Comm`. Plays the part of the device: it opens a file on the computer,
+ * writes a test pattern to it and reads it back, once with the old stop-and-wait packets and once
+ * with windowed streaming, then reports the throughput of each. Framed mode is negotiated first
+ * unless `raw` is given.
+ *
+ * Run it through software/src/bench.py, which provides the computer's end of the link.
+ */
+
+static bool open_file() {
+  Comm::Packet pkt = {0x01, {PKT_FILEOPEN, false}};
+  Comm::send(&pkt);
+
+  Comm::Packet::copy_str(&pkt, "Benchmark file");
+  Comm::send(&pkt);
+
+  if (!Comm::recv(&pkt, TIMEOUT_FILEREAD) || pkt.buffer[0] != PKT_FILEOPEN) return false;
+
+  pkt = {0x01, {PKT_FILECONF, 0x03 /* O_RDWR */}};
+  Comm::send(&pkt);
+
+  return true;
+}
+
+// 32-bit offsets once `CAP_OFFSET32` is negotiated, like `FileCtrlSerial::seek()`
+static void seek(uint32_t position) {
+  Comm::Packet pkt = {0x02, {PKT_FILESEEK, (uint8_t) (position & 0xFF), (uint8_t) (position >> 8)}};
+
+  if (Comm::get_caps() & CAP_OFFSET32) {
+    pkt.end = 0x04;
+    pkt.buffer[3] = (position >> 16) & 0xFF;
+    pkt.buffer[4] = position >> 24;
+  }
+
+  Comm::send(&pkt);
+}
+
+// One request and one reply per 256 bytes, like `FileCtrlSerial::read()` used to do
+static uint16_t read_stop_and_wait(uint8_t *buf, uint16_t size) {
+  Comm::Packet pkt = {0x01, {PKT_FILEREAD, 0xFF}};
+  Comm::Packet data;
+
+  uint16_t offset = 0;
+
+  while (offset < size) {
+    Comm::send(&pkt);
+    if (!Comm::recv(&data, TIMEOUT_FILEREAD)) break;
+
+    memcpy(buf + offset, data.buffer, (uint16_t) data.end + 1);
+    offset += (uint16_t) data.end + 1;
+  }
+
+  return offset;
+}
+
+// One packet and one ack per 256 bytes, like `FileCtrlSerial::write()` used to do
+static uint16_t write_stop_and_wait(const uint8_t *buf, uint16_t size) {
+  Comm::Packet pkt = {0x00, {PKT_FILEWRIT}};
+  Comm::Packet data;
+
+  for (uint16_t offset = 0; offset < size; offset += 0x0100) {
+    data.end = 0xFF;
+    memcpy(data.buffer, buf + offset, 0x0100);
+
+    Comm::send(&pkt);
+    Comm::send(&data);
+    Comm::recv(&data);
+  }
+
+  return size;
+}
+
+static uint16_t read_stream(uint8_t *buf, uint16_t size) {
+  Comm::Packet pkt = {0x03, {PKT_STREAMRD, (uint8_t) (size & 0xFF), (uint8_t) (size >> 8), STREAM_WINDOW}};
+  Comm::send(&pkt);
+
+  return Comm::stream_recv(buf, size, TIMEOUT_FILEREAD);
+}
+
+static uint16_t write_stream(const uint8_t *buf, uint16_t size) {
+  Comm::Packet pkt = {0x02, {PKT_STREAMWR, (uint8_t) (size & 0xFF), (uint8_t) (size >> 8)}};
+  Comm::send(&pkt);
+
+  return Comm::stream_send(buf, size);
+}
+
+template<typename Func>
+static bool run(const char *name, uint16_t size, Func action) {
+  seek(0);
+
+  const unsigned long t1 = millis();
+  const uint16_t done = action();
+  const unsigned long t2 = millis();
+
+  const double secs = (t2 - t1) / 1000.0;
+
+  printf("%-20s %5u/%5u bytes in %6.3fs = %7.2f KiB/s\n", name, done, size, secs, done / 1024.0 / secs);
+
+  return done == size;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s TTY [KIB] [raw]\n", argv[0]);
+    return 2;
+  }
+
+  if (!open_serial(argv[1])) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  const uint16_t size = (argc > 2 ? atoi(argv[2]) : 16) * 1024;
+
+  static uint8_t pattern[0xFF00];
+  static uint8_t readback[0xFF00];
+
+  if (size == 0 || size > sizeof(pattern) || size % 0x0100 != 0) {
+    fprintf(stderr, "KIB must be between 1 and 63\n");
+    return 2;
+  }
+
+  for (uint16_t i = 0; i < size; ++i) {
+    pattern[i] = (i * 7) ^ (i >> 8);
+  }
+
+  const bool raw = (argc > 3 && strcmp(argv[3], "raw") == 0);
+
+  if (!raw && !Comm::ping()) {
+    fprintf(stderr, "No response to ping\n");
+    return 1;
+  }
+
+  printf("Capabilities: 0x%02X at %lu baud\n", Comm::get_caps(), (unsigned long) Comm::get_baud());
+
+  if (!open_file()) {
+    fprintf(stderr, "Could not open file\n");
+    return 1;
+  }
+
+  bool ok = true;
+
+  ok &= run("stop-and-wait write", size, [&]() { return write_stop_and_wait(pattern, size); });
+  ok &= run("windowed write",      size, [&]() { return write_stream(pattern, size); });
+
+  ok &= run("stop-and-wait read",  size, [&]() { return read_stop_and_wait(readback, size); });
+  ok &= (memcmp(pattern, readback, size) == 0);
+
+  memset(readback, 0, size);
+
+  ok &= run("windowed read",       size, [&]() { return read_stream(readback, size); });
+  ok &= (memcmp(pattern, readback, size) == 0);
+
+  Comm::Packet pkt = {0x00, {PKT_FILECLOS}};
+  Comm::send(&pkt);
+  ser.flush();
+
+  printf("%s\n", ok ? "All data verified." : "Verification FAILED!");
+
+  return ok ? 0 : 1;
+}
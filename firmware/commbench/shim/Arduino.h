@@ -0,0 +1,44 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+// Minimal stand-in for the Arduino core, just enough to build `Comm` on a Linux host.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define pgm_read_byte(addr) (*(const uint8_t *) (addr))
+#define pgm_read_word(addr) (*(const uint16_t *) (addr))
+#define pgm_read_dword(addr) (*(const uint32_t *) (addr))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+class Print {
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t val) = 0;
+  virtual size_t write(const uint8_t *buf, size_t size) = 0;
+
+  virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+// Connects `SerialCtrl` to a tty (e.g. one end of a pty pair) in raw mode; must be called before anything else
+bool open_serial(const char *path);
+
+#endif
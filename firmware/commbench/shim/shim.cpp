@@ -0,0 +1,138 @@
+#include <Arduino.h>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "constants.hpp"
+
+SerialCtrl ser;
+
+static int fd = -1;
+
+// Bytes read from the tty but not yet by `Comm`; `SerialCtrl` keeps its state in statics as well
+static uint8_t rx_buf[4096];
+static size_t rx_head = 0, rx_tail = 0;
+static uint16_t rx_high_water = 0;
+
+static uint64_t now_us() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const uint64_t start_us = now_us();
+
+unsigned long millis() {
+  return (now_us() - start_us) / 1000;
+}
+
+unsigned long micros() {
+  return now_us() - start_us;
+}
+
+void delay(unsigned long ms) {
+  usleep(ms * 1000);
+}
+
+bool open_serial(const char *path) {
+  fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0) return false;
+
+  termios tio;
+  tcgetattr(fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(fd, TCSANOW, &tio);
+
+  return true;
+}
+
+// Moves whatever the tty has into `rx_buf` without blocking
+static void fill() {
+  if (rx_head == rx_tail) rx_head = rx_tail = 0;
+
+  ssize_t n = ::read(fd, rx_buf + rx_tail, sizeof(rx_buf) - rx_tail);
+  if (n > 0) rx_tail += n;
+
+  if (rx_tail - rx_head > rx_high_water) rx_high_water = rx_tail - rx_head;
+}
+
+void SerialCtrl::begin(uint32_t baud) {
+  // A pty has no real baud rate, but it keeps the setting around so the other end can see it. There are no
+  // constants for some of the rates the firmware uses, so it gets the nearest one (bench.py maps them back).
+  speed_t speed = (
+    baud <= 115200  ? B115200  :
+    baud <= 250000  ? B230400  :
+    baud <= 500000  ? B500000  :
+    baud <= 1000000 ? B1000000 :
+                      B2000000
+  );
+
+  termios tio;
+  tcgetattr(fd, &tio);
+  cfsetspeed(&tio, speed);
+  tcsetattr(fd, TCSANOW, &tio);
+}
+
+bool SerialCtrl::set_rx_buffer(uint16_t size) {
+  (void) size;  // `rx_buf` is always big enough
+  return true;
+}
+
+int SerialCtrl::available() {
+  fill();
+
+  if (rx_head == rx_tail) usleep(10);  // Callers spin on this, don't hog a core
+
+  return rx_tail - rx_head;
+}
+
+int SerialCtrl::peek() {
+  if (available() == 0) return -1;
+
+  return rx_buf[rx_head];
+}
+
+int SerialCtrl::read() {
+  if (available() == 0) return -1;
+
+  return rx_buf[rx_head++];
+}
+
+uint16_t SerialCtrl::read(uint8_t *buf, uint16_t len) {
+  const uint16_t waiting = available();
+  const uint16_t count = (waiting < len ? waiting : len);
+
+  memcpy(buf, rx_buf + rx_head, count);
+  rx_head += count;
+
+  return count;
+}
+
+size_t SerialCtrl::write(uint8_t val) {
+  return write(&val, 1);
+}
+
+size_t SerialCtrl::write(const uint8_t *buf, size_t size) {
+  size_t done = 0;
+
+  while (done < size) {
+    ssize_t n = ::write(fd, buf + done, size - done);
+
+    if (n > 0) done += n;
+    else usleep(100);
+  }
+
+  return done;
+}
+
+void SerialCtrl::flush() {
+  tcdrain(fd);
+}
+
+void SerialCtrl::get_stats(Stats *out) {
+  out->size       = sizeof(rx_buf);
+  out->high_water = rx_high_water;
+  out->overruns   = 0;
+}
@@ -0,0 +1,165 @@
+#include <Arduino.h>
+#include "constants.hpp"
+
+#include <SD/src/SD.h>
+
+#include "crc.hpp"
+#include "sd.hpp"
+#include "util.hpp"
+
+#include "catalog.hpp"
+
+extern SdCtrl sd;
+
+static File open_catalog(uint8_t access) {
+  char path[32];
+
+  strcpy(path, Strings::M_FILE_DIR);
+  strcat(path, Strings::M_CATALOG);
+
+  return SD.open(path, access);
+}
+
+// Looks up what the directory says about `name`, or nullptr if it isn't there
+static const SdFileInfo *dir_info(const char *name) {
+  SdDirIndex *index = sd.get_index(Strings::M_FILE_DIR);
+  if (index == nullptr) return nullptr;
+
+  for (uint16_t i = 0; i < index->size(); ++i) {
+    const SdFileInfo *info = index->get(i);
+
+    if (!info->is_dir() && strcasecmp(info->name, name) == 0) return info;
+  }
+
+  return nullptr;
+}
+
+// Finds where the entry for `name` starts in `cat`, or the size of `cat` if it has none
+static uint32_t find_entry(File &cat, const char *name) {
+  char entry_name[sizeof(Catalog::Entry::name)];
+
+  for (uint32_t pos = 0; pos + sizeof(Catalog::Entry) <= cat.size(); pos += sizeof(Catalog::Entry)) {
+    cat.seek(pos);
+
+    if (cat.read((uint8_t *) entry_name, sizeof(entry_name)) != sizeof(entry_name)) break;
+
+    entry_name[sizeof(entry_name) - 1] = '\0';
+    if (strcasecmp(entry_name, name) == 0) return pos;
+  }
+
+  return cat.size();
+}
+
+const char *Catalog::name_in_dir(const char *path) {
+  const size_t dir_len = strlen(Strings::M_FILE_DIR);
+
+  if (strncasecmp(path, Strings::M_FILE_DIR, dir_len) != 0) return nullptr;
+
+  const char *name = path + dir_len;
+  const size_t len = strlen(name);
+
+  if (len == 0 || len >= sizeof(Entry::name) || strchr(name, '/') != nullptr) return nullptr;
+
+  // The catalog doesn't keep track of itself
+  if (strcasecmp(name, Strings::M_CATALOG) == 0) return nullptr;
+
+  return name;
+}
+
+void Catalog::begin(Entry *entry, const char *name) {
+  memset(entry, 0x00, sizeof(Entry));
+  strncpy(entry->name, name, sizeof(entry->name) - 1);
+}
+
+bool Catalog::add(Entry *entry, const uint8_t *buf, uint16_t len) {
+  if (entry->size + len > MAX_SIZE) return false;
+
+  entry->crc = Crc::crc32(buf, len, entry->crc);
+
+  while (len > 0) {
+    const uint16_t offset = entry->size % PAGE_SIZE;
+    const uint16_t count  = MIN(len, PAGE_SIZE - offset);
+
+    uint32_t *page = &entry->pages[entry->size / PAGE_SIZE];
+    *page = Crc::crc32(buf, count, (offset == 0 ? 0 : *page));
+
+    entry->size += count;
+    buf         += count;
+    len         -= count;
+  }
+
+  return true;
+}
+
+uint8_t Catalog::num_pages(const Entry *entry) {
+  return (entry->size + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+bool Catalog::find(const char *name, Entry *entry) {
+  const SdFileInfo *info = dir_info(name);
+  if (info == nullptr || info->size > MAX_SIZE) return false;
+
+  File cat = open_catalog(O_READ);
+  if (!cat) return false;
+
+  bool found = false;
+  const uint32_t pos = find_entry(cat, name);
+
+  if (pos < cat.size()) {
+    cat.seek(pos);
+
+    found = (
+      cat.read((uint8_t *) entry, sizeof(Entry)) == sizeof(Entry) &&
+      entry->size == info->size && entry->first_cluster == info->first_cluster &&
+      entry->write_date == info->write_date && entry->write_time == info->write_time
+    );
+  }
+
+  cat.close();
+  return found;
+}
+
+bool Catalog::store(Entry *entry) {
+  const SdFileInfo *info = dir_info(entry->name);
+  if (info == nullptr || info->size != entry->size) return false;
+
+  entry->write_date    = info->write_date;
+  entry->write_time    = info->write_time;
+  entry->first_cluster = info->first_cluster;
+
+  File cat = open_catalog(O_RDWR | O_CREAT);
+  if (!cat) return false;
+
+  uint32_t pos = find_entry(cat, entry->name);
+
+  // Reuses the first free entry rather than growing the catalog
+  for (uint32_t free_pos = 0; pos == cat.size() && free_pos < cat.size(); free_pos += sizeof(Entry)) {
+    cat.seek(free_pos);
+
+    if (cat.read() == '\0') pos = free_pos;
+  }
+
+  cat.seek(pos);
+  const bool success = (cat.write((const uint8_t *) entry, sizeof(Entry)) == sizeof(Entry));
+
+  cat.close();
+
+  // The catalog's own directory entry changed, and it may have just been created
+  sd.invalidate_index();
+
+  return success;
+}
+
+void Catalog::remove(const char *name) {
+  File cat = open_catalog(O_RDWR);
+  if (!cat) return;
+
+  const uint32_t pos = find_entry(cat, name);
+
+  if (pos < cat.size()) {
+    cat.seek(pos);
+    cat.write((uint8_t) '\0');
+  }
+
+  cat.close();
+}
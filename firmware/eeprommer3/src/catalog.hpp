@@ -0,0 +1,57 @@
+#ifndef CATALOG_HPP
+#define CATALOG_HPP
+
+#include <Arduino.h>
+#include "constants.hpp"
+
+/*
+ * Checksums of the images in `Strings::M_FILE_DIR`, kept in a file there (`Strings::M_CATALOG`), so that the EEPROM
+ * can be compared with an image without reading the image again.
+ *
+ * Each entry holds the CRC-32 of a whole image and of each `PAGE_SIZE` bytes of it. It is tied to the file by the
+ * file's size, first cluster and modification time, so an image changed on a computer is not mistaken for the old one.
+ * `FileCtrlSd` works the checksums out whenever an image is written, or read from start to end, and stores them.
+ */
+namespace Catalog {
+  constexpr uint16_t PAGE_SIZE = 0x0100;  // Same as the page hashes of `ProgrammerRemoteCore`
+  constexpr uint32_t MAX_SIZE  = 0x8000;  // Only files that fit in the EEPROM are kept
+  constexpr uint8_t  MAX_PAGES = MAX_SIZE / PAGE_SIZE;
+
+  // Stored as is in the catalog file, one after another; entries with an empty name are free
+  struct Entry {
+    char name[13];
+    uint8_t reserved;
+
+    uint16_t write_date;  // From the file's directory entry, in FAT format
+    uint16_t write_time;
+    uint32_t first_cluster;
+
+    uint32_t size;
+    uint32_t crc;               // Of the whole file
+    uint32_t pages[MAX_PAGES];  // Of each page of the file, the last one may be shorter
+  };
+
+  // Gets the name of a file directly in `Strings::M_FILE_DIR` from its path, or nullptr if it is elsewhere
+  const char *name_in_dir(const char *path);
+
+  // Starts `entry` over for the file `name`, with no data yet
+  void begin(Entry *entry, const char *name);
+
+  // Adds the next `len` bytes of the file to `entry`; returns false if the file got too large to catalog
+  bool add(Entry *entry, const uint8_t *buf, uint16_t len);
+
+  // Number of pages `entry` has checksums for
+  uint8_t num_pages(const Entry *entry);
+
+  // Reads the entry for `name` into `entry`; returns false if there is none or the file changed since it was stored
+  bool find(const char *name, Entry *entry);
+
+  // Adds or replaces the entry for `entry->name`, filling in which file it belongs to from the directory, so the file
+  // must have been closed. Returns false if it can't be stored.
+  bool store(Entry *entry);
+
+  // Forgets the entry for `name`, if there is one
+  void remove(const char *name);
+};
+
+#endif
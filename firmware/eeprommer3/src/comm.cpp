@@ -1,10 +1,40 @@
 #include <Arduino.h>
 #include "constants.hpp"
 
+#include "crc.hpp"
+#include "log.hpp"
+#include "memory.hpp"
+
 #include "comm.hpp"
 
 namespace Comm {
 
+struct HandlerEntry {
+  uint8_t type;
+  Handler handler;
+};
+
+static HandlerEntry handlers[MAX_HANDLERS];
+static uint8_t num_handlers = 0;
+
+static uint8_t caps = 0x00;
+
+static const uint32_t BAUD_RATES[NUM_BAUDS] PROGMEM = {115200, 250000, 500000, 1000000, 2000000};
+
+static uint8_t baud_code = BAUD_115200;
+static uint8_t bauds_failed = 0x00;  // Rates that failed their test pattern, not tried again
+
+static uint8_t tx_seq = 0;  // Sequence number of the next frame to send
+static uint8_t rx_seq = 0;  // Sequence number of the next frame expected
+
+// Last `FRAME_HISTORY` frames sent, indexed by `seq % FRAME_HISTORY`; allocated in XRAM on first use
+static Packet *history = nullptr;
+
+// Last NAK sent, so the same frame isn't asked for over and over while it is on its way
+static uint8_t nak_seq = 0;
+static unsigned long nak_time = 0;
+static bool nak_sent = false;
+
 void Packet::copy(Packet *dst, Packet *src) {
   dst->end = src->end;
   memcpy(dst->buffer, src->buffer, (uint16_t) src->end + 1);
@@ -20,44 +50,545 @@ void Packet::copy_str_P(Packet *pkt, const char *str) {
   memcpy_P(pkt->buffer, str, (uint16_t) pkt->end + 1);
 }
 
-void send(Packet *pkt) {
-  Serial.write(pkt->end);
-  Serial.write(pkt->buffer, (uint16_t) pkt->end + 1);
+static void send_frame(uint8_t seq, Packet *pkt) {
+  uint16_t crc = Crc::crc16_update(Crc::CRC16_INIT, seq);
+  crc = Crc::crc16_update(crc, pkt->end);
+  crc = Crc::crc16(pkt->buffer, (uint16_t) pkt->end + 1, crc);
+
+  const uint8_t header[] {FRAME_SOF, seq, pkt->end};
+  const uint8_t footer[] {(uint8_t) (crc & 0xFF), (uint8_t) (crc >> 8)};
+
+  ser.write(header, sizeof(header));
+  ser.write(pkt->buffer, (uint16_t) pkt->end + 1);
+  ser.write(footer, sizeof(footer));
 }
 
-bool recv(Packet *pkt, uint16_t timeout_ms) {
-  unsigned long t1 = millis();
-  bool header = true;
-  uint8_t index = 0;
-
-  while (true) {
-    while (Serial.available() == 0) {
-      if (0 < timeout_ms && timeout_ms < (millis() - t1)) {
-        SER_LOG_PRINT("Timeout %dms exceeded while reading packet.\n", timeout_ms);
-        return false;
+static void send_nak() {
+  if (nak_sent && nak_seq == rx_seq && millis() - nak_time < TIMEOUT_NAK) {
+    return;  // Already asked for this frame, wait for it
+  }
+
+  const uint8_t nak[] {FRAME_NAK, rx_seq, (uint8_t) ~rx_seq};
+  ser.write(nak, sizeof(nak));
+
+  nak_seq  = rx_seq;
+  nak_time = millis();
+  nak_sent = true;
+}
+
+// Resends every frame from `seq` on, if they are all still in the history
+static void retransmit(uint8_t seq) {
+  const uint8_t count = tx_seq - seq;
+
+  if (count == 0 || count > FRAME_HISTORY) return;
+
+  SER_LOG_PRINT("Resending %d frames from seq %d.\n", count, seq);
+
+  for (; seq != tx_seq; ++seq) {
+    send_frame(seq, &history[seq % FRAME_HISTORY]);
+  }
+}
+
+static void set_baud(uint8_t code) {
+  ser.flush();
+  ser.begin(pgm_read_dword(&BAUD_RATES[code]));
+
+  baud_code = code;
+}
+
+// Goes back to the default rate without framing, where a computer that started over pings
+static void fall_back() {
+  SER_LOG_PRINT("Only garbage at %lu baud, going back to the default rate.\n", get_baud());
+
+  set_baud(BAUD_115200);
+  caps = 0x00;
+}
+
+// Waits for `ms` milliseconds, throwing away anything that comes in meanwhile
+static void drain_for(uint16_t ms) {
+  const unsigned long t1 = millis();
+
+  while (millis() - t1 < ms) {
+    while (ser.available() > 0) ser.read();
+  }
+}
+
+Parser::Status Parser::update(Packet *pkt) {
+  if (m_state != State::IDLE && millis() - m_last_byte > TIMEOUT_BYTE) {
+    // The rest went missing; a cut off NAK (or what looked like the start of a ping) is just ignored
+    const bool was_nak = (m_state == State::NAK_SEQ || m_state == State::NAK_CHK || m_state == State::PING);
+    m_state = State::IDLE;
+
+    if (was_nak) return Status::NEED_MORE;
+
+    SER_LOG_PRINT("Packet cut off, expected seq %d.\n", rx_seq);
+    if (caps & CAP_FRAMED) send_nak();
+
+    return Status::ERROR;
+  }
+
+  while (ser.available() > 0) {
+    m_last_byte = millis();
+
+    switch (m_state) {
+    case State::IDLE: {
+      const uint8_t val = ser.read();
+
+      if (!(caps & CAP_FRAMED)) {
+        pkt->end = val;
+        m_index  = 0;
+        m_state  = State::DATA;
+      }
+      else if (val <= 0x02 && m_skipped == 0) {
+        // May be the length of an unframed ping from a computer that started over, see `State::PING`
+        pkt->end = val;
+        m_state  = State::PING;
+      }
+      else {
+        idle_framed(val);
       }
-    }
 
-    if (header) {
-      pkt->end = Serial.read();
-      header = false;
+      break;
     }
-    else {
-      pkt->buffer[index] = Serial.read();
 
-      if (index++ == pkt->end) {
+    case State::PING: {
+      const uint8_t val = ser.read();
+
+      if (val != PKT_PING) {
+        // The length was garbage after all, but this byte may still start a frame
+        skip();
+        idle_framed(val);
         break;
       }
+
+      // A ping is always unframed, and turns framing off until it is negotiated again
+      SER_LOG_PRINT("Unframed ping, leaving framed mode.\n");
+      caps = 0x00;
+
+      pkt->buffer[0] = PKT_PING;
+      m_index = 1;
+      m_state = State::DATA;
+
+      if (m_index > pkt->end) {
+        m_state = State::IDLE;
+        return Status::COMPLETE;
+      }
+
+      break;
+    }
+
+    case State::NAK_SEQ:
+      m_seq   = ser.read();
+      m_state = State::NAK_CHK;
+      break;
+
+    case State::NAK_CHK:
+      if (m_seq == (uint8_t) ~ser.read()) retransmit(m_seq);
+
+      m_state = State::IDLE;
+      break;
+
+    case State::SEQ:
+      m_seq   = ser.read();
+      m_state = State::END;
+      break;
+
+    case State::END:
+      pkt->end = ser.read();
+      m_index  = 0;
+      m_state  = State::DATA;
+      break;
+
+    case State::DATA:
+      m_index += ser.read(pkt->buffer + m_index, (uint16_t) pkt->end + 1 - m_index);
+
+      if (m_index > pkt->end) {
+        if (!(caps & CAP_FRAMED)) {
+          m_state = State::IDLE;
+          return Status::COMPLETE;
+        }
+
+        m_index = 0;
+        m_state = State::CRC;
+      }
+
+      break;
+
+    case State::CRC:
+      m_index += ser.read(m_crc + m_index, sizeof(m_crc) - m_index);
+
+      if (m_index == sizeof(m_crc)) {
+        m_state = State::IDLE;
+
+        const Status status = check_frame(pkt);
+        if (status != Status::NEED_MORE) return status;
+      }
+
+      break;
+    }
+  }
+
+  return Status::NEED_MORE;
+}
+
+// Handles a byte between frames in framed mode
+void Parser::idle_framed(uint8_t val) {
+  if (val == FRAME_SOF) {
+    m_state   = State::SEQ;
+    m_skipped = 0;
+  }
+  else if (val == FRAME_NAK) {
+    m_state   = State::NAK_SEQ;
+    m_skipped = 0;
+  }
+  else {
+    skip();  // Skip to next start marker
+  }
+}
+
+void Parser::skip() {
+  m_noise = true;
+  if (m_skipped < UINT8_MAX) ++m_skipped;
+
+  // Framed streams have nothing between frames, so this much garbage means the rates differ
+  if (m_skipped >= NOISE_FALLBACK && baud_code != BAUD_115200) {
+    fall_back();
+    m_skipped = 0;
+  }
+}
+
+// Checks a frame that has been read completely
+Parser::Status Parser::check_frame(Packet *pkt) {
+  uint16_t crc = Crc::crc16_update(Crc::CRC16_INIT, m_seq);
+  crc = Crc::crc16_update(crc, pkt->end);
+  crc = Crc::crc16(pkt->buffer, (uint16_t) pkt->end + 1, crc);
+
+  if (crc != (m_crc[0] | (m_crc[1] << 8))) {
+    SER_LOG_PRINT("Damaged frame, expected seq %d.\n", rx_seq);
+    send_nak();
+    return Status::ERROR;
+  }
+
+  if (m_seq != rx_seq) {
+    // Ahead means frames went missing in between, behind is a repeat of one already received
+    if ((uint8_t) (m_seq - rx_seq) < 0x80) {
+      send_nak();
+      return Status::ERROR;
+    }
+
+    return Status::NEED_MORE;
+  }
+
+  ++rx_seq;
+  nak_sent = false;
+
+  return Status::COMPLETE;
+}
+
+void Parser::reset() {
+  m_state   = State::IDLE;
+  m_noise   = false;
+  m_skipped = 0;
+}
+
+bool Parser::is_idle() {
+  return m_state == State::IDLE;
+}
+
+bool Parser::had_noise() {
+  return m_noise;
+}
+
+void send(Packet *pkt) {
+  if (caps & CAP_FRAMED) {
+    Packet::copy(&history[tx_seq % FRAME_HISTORY], pkt);
+    send_frame(tx_seq++, pkt);
+  }
+  else {
+    ser.write(pkt->end);
+    ser.write(pkt->buffer, (uint16_t) pkt->end + 1);
+  }
+}
+
+bool recv(Packet *pkt, uint16_t timeout_ms) {
+  const unsigned long t1 = millis();
+
+  Parser parser;
+
+  while (parser.update(pkt) != Parser::Status::COMPLETE) {
+    if (0 < timeout_ms && timeout_ms < (millis() - t1)) {
+      SER_LOG_PRINT("Timeout %dms exceeded while reading packet.\n", timeout_ms);
+
+      // Nothing but garbage came in, the computer has probably gone back to the default rate
+      if (parser.had_noise() && baud_code != BAUD_115200) fall_back();
+
+      return false;
+    }
+
+    // If an answer is expected soon, or garbage came in, going without a frame
+    // for a while may mean one was lost entirely, so ask for it (again)
+    const bool impatient = (timeout_ms > 0 || parser.had_noise());
+
+    if ((caps & CAP_FRAMED) && impatient && parser.is_idle() && millis() - t1 > TIMEOUT_NAK) {
+      send_nak();
     }
   }
 
   return true;
 }
 
-bool ping() {
-  Packet pkt = {0x00, {PKT_PING}};
+// Pings at the current baud rate, then returns the rates the computer supports (or -1 if no response)
+static int ping_once() {
+  caps = 0x00;
+
+  uint8_t supported = CAP_OFFSET32;
+
+  if (history == nullptr) {
+    Memory::Scope scope(Memory::Tag::COMM);
+    history = (Packet *) malloc(sizeof(Packet) * FRAME_HISTORY);
+  }
+
+  if (history != nullptr) {
+    supported |= CAP_FRAMED;
+  }
+
+#ifdef LOGGING
+  supported |= CAP_LOG;
+#endif
+
+  // Fast rates are only used with framing, so that errors are caught
+  const uint8_t rates = (supported & CAP_FRAMED ? (1 << NUM_BAUDS) - 1 : 0x00);
+
+  Packet pkt = {0x02, {PKT_PING, supported, rates}};
+  send(&pkt);
+
+  if (!recv(&pkt, TIMEOUT_PING)) {
+    return -1;
+  }
+
+  // Computers that don't know about capabilities reply with just the type
+  caps = (pkt.end >= 1 ? pkt.buffer[1] & supported : 0x00);
+
+  tx_seq   = 0;
+  rx_seq   = 0;
+  nak_sent = false;
+
+  // May be a different program than before
+  Log::reset_sites();
+
+  SER_LOG_PRINT("Ping response, capabilities 0x%02X.\n", caps);
+
+  return (pkt.end >= 2 ? pkt.buffer[2] & rates : 0x00);
+}
+
+// Switches both sides to baud rate `code` and checks the link with a test pattern.
+// Returns false, with the old rate restored, if anything went wrong.
+static bool try_baud(uint8_t code) {
+  static const uint8_t PATTERN[] PROGMEM = {
+    0x00, 0xFF, 0x55, 0xAA, 0x0F, 0xF0, 0x33, 0xCC, 0x01, 0x80, 0xFE, 0x7F, FRAME_SOF, FRAME_NAK, 0x12, 0x34,
+  };
+
+  Packet pkt = {0x01, {PKT_BAUD, code}};
+  send(&pkt);
+
+  if (!recv(&pkt, TIMEOUT_PING) || pkt.buffer[0] != PKT_BAUD || pkt.buffer[1] != code) {
+    return false;  // Refused
+  }
+
+  const uint8_t old_code = baud_code;
+
+  set_baud(code);
+  delay(T_BAUD_SETTLE);
+
+  pkt.end = sizeof(PATTERN) + 1;
+  pkt.buffer[0] = PKT_BAUD;
+  pkt.buffer[1] = code;
+  memcpy_P(pkt.buffer + 2, PATTERN, sizeof(PATTERN));
   send(&pkt);
-  return recv(&pkt, TIMEOUT_PING);
+
+  Packet echo;
+
+  if (recv(&echo, TIMEOUT_BAUD) && echo.end == pkt.end && memcmp(echo.buffer, pkt.buffer, (uint16_t) pkt.end + 1) == 0) {
+    pkt = {0x01, {PKT_BAUD, code}};
+    send(&pkt);
+
+    SER_LOG_PRINT("Switched to %lu baud.\n", get_baud());
+    return true;
+  }
+
+  set_baud(old_code);
+
+  // Give the computer time to give up as well
+  drain_for(2 * TIMEOUT_BAUD);
+
+  return false;
+}
+
+bool ping() {
+  int rates = ping_once();
+
+  if (rates < 0 && baud_code != BAUD_115200) {
+    // Computer may have gone back to the default rate, give it time to notice that we haven't
+    set_baud(BAUD_115200);
+    drain_for(TIMEOUT_NAK * 2);
+
+    rates = ping_once();
+  }
+
+  if (rates < 0) {
+    return false;
+  }
+
+  // Try the fastest untested rates first; stop at the current one
+  for (int8_t code = NUM_BAUDS - 1; code > baud_code; --code) {
+    if (!(rates & (1 << code)) || (bauds_failed & (1 << code))) continue;
+
+    if (try_baud(code)) break;
+
+    SER_LOG_PRINT("Could not switch to %lu baud.\n", pgm_read_dword(&BAUD_RATES[code]));
+    bauds_failed |= (1 << code);
+
+    // Start over cleanly at the old rate
+    if (ping_once() < 0) return false;
+  }
+
+  return true;
+}
+
+uint8_t get_caps() {
+  return caps;
+}
+
+uint32_t get_baud() {
+  return pgm_read_dword(&BAUD_RATES[baud_code]);
+}
+
+uint16_t stream_recv(uint8_t *buf, uint16_t len, uint16_t timeout_ms) {
+  Packet pkt;
+
+  uint8_t seq = 0;
+  uint16_t offset = 0;
+
+  while (offset < len) {
+    const int16_t received = stream_recv_packet(&pkt, &seq, timeout_ms);
+
+    if (received < 0) {
+      break;  // Abort
+    }
+
+    const uint8_t count = MIN((uint16_t) received, len - offset);
+
+    memcpy(buf + offset, pkt.buffer + 2, count);
+    offset += count;
+
+    if (received < STREAM_CHUNK) {
+      break;  // Short packet, stream is over
+    }
+  }
+
+  return offset;
+}
+
+int16_t stream_recv_packet(Packet *pkt, uint8_t *seq, uint16_t timeout_ms) {
+  if (!recv(pkt, timeout_ms)) {
+    return -1;  // Abort (computer stopped sending)
+  }
+
+  if (pkt->buffer[0] != PKT_STREAMDT || pkt->end < 1 || pkt->buffer[1] != *seq) {
+    SER_LOG_PRINT("Bad stream packet (type 0x%02X, expected seq %d).\n", pkt->buffer[0], *seq);
+    return -1;  // Abort (out of sync)
+  }
+
+  Packet ack = {0x01, {PKT_STREAMAK, (*seq)++}};
+  send(&ack);
+
+  return pkt->end - 1;
+}
+
+uint16_t stream_send(const uint8_t *buf, uint16_t len, uint16_t timeout_ms) {
+  Packet pkt;
+
+  const uint16_t num_pkts = (len + STREAM_CHUNK - 1) / STREAM_CHUNK;
+
+  uint16_t sent  = 0;  // Number of packets sent
+  uint16_t acked = 0;  // Number of packets acknowledged
+
+  while (acked < num_pkts) {
+    const uint8_t in_flight = sent - acked;
+
+    if (sent < num_pkts && in_flight < STREAM_WINDOW) {
+      const uint16_t offset = sent * STREAM_CHUNK;
+      const uint8_t count = MIN(STREAM_CHUNK, len - offset);
+
+      pkt.end = count + 1;
+      pkt.buffer[0] = PKT_STREAMDT;
+      pkt.buffer[1] = sent & 0xFF;
+      memcpy(pkt.buffer + 2, buf + offset, count);
+
+      send(&pkt);
+      ++sent;
+
+      // Only stop to read acks if they have already arrived
+      if (ser.available() == 0) continue;
+    }
+
+    if (!recv(&pkt, timeout_ms)) {
+      break;  // Abort (computer stopped responding)
+    }
+
+    // Cumulative ack: everything up to and including `seq` has arrived
+    const uint8_t newly_acked = pkt.buffer[1] + 1 - (acked & 0xFF);
+
+    if (pkt.buffer[0] != PKT_STREAMAK || newly_acked > sent - acked) {
+      SER_LOG_PRINT("Bad stream ack (type 0x%02X, seq %d).\n", pkt.buffer[0], pkt.buffer[1]);
+      break;  // Abort (out of sync)
+    }
+
+    acked += newly_acked;
+  }
+
+  return MIN(len, acked * STREAM_CHUNK);
+}
+
+bool add_handler(uint8_t type, Handler handler) {
+  if (num_handlers >= MAX_HANDLERS) return false;
+
+  handlers[num_handlers++] = {type, handler};
+  return true;
+}
+
+bool dispatch(Packet *pkt) {
+  for (uint8_t i = 0; i < num_handlers; ++i) {
+    if (handlers[i].type == pkt->buffer[0]) {
+      (*handlers[i].handler)(pkt);
+      return true;
+    }
+  }
+
+  SER_LOG_PRINT("Ignoring unsolicited packet of type 0x%02X.\n", pkt->buffer[0]);
+  return false;
+}
+
+void poll() {
+  // Kept between calls, since a packet may take several calls to come in; allocated in XRAM on first use
+  static Parser parser;
+  static Packet *pkt = nullptr;
+
+  if (parser.is_idle() && ser.available() == 0) {
+    if (caps & CAP_LOG) Log::drain();
+    return;
+  }
+
+  Memory::Scope scope(Memory::Tag::COMM);
+
+  if (pkt == nullptr) {
+    pkt = (Packet *) malloc(sizeof(Packet));
+    if (pkt == nullptr) return;
+  }
+
+  if (parser.update(pkt) == Parser::Status::COMPLETE) {
+    dispatch(pkt);
+  }
 }
 
 };
@@ -5,6 +5,7 @@
 #include "constants.hpp"
 
 #define PKT_PING     0x00
+#define PKT_BAUD     0x01
 #define PKT_FILEOPEN 0x10
 #define PKT_FILECONF 0x11
 #define PKT_FILESIZE 0x12
@@ -13,9 +14,64 @@
 #define PKT_FILEWRIT 0x15
 #define PKT_FILEFLUS 0x16
 #define PKT_FILECLOS 0x17
+#define PKT_STREAMRD 0x18
+#define PKT_STREAMWR 0x19
+#define PKT_STREAMDT 0x1A
+#define PKT_STREAMAK 0x1B
+#define PKT_MEMSTAT  0x20
+#define PKT_EEINFO   0x30
+#define PKT_EEREAD   0x31
+#define PKT_EEWRIT   0x32
+#define PKT_EEVRFY   0x33
+#define PKT_EEFILL   0x34
+#define PKT_EECSUM   0x35
+#define PKT_EEDUMP   0x36
+#define PKT_DUMPDT   0x37
+#define PKT_DUMPCK   0x38
+#define PKT_EEHASH   0x39
+#define PKT_LOGFMT   0x40
+#define PKT_LOGDATA  0x41
 
 #define TIMEOUT_PING      200
 #define TIMEOUT_FILEREAD 1000
+#define TIMEOUT_STREAM   1000
+#define TIMEOUT_BYTE       50
+#define TIMEOUT_NAK       100
+#define TIMEOUT_BAUD      500
+
+// Bytes of garbage in a row, while framed at a fast rate, after which the device goes back to `BAUD_115200`
+#define NOISE_FALLBACK 8
+
+// Time for the computer to switch baud rates after acknowledging a `PKT_BAUD`
+#define T_BAUD_SETTLE 10
+
+// Capabilities exchanged in `PKT_PING`
+#define CAP_FRAMED   0x01
+#define CAP_OFFSET32 0x02  // `PKT_FILESIZE` and `PKT_FILESEEK` have 32-bit offsets instead of 16-bit
+#define CAP_LOG      0x04  // The computer takes `PKT_LOGFMT` and `PKT_LOGDATA` packets (see `log.hpp`)
+
+// Baud rate codes; bit n of the rates byte in `PKT_PING` is set if code n is supported
+#define BAUD_115200 0
+#define BAUD_250K   1
+#define BAUD_500K   2
+#define BAUD_1M     3
+#define BAUD_2M     4
+#define NUM_BAUDS   5
+
+// Framed mode: `[FRAME_SOF, seq, end, buffer..., crc_lo, crc_hi]` and `[FRAME_NAK, seq, ~seq]`
+#define FRAME_SOF 0x7E
+#define FRAME_NAK 0x7D
+
+// Number of sent frames kept for retransmission
+#define FRAME_HISTORY 8
+
+// Number of data bytes in each `PKT_STREAMDT` packet (except possibly the last)
+#define STREAM_CHUNK  128
+
+// Maximum number of unacknowledged `PKT_STREAMDT` packets in flight
+#define STREAM_WINDOW 4
+
+#define MAX_HANDLERS 16
 
 namespace Comm {
 
@@ -28,17 +84,149 @@ struct Packet {
   static void copy_str_P(Packet *pkt, const char *str);
 };
 
-// Sends a packet over Serial.
+/*
+ * Framed mode
+ *
+ * Once both sides report `CAP_FRAMED` in `ping()`, every packet is wrapped in a frame with a start
+ * marker, a sequence number and a CRC-16 over everything after the marker. A receiver that gets a
+ * corrupted frame, a frame from further ahead than expected, or stops getting bytes in the middle of
+ * a frame replies with a NAK holding the sequence number it expected. The sender then goes back and
+ * resends every frame from that one on, out of the last `FRAME_HISTORY` frames it sent. Frames
+ * which have already been received are dropped, and anything between frames is skipped until the
+ * next start marker, so the stream resynchronizes by itself.
+ *
+ * `ping()` is always sent unframed and turns framed mode off on both sides before negotiating it.
+ * An unframed ping from the computer (e.g. one that was restarted) is recognized where a frame could
+ * start, and turns framed mode off as well.
+ */
+
+// Sends a packet over serial.
 void send(Packet *pkt);
 
-// Blocks while reading a packet from Serial.
+// Blocks while reading a packet from serial.
 // Returns true if packet was read successfully, false if timeout occurred.
 // Set `timeout_ms` to 0 to disable timeout.
 bool recv(Packet *pkt, uint16_t timeout_ms = 0);
 
-// Pings connected computer over Serial, returns whether a response was recieved.
+/*
+ * Reads packets a piece at a time, without ever waiting for bytes that haven't arrived yet, so that
+ * the caller can keep the GUI and other work going in between. `recv()` is built on top of it.
+ *
+ * In framed mode, it also NAKs frames that are damaged, out of order or cut off (no byte for
+ * `TIMEOUT_BYTE`), and resends frames that the computer NAKs.
+ */
+class Parser {
+public:
+  enum class Status : uint8_t {
+    NEED_MORE,  // No complete packet yet
+    COMPLETE,   // `pkt` holds a whole packet
+    ERROR,      // A damaged or cut off packet was dropped
+  };
+
+  // Reads whatever has arrived into `pkt`, and returns right away.
+  // The same `pkt` has to be passed each time until `COMPLETE` is returned.
+  Status update(Packet *pkt);
+
+  // Drops anything read so far of the current packet
+  void reset();
+
+  // Returns whether the parser is between packets
+  bool is_idle();
+
+  // Returns whether any bytes outside of packets were skipped (framed mode only)
+  bool had_noise();
+
+private:
+  enum class State : uint8_t {
+    IDLE, NAK_SEQ, NAK_CHK, SEQ, END, DATA, CRC,
+    PING,  // Got what may be the length of an unframed ping while framed, waiting for `PKT_PING`
+  };
+
+  void idle_framed(uint8_t val);
+  void skip();
+
+  Status check_frame(Packet *pkt);
+
+  State m_state = State::IDLE;
+
+  uint8_t m_seq = 0;
+  uint16_t m_index = 0;
+  uint8_t m_crc[2];
+
+  unsigned long m_last_byte = 0;
+  bool m_noise = false;
+  uint8_t m_skipped = 0;  // Bytes skipped since the last start marker (saturates)
+};
+
+/*
+ * Baud rate negotiation
+ *
+ * `PKT_PING` is `[type, caps, rates]` both ways; the computer replies with what both sides support.
+ * If framed mode was agreed on, the fastest common rate that hasn't failed before is tried:
+ *
+ * 1. Device sends `[PKT_BAUD, code]`, computer replies `[PKT_BAUD, code]` (or `0xFF` to refuse).
+ * 2. Both switch rates, then the device sends `[PKT_BAUD, code, pattern...]` and the computer echoes it.
+ * 3. If the echo matches, the device sends `[PKT_BAUD, code]` to confirm. Otherwise, or if the
+ *    computer doesn't get the confirmation in time, both go back to the old rate.
+ *
+ * If a ping at a fast rate goes unanswered, the device falls back to `BAUD_115200` and tries again.
+ * Both sides also fall back, without framing, once they only get garbage: the computer while waiting
+ * for a new packet, the device after `NOISE_FALLBACK` bytes of it or a timeout with nothing else. That
+ * way, a computer that started over and pings at `BAUD_115200` is heard again.
+ */
+
+// Pings connected computer over serial and negotiates capabilities and baud rate.
+// Returns whether a response was recieved.
 bool ping();
 
+// Returns the capabilities (`CAP_xxx`) agreed on in the last `ping()`
+uint8_t get_caps();
+
+// Returns the current baud rate
+uint32_t get_baud();
+
+/*
+ * Windowed streaming
+ *
+ * Bulk data is sent as a series of `PKT_STREAMDT` packets, each `[type, seq, data...]` with up to
+ * `STREAM_CHUNK` data bytes. `seq` counts up from 0 for each stream (wrapping at 256). The receiver
+ * replies to every data packet with `[PKT_STREAMAK, seq]`, which acknowledges that packet and every
+ * one before it. The sender keeps up to `STREAM_WINDOW` packets in flight instead of waiting for each
+ * ack, so the link never sits idle for a round trip. A data packet shorter than `STREAM_CHUNK` ends
+ * the stream early (e.g. at the end of a file).
+ *
+ * The request that starts a stream (e.g. `PKT_STREAMRD`) is sent by the caller beforehand.
+ */
+
+// Receives up to `len` streamed bytes into `buf`, acknowledging each packet.
+// Returns the number of bytes received; stops early on a short packet, an error, or a timeout.
+uint16_t stream_recv(uint8_t *buf, uint16_t len, uint16_t timeout_ms = TIMEOUT_STREAM);
+
+// Receives the next packet of a stream into `pkt` and acknowledges it, so its data can be used where it is
+// (from `pkt->buffer + 2`). `*seq` is the sequence number expected, and is counted up.
+// Returns the number of data bytes, or -1 on an error or a timeout.
+int16_t stream_recv_packet(Packet *pkt, uint8_t *seq, uint16_t timeout_ms = TIMEOUT_STREAM);
+
+// Streams `len` bytes from `buf`, keeping up to `STREAM_WINDOW` packets unacknowledged.
+// Returns the number of bytes whose packets were acknowledged.
+uint16_t stream_send(const uint8_t *buf, uint16_t len, uint16_t timeout_ms = TIMEOUT_STREAM);
+
+// Handles a packet that the computer sent on its own (not as a response to one of ours).
+// The handler may reuse `pkt` to send its reply.
+typedef void (*Handler)(Packet *pkt);
+
+// Registers `handler` to be called by `poll()` for packets whose first byte is `type`.
+// Returns false if there is no room left for another handler.
+bool add_handler(uint8_t type, Handler handler);
+
+// Passes `pkt` to the handler registered for its type. Returns false if there is none.
+bool dispatch(Packet *pkt);
+
+// Reads whatever part of a packet from the computer has arrived, and passes the packet
+// to its handler once it is complete. Never waits for more bytes.
+// If nothing is coming in, sends a packet of the log instead (if there is anything to send).
+void poll();
+
 };
 
 #endif
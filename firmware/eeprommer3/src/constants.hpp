@@ -1,15 +1,16 @@
 #ifndef CONSTANTS_HPP
 #define CONSTANTS_HPP
 
+#include "log.hpp"
 #include "strfmt.hpp"
 
 /*****************************************/
 /** Global Objects ***********************/
 /*****************************************/
 
-#include "HardwareSerial.h"
+#include "serial.hpp"
 
-extern HardwareSerial Serial;
+extern SerialCtrl ser;
 
 /*****************************************/
 /** Compile-Time Constants ***************/
@@ -17,7 +18,18 @@ extern HardwareSerial Serial;
 
 #define DEBUG_MODE
 
-// #define LOGGING
+// Logs with `SER_LOG_PRINT()` to a buffer that is sent to the computer when the link is idle (see `log.hpp`)
+#define LOGGING
+
+// Boots straight to an interactive screen: only a quick XRAM check is done at boot
+// (the full test runs in the background while idle), first-boot XRAM tuning only covers
+// the 8K buffer, fixed delays are shortened and the intro goes on to the menu by itself
+// instead of waiting for "Continue"
+#define FAST_BOOT
+
+// Pin raised while the serial RX buffer is nearly full, for USB adapters with a CTS input
+// (the Mega's own USB chip doesn't have one)
+// #define SER_RTS 49
 
 /*****************************************/
 /** Macros *******************************/
@@ -73,11 +85,16 @@ extern HardwareSerial Serial;
   TftCalc::fraction_x(tft, 10, 1), 24, \
   (text)
 
-// Prints text over Serial if logging is enabled
-// - SER_DEBUG_PRINT(foo, 's') where foo = "bar" => prints "SER_DEBUG_PRINT: foo = bar"
+// Logs text for the computer if logging is enabled (`text` has to be a string literal)
+// - SER_DEBUG_PRINT(foo, "s") where foo = "bar" => logs "foo = bar"
 #ifdef LOGGING
-#define SER_DEBUG_PRINT(var, type) PRINTF_NOBUF(&Serial, STRFMT_P_NOBUF(PSTR("SER_DEBUG_PRINT: %%s = %%%c\n"), type), #var, var)
-#define SER_LOG_PRINT(text, ...) PRINTF_P_NOBUF(&Serial, PSTR("*!* - SER_LOG_PRINT: ...%-12s :%-4d || " text), __FILE__ + max(strlen(__FILE__), 12) - 12, __LINE__, ##__VA_ARGS__)
+#define SER_DEBUG_PRINT(var, fmt) SER_LOG_PRINT(#var " = %" fmt "\n", var)
+#define SER_LOG_PRINT(text, ...)                                                       \
+  do {                                                                                 \
+    static const char log_fmt[] PROGMEM = text;                                        \
+    static const Log::Site log_site PROGMEM = {__LINE__, Log::FILE_NAME, log_fmt};     \
+    Log::write(&log_site, ##__VA_ARGS__);                                              \
+  } while (0)
 #else
 #define SER_DEBUG_PRINT(var, type)
 #define SER_LOG_PRINT(text, ...)
@@ -89,6 +106,9 @@ extern HardwareSerial Serial;
 
 #define XRAM_8K_BUF 0xE000
 
+// Addresses in the ATmega's internal EEPROM
+#define IEE_XRAM_WAITS 0x000
+
 #define SD_CS 10
 #define SD_EN A15
 
@@ -107,4 +127,14 @@ extern HardwareSerial Serial;
 
 #define T_DEBOUNCE 200
 
+#ifdef FAST_BOOT
+#define T_BOOT_SETTLE   50
+#define T_TFT_RESET     20
+#define T_INTRO        300
+#else
+#define T_BOOT_SETTLE 1000
+#define T_TFT_RESET    500
+#define T_INTRO       2000
+#endif
+
 #endif
@@ -0,0 +1,62 @@
+#ifndef CRC_HPP
+#define CRC_HPP
+
+#include <Arduino.h>
+#include "constants.hpp"
+
+/*
+ * Checksums used to detect corrupted data.
+ */
+namespace Crc {
+  // CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF, not reflected
+  constexpr uint16_t CRC16_INIT = 0xFFFF;
+
+  // Adds one byte to a running CRC-16, using a 16-entry (nibble) table to keep flash usage small
+  uint16_t crc16_update(uint16_t crc, uint8_t data);
+
+  // Adds `len` bytes at `buf` to a running CRC-16
+  uint16_t crc16(const uint8_t *buf, uint16_t len, uint16_t crc = CRC16_INIT);
+
+  // CRC-32/ISO-HDLC (as in zlib): polynomial 0x04C11DB7, reflected, initial value and final XOR 0xFFFFFFFF.
+  // Adds `len` bytes at `buf` to a finished CRC-32 (0 for none yet), like zlib's `crc32()`.
+  uint32_t crc32(const uint8_t *buf, uint16_t len, uint32_t crc = 0);
+
+  // Adds one byte to a running CRC-32 that isn't finished, i.e. still without the final XOR
+  uint32_t crc32_update(uint32_t crc, uint8_t data);
+
+  // Fletcher-16: two sums modulo 255, the second in the high byte, both starting at 0.
+  // Much weaker than a CRC, but only two additions per byte.
+  uint16_t fletcher16_update(uint16_t sums, uint8_t data);
+
+  // Algorithms `Engine` can run, as numbered in `PKT_EECSUM`
+  enum Algo : uint8_t {
+    CRC16,
+    CRC32,
+    FLETCHER16,
+  };
+
+  // Keeps a checksum that is fed one byte at a time, so data can be checked as it arrives without being stored
+  class Engine {
+  public:
+    Engine(Algo algo = Algo::CRC32);
+
+    // Starts over, as if no data had been added
+    void reset();
+
+    void update(uint8_t data);
+
+    // The finished checksum of everything added since the last `reset()`
+    uint32_t result() const;
+
+    // Number of bytes in `result()`
+    uint8_t size() const;
+
+    Algo algo() const { return m_algo; }
+
+  private:
+    Algo m_algo;
+    uint32_t m_state;
+  };
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include <Wire/src/Wire.h>
 
 #include "ad_array.hpp"
+#include "crc.hpp"
 #include "new_delete.hpp"
 #include "util.hpp"
 
@@ -76,11 +77,14 @@ void EepromCtrl::write(uint16_t addr, uint8_t data, bool quick) {
   }
 }
 
-void EepromCtrl::read(uint16_t addr1, uint16_t addr2, uint8_t *buf) {
+void EepromCtrl::read(uint16_t addr1, uint16_t addr2, uint8_t *buf, Crc::Engine *sum) {
   uint16_t i = addr1;
 
   do {
-    buf[i - addr1] = read(i);
+    const uint8_t data = read(i);
+
+    if (buf != nullptr) buf[i - addr1] = data;
+    if (sum != nullptr) sum->update(data);
   }
   while (i++ != addr2);
 }
@@ -5,6 +5,7 @@
 #include "constants.hpp"
 
 #include "ad_array.hpp"
+#include "crc.hpp"
 
 #define PORT_A 0
 #define PORT_B 1
@@ -60,10 +61,16 @@ public:
   uint8_t read(uint16_t addr);
   void write(uint16_t addr, uint8_t data, bool quick = false);
 
-  void read(uint16_t addr1, uint16_t addr2, uint8_t *buf);
+  // Reads `addr1` to `addr2` (inclusive) into `buf`, and adds each byte to `sum` as it is read if that is given.
+  // `buf` can be nullptr if only the checksum is needed.
+  void read(uint16_t addr1, uint16_t addr2, uint8_t *buf, Crc::Engine *sum = nullptr);
   void write(uint16_t addr, uint8_t *buf, uint16_t len);
   void write(AddrDataArray *buf);
 
+  // Bytes in a page of the AT28C256. The I/O expanders are too slow to load a whole page within its
+  // byte load cycle time, so writes still take one write cycle per byte; callers only group bytes by page.
+  static constexpr uint8_t PAGE_SIZE = 64;
+
 #ifdef DEBUG_MODE
   IoExpCtrl *get_io_exp(bool which) {
     return &(which ? m_exp_1 : m_exp_0);
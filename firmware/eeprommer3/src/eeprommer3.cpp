@@ -6,7 +6,9 @@
 #include "comm.hpp"
 #include "eeprom.hpp"
 #include "gui.hpp"
+#include "memory.hpp"
 #include "prog.hpp"
+#include "prog_core.hpp"
 #include "sd.hpp"
 #include "tft.hpp"
 #include "tft_util.hpp"
@@ -23,9 +25,10 @@ TftCtrl tft;
 TouchCtrl tch(TS_XP, TS_XM, TS_YP, TS_YM, TS_RESIST);
 SdCtrl sd(SD_CS, SD_EN);
 EepromCtrl ee;
+SerialCtrl ser;
 
 void setup() {
-  delay(1000); // Stabilization delay or else stuff like Serial can be glitchy
+  delay(T_BOOT_SETTLE); // Stabilization delay or else stuff like serial can be glitchy
 
   SdCtrl::Status sd_status = initialize();
 
@@ -52,10 +55,21 @@ void setup() {
     }
   }
 
+  Util::skippable_delay(T_INTRO, TftUtil::Lambdas::is_tching_btn(skip_btn));
+
+#ifdef FAST_BOOT
+  // Straight on to the menu, but wait for a press on "Skip" to end so it doesn't also count as a press there
+  while (tch.is_touching()) {
+    /* wait for release */;
+  }
+#else
   skip_btn.set_text(Strings::L_CONTINUE);
   skip_btn.draw();
+
   delay(1000);  // Delay so button isn't accidentally pressed too early
+
   skip_btn.wait_for_press();
+#endif
 
   SER_LOG_PRINT("\n");
 
@@ -65,12 +79,12 @@ void setup() {
 SdCtrl::Status initialize() {
   Wire.begin();
 
-  Serial.begin(115200);
-#ifdef LOGGING
-  Serial.println(F("=== EEPROMMER3 ==="));
-  Serial.println(F("> Starting up... <"));
-  Serial.println(F(""));
-#endif
+  ser.begin(115200);
+
+  SER_LOG_PRINT("=== EEPROMMER3 ===\n");
+  SER_LOG_PRINT("> Starting up... <\n");
+
+  Memory::init();
 
   SER_LOG_PRINT(
     "Heap configured at addresses 0x%X-0x%X.\n",  // Using %X because the output is more customizable than %p
@@ -78,7 +92,38 @@ SdCtrl::Status initialize() {
     reinterpret_cast<uintptr_t>(__malloc_heap_end)
   );
 
-  xram::init(0x00, 0x01);
+  // Start out at the slowest timing; it is safe on any RAM chip
+  xram::init(xram::MAX_WAITS, 0x01);
+
+  uint8_t waits;
+
+  if (!xram::load_waits(&waits)) {
+#ifdef FAST_BOOT
+    // Only over the 8K buffer, like the "Tune XRAM" action: all 32K would take seconds with interrupts off
+    const auto res = xram::tune(XRAM_8K_BUF, 0x2000);
+#else
+    // Nothing has been allocated yet, so the whole heap can be used for tuning
+    const auto res = xram::tune(0x8000, 0x8000);
+#endif
+
+    waits = res.waits;
+
+    // If nothing passed, tuning is tried again on the next boot
+    if (res.passed != 0x00) xram::save_waits(waits);
+
+    SER_LOG_PRINT("Tuned XRAM to %u wait states.\n", waits);
+  }
+
+  xram::init(waits, 0x01);
+
+#ifdef FAST_BOOT
+  // The full test is done a chunk at a time by `Util::idle()`
+  bool xr_ok = xram::quick_test();
+  UNUSED_VAR(xr_ok);
+
+  SER_LOG_PRINT("Initialized XRAM!\n");
+  SER_LOG_PRINT("- Quick test %s.\n", xr_ok ? "passed" : "FAILED");
+#else
   auto xr = xram::test();
 
   char percentage[10];
@@ -86,6 +131,18 @@ SdCtrl::Status initialize() {
 
   SER_LOG_PRINT("Initialized XRAM!\n");
   SER_LOG_PRINT("- Verified %u/32768 bytes (%s%%) in %lums.\n", xr.successes, percentage, xr.time);
+#endif
+
+  // The heap is in XRAM, so the large serial buffer can't be allocated before this
+  if (ser.set_rx_buffer(SerialCtrl::RX_BUF_SIZE)) {
+    SER_LOG_PRINT("Serial RX buffer is %u bytes.\n", SerialCtrl::RX_BUF_SIZE);
+  }
+
+#ifdef LOGGING
+  if (Log::set_buffer()) {
+    SER_LOG_PRINT("Log buffer is %u bytes.\n", Log::BUF_SIZE);
+  }
+#endif
 
   tft.init(TFT_DRIVER, 1);
   tft.fillScreen(TftColor::BLACK);
@@ -94,6 +151,9 @@ SdCtrl::Status initialize() {
   ee.init();
   SER_LOG_PRINT("Initialized EEPROM!\n");
 
+  // Remote requests can be handled from here on, e.g. while the intro is shown
+  ProgrammerRemoteCore::init();
+
   SdCtrl::Status res = sd.init();
   SER_LOG_PRINT("Initialized SD...\n");
 
@@ -101,23 +161,23 @@ SdCtrl::Status initialize() {
 }
 
 void draw_intro(uint16_t x, uint16_t y, Gui::Btn *skip_btn) {
-  if (sd.is_enabled()) {
-    tft.drawRGBBitmapFromFile(x, y, "startup.bin", 320, 240, true, TftUtil::Lambdas::is_tching_btn(*skip_btn));
+  if (sd.is_enabled() && tft.drawImageFromFile(x, y, "startup.e3i", TftUtil::Lambdas::is_tching_btn(*skip_btn))) {
+    return;
   }
-  else {
-    tft.drawThickRect(x, y, 320, 240, TftColor::CYAN, 4);
-    tft.drawText_P(TftCalc::t_center_x(tft, 10, 4), y + 10, Strings::L_PROJ_NAME, TftColor::ORANGE, 4);
-    tft.drawText_P(TftCalc::t_center_x(tft, 15, 2), y + 50, Strings::L_INTRO1,    TftColor::BLUE,   2);
-    tft.drawText_P(TftCalc::t_center_x(tft, 18, 2), y + 90, Strings::L_INTRO2,    TftColor::CYAN,   2);
 
-    tft.fillCircle   (x + 135, y + 140, 20,     TftColor::CYAN);
-    tft.fillRect     (x + 175, y + 120, 40, 40, TftColor::DGRAY);
-    tft.drawThickRect(x + 175, y + 120, 40, 40, TftColor::LGRAY, 2);
+  // Covers up whatever part of the image was drawn before it couldn't be read
+  tft.fillRect(x, y, 320, 240, TftColor::BLACK);
 
-    tft.drawText_P(x + 10, y + 190, Strings::W_LOAD, TftColor::PURPLE, 3);
+  tft.drawThickRect(x, y, 320, 240, TftColor::CYAN, 4);
+  tft.drawText_P(TftCalc::t_center_x(tft, 10, 4), y + 10, Strings::L_PROJ_NAME, TftColor::ORANGE, 4);
+  tft.drawText_P(TftCalc::t_center_x(tft, 15, 2), y + 50, Strings::L_INTRO1,    TftColor::BLUE,   2);
+  tft.drawText_P(TftCalc::t_center_x(tft, 18, 2), y + 90, Strings::L_INTRO2,    TftColor::CYAN,   2);
 
-    Util::skippable_delay(2000, TftUtil::Lambdas::is_tching_btn(*skip_btn));
-  }
+  tft.fillCircle   (x + 135, y + 140, 20,     TftColor::CYAN);
+  tft.fillRect     (x + 175, y + 120, 40, 40, TftColor::DGRAY);
+  tft.drawThickRect(x + 175, y + 120, 40, 40, TftColor::LGRAY, 2);
+
+  tft.drawText_P(x + 10, y + 190, Strings::W_LOAD, TftColor::PURPLE, 3);
 }
 
 void mainprog() {
@@ -3,22 +3,31 @@
 
 #include "comm.hpp"
 #include "dialog.hpp"
+#include "eeprom.hpp"
 #include "error.hpp"
 #include "gui.hpp"
+#include "memory.hpp"
 #include "new_delete.hpp"
 #include "sd.hpp"
 #include "tft.hpp"
 #include "tft_calc.hpp"
 #include "tft_util.hpp"
 #include "util.hpp"
+#include "xram.hpp"
 
 #include "file.hpp"
 
+extern EepromCtrl ee;
+
+// How much of the RAM disk is in use, kept between files
+static uint16_t ram_disk_size = 0;
+
 namespace Gui {
 
 MenuSdFileSel::MenuSdFileSel(uint8_t pad_v, uint8_t pad_h, uint8_t marg_v, uint8_t marg_h, uint8_t rows, uint8_t cols) :
   MenuChoice(pad_v, pad_h, marg_v, marg_h, calc_num_cols(cols), calc_btn_height(rows, marg_v, pad_v), true) {
-  m_num_rows = rows;  // NOLINT(cppcoreguidelines-prefer-member-initializer): init list taken by delegated ctor
+  m_num_rows  = rows;  // NOLINT(cppcoreguidelines-prefer-member-initializer): init list taken by delegated ctor
+  m_num_slots = rows * m_num_cols;  // NOLINT(cppcoreguidelines-prefer-member-initializer): same
 
   for (uint8_t j = 0; j < m_num_rows; ++j) {
     for (uint8_t i = 0; i < m_num_cols; ++i) {
@@ -26,66 +35,113 @@ MenuSdFileSel::MenuSdFileSel(uint8_t pad_v, uint8_t pad_h, uint8_t marg_v, uint8
     }
   }
 
-  const uint16_t _w = TftCalc::fraction_x(tft, 10, 1);
+  const uint16_t _w = TftCalc::fraction_x(tft, 10, 1) - 2 * (40 + 10);
+  const uint16_t _x = TftCalc::right(tft, 40, 10);
   const uint16_t _y = TftCalc::bottom(tft, 24, 44);
 
-  add_btn(new Btn(10, _y, _w, 24, Strings::L_CANCEL, TftColor::PINKK, TftColor::RED));
+  add_btn(new Btn(10 + 40 + 10, _y, _w, 24, Strings::L_CANCEL, TftColor::PINKK, TftColor::RED));
+  add_btn(new Btn(10, _y, 40, 24, Strings::L_ARROW_L, TftColor::WHITE, TftColor::DGRAY));
+  add_btn(new Btn(_x, _y, 40, 24, Strings::L_ARROW_R, TftColor::WHITE, TftColor::DGRAY));
   add_btn_confirm(true);
 
   init_files();
 }
 
 void MenuSdFileSel::init_files() {
-  const uint8_t max_files = m_num_cols * m_num_rows;
-
-  m_files = (SdFileInfo *) malloc(max_files * sizeof(SdFileInfo));
-
   if (!SD.exists(Strings::M_FILE_DIR)) {
     SD.mkdir(Strings::M_FILE_DIR);
   }
 
-  m_num_files = sd.get_files(Strings::M_FILE_DIR, m_files, max_files);
+  m_index = sd.get_index(Strings::M_FILE_DIR);
+
+  const uint16_t num_files = (m_index == nullptr ? 0 : m_index->size());
 
-  uint8_t i = 0;
+  m_num_pages = MAX(1, (num_files + m_num_slots - 1) / m_num_slots);
 
-  // Update and enable all the needed buttons.
-  for (/* no init clause */; i < m_num_files; ++i) {
-    get_btn(i)->visibility(true)->set_text(m_files[i].name);
+  show_page();
+}
 
-    if (m_files[i].is_dir) {
-      get_btn(i)->set_fg(TftColor::LGRAY)->set_bg(TftColor::DGRAY)->operation(false);
+// Updates the buttons to show the files on `m_page`
+void MenuSdFileSel::show_page() {
+  for (uint8_t i = 0; i < m_num_slots; ++i) {
+    const SdFileInfo *info = (m_index == nullptr ? nullptr : m_index->get(m_page * m_num_slots + i));
+    Btn *btn = get_btn(i);
+
+    if (info == nullptr) {
+      btn->visibility(false)->operation(false);
+    }
+    else if (info->is_dir()) {
+      btn->visibility(true)->operation(false)->set_text(info->name)->set_fg(TftColor::LGRAY)->set_bg(TftColor::DGRAY);
+    }
+    else {
+      btn->visibility(true)->operation(true)->set_text(info->name)->set_fg(TftColor::BLACK)->set_bg(TftColor::WHITE);
     }
   }
 
-  // Disable everything else except the control buttons.
-  for (/* no init clause */; i < get_num_btns() - 2; ++i) {
-    get_btn(i)->visibility(false)->operation(false);
-  }
+  get_btn(btn_prev())->operation(m_page > 0);
+  get_btn(btn_next())->operation(m_page + 1 < m_num_pages);
 }
 
 MenuSdFileSel::~MenuSdFileSel() {
-  free(m_files);
+  // Empty
 }
 
 MenuSdFileSel::Status MenuSdFileSel::wait_for_value(char *file_path, uint8_t max_path_len) {
   if (max_path_len <= 2) return Status::FNAME_TOO_LONG;
 
-  if (m_num_files == 0) {
-    select(m_num_btns - 2);  // Cancel button
+  if (m_index == nullptr || m_index->size() == 0) {
+    select(btn_cancel());
     tft.drawText_P(10, 50, Strings::L_NO_FILES, TftColor::PINKK);
   }
 
-  uint8_t btn_id = MenuChoice::wait_for_value();
+  draw();
+
+  // Like `MenuChoice::wait_for_value()`, but the arrows turn the page instead of being chosen
+  while (true) {
+    if (m_num_pages > 1) {
+      tft.drawTextBg(10, 38, STRFMT_P_NOBUF(Strings::L_PAGE_N_N, m_page, m_num_pages - 1), TftColor::LGRAY, TftColor::BLACK, 1);
+    }
+
+    const uint8_t btn_pressed = wait_for_press();
+
+    if ((btn_pressed == btn_prev() || btn_pressed == btn_next()) && get_btn(btn_pressed)->flags.operational) {
+      m_page += (btn_pressed == btn_next() ? 1 : -1);
+
+      for (uint8_t i = 0; i < m_num_slots; ++i) {
+        get_btn(i)->erase();
+      }
+
+      show_page();
+      select(get_btn(0)->flags.operational ? 0 : btn_cancel());
+
+      for (uint8_t i = 0; i < m_num_slots; ++i) {
+        get_btn(i)->draw();
+      }
+
+      update();
+      get_btn(btn_prev())->draw();
+      get_btn(btn_next())->draw();
+    }
+    else if (btn_pressed == m_confirm_btn) {
+      if (get_btn(m_cur_choice)->flags.operational) break;
+    }
+    else if (btn_pressed != btn_prev() && btn_pressed != btn_next()) {
+      select(btn_pressed);
+      update();
+    }
+  }
 
-  if (btn_id == get_num_btns() - 2) {
+  if (m_cur_choice == btn_cancel()) {
     return Status::CANCELED;
   }
 
-  if (strlen(Strings::M_FILE_DIR) + strlen(m_files[btn_id].name) >= max_path_len) {
+  const char *name = m_index->get(m_page * m_num_slots + m_cur_choice)->name;
+
+  if (strlen(Strings::M_FILE_DIR) + strlen(name) >= max_path_len) {
     return Status::FNAME_TOO_LONG;
   }
 
-  snprintf_P(file_path, max_path_len, PSTR("%s%s"), Strings::M_FILE_DIR, m_files[btn_id].name);
+  snprintf_P(file_path, max_path_len, PSTR("%s%s"), Strings::M_FILE_DIR, name);
   return Status::OK;
 }
 
@@ -93,7 +149,7 @@ MenuSdFileSel::Status MenuSdFileSel::wait_for_value(char *file_path, uint8_t max
 
 namespace Dialog {
 
-FileCtrl *ask_file(const char *prompt, uint8_t access, AskFileStatus *status, bool must_exist) {
+FileCtrl *ask_file(const char *prompt, uint8_t access, AskFileStatus *status, bool must_exist, uint32_t size) {
   FileSystem fsys = ask_fsys(Strings::P_FILE_TYPE);
   tft.fillScreen(TftColor::BLACK);
 
@@ -110,10 +166,14 @@ FileCtrl *ask_file(const char *prompt, uint8_t access, AskFileStatus *status, bo
 
   case FileSystem::ON_SD_CARD:
     *status = ask_file_sd(prompt, fpath, ARR_LEN(fpath), must_exist);
-    return FileCtrl::create_file(fsys, fpath, access);
+    return (*status == AskFileStatus::OK ? FileCtrl::create_file(fsys, fpath, access, size) : nullptr);
 
   case FileSystem::ON_SERIAL:
     *status = ask_file_serial(prompt, must_exist);
+    return (*status == AskFileStatus::OK ? FileCtrl::create_file(fsys, "", access) : nullptr);
+
+  case FileSystem::IN_XRAM:
+    *status = AskFileStatus::OK;
     return FileCtrl::create_file(fsys, "", access);
 
   default:
@@ -169,12 +229,23 @@ AskFileStatus ask_file_serial(const char *prompt, bool must_exist) {
 
   show_error(ErrorLevel::INFO, 0x3, Strings::W_SOFTWARE, Strings::L_SOFTWARE);
 
-  do {
-    Comm::recv(&pkt);
+  Gui::Btn cancel_btn(BOTTOM_BTN(Strings::L_CANCEL), TftColor::PINKK, TftColor::DRED);
+  cancel_btn.draw();
+
+  // The user may take a while, so keep answering the computer's other requests in the meantime
+  Comm::Parser parser;
+
+  while (!cancel_btn.is_pressed()) {
+    if (parser.update(&pkt) != Comm::Parser::Status::COMPLETE) continue;
+
+    if (pkt.buffer[0] == PKT_FILEOPEN) {
+      return AskFileStatus::OK;
+    }
+
+    Comm::dispatch(&pkt);
   }
-  while (pkt.buffer[0] != PKT_FILEOPEN);
 
-  return AskFileStatus::OK;
+  return AskFileStatus::CANCELED;
 }
 
 FileSystem ask_fsys(const char *prompt) {
@@ -183,6 +254,7 @@ FileSystem ask_fsys(const char *prompt) {
   Gui::MenuChoice menu(10, 10, 50, 10, 1, 40, true, 0);
   menu.add_btn_calc(Strings::L_FILE_SD,  TftColor::LGREEN, TftColor::DGREEN);
   menu.add_btn_calc(Strings::L_FILE_SER, TftColor::CYAN,   TftColor::BLUE  );
+  menu.add_btn_calc(Strings::L_FILE_RAM, TftColor::YELLOW, TftColor::OLIVE );
   menu.add_btn_calc(Strings::L_CANCEL,   TftColor::PINKK,  TftColor::DRED  );
   menu.add_btn_confirm(true);
 
@@ -190,6 +262,7 @@ FileSystem ask_fsys(const char *prompt) {
 
   if (~avail & FileSystem::ON_SD_CARD) menu.get_btn(0)->operation(false);
   if (~avail & FileSystem::ON_SERIAL)  menu.get_btn(1)->operation(false);
+  if (~avail & FileSystem::IN_XRAM)    menu.get_btn(2)->operation(false);
 
   const uint8_t btn_pressed = menu.wait_for_value();
   const uint8_t btn_cancel  = menu.get_num_btns() - 2;
@@ -198,6 +271,7 @@ FileSystem ask_fsys(const char *prompt) {
     switch (btn_pressed) {
     case 0: return FileSystem::ON_SD_CARD;
     case 1: return FileSystem::ON_SERIAL;
+    case 2: return FileSystem::IN_XRAM;
     }
   }
 
@@ -206,67 +280,260 @@ FileSystem ask_fsys(const char *prompt) {
 
 };
 
-FileCtrl *FileCtrl::create_file(FileSystem fsys, const char *path, uint8_t access) {
+FileCtrl *FileCtrl::create_file(FileSystem fsys, const char *path, uint8_t access, uint32_t size) {
+  Memory::Scope scope(Memory::Tag::FILES);
+
+  FileCtrl *file;
+
   switch (fsys) {
-  case FileSystem::ON_SD_CARD: return new FileCtrlSd(path, access);
-  case FileSystem::ON_SERIAL:  return new FileCtrlSerial(path, access);
+  case FileSystem::ON_SD_CARD: file = new FileCtrlSd(path, access, size); break;
+  case FileSystem::ON_SERIAL:  file = new FileCtrlSerial(path, access);   break;
+  case FileSystem::ON_EEPROM:  file = new FileCtrlEeprom;                  break;
+  case FileSystem::IN_XRAM:
+    file = new FileCtrlXram(
+      (uint8_t *) xram::access(FileCtrlXram::RAM_DISK_ADDR), FileCtrlXram::RAM_DISK_SIZE, &ram_disk_size, access
+    );
+    break;
   case FileSystem::NONE:
   default:
     return nullptr;
   }
+
+  // Image files from the SD card or the computer that are only read may be compressed. Anything written is left
+  // plain, and so is data in the chip or the RAM disk, which is copied as it is even if it happens to look compressed.
+  const bool from_image = (fsys == FileSystem::ON_SD_CARD || fsys == FileSystem::ON_SERIAL);
+
+  return (from_image && !(access & O_WRITE) ? FileCtrlCompressed::open_if_compressed(file) : file);
 }
 
 bool FileCtrl::check_valid(FileCtrl *file) {
   return (file != nullptr) && (file->is_open());
 }
 
-FileCtrlSd::FileCtrlSd(const char *path, uint8_t access) {
-  m_file = SD.open(path, access);
+FileCtrl::~FileCtrl() {
+  free(m_spare);
+}
+
+FileCtrl::Span FileCtrl::acquire_read(uint16_t max) {
+  if (m_spare_pos == m_spare_len) {
+    if (m_spare == nullptr) {
+      Memory::Scope scope(Memory::Tag::FILES);
+
+      m_spare = (uint8_t *) malloc(SPARE_SIZE);
+      if (m_spare == nullptr) return {nullptr, 0};
+    }
+
+    // No more than was asked for, so nothing is left over once it has all been committed
+    m_spare_len = read(m_spare, MIN(max, SPARE_SIZE));
+    m_spare_pos = 0;
+  }
+
+  return {m_spare + m_spare_pos, (uint16_t) MIN(max, m_spare_len - m_spare_pos)};
+}
+
+void FileCtrl::commit(uint16_t n) {
+  m_spare_pos += n;
+}
+
+const Catalog::Entry *FileCtrl::checksums() {
+  return nullptr;
+}
+
+FileCtrlSd::FileCtrlSd(const char *path, uint8_t access, uint32_t size) {
   fsys = FileSystem::ON_SD_CARD;
+
+  if (access & O_WRITE) {
+    // The directory may be about to change, and the file's old checksums won't be right any more
+    sd.invalidate_index();
+
+    const char *name = Catalog::name_in_dir(path);
+    if (name != nullptr) Catalog::remove(name);
+  }
+
+  if (size != 0 && (access & O_TRUNC)) {
+    // Falls back to `m_file` if there is no room for a contiguous file
+    m_writer = new SdWriter;
+
+    if (m_writer->open(path, size)) {
+      begin_checksums(path, access);
+      return;
+    }
+
+    delete m_writer;
+    m_writer = nullptr;
+  }
+
+  m_file = SD.open(path, access);
+
+  if (!m_file) return;
+
+  begin_checksums(path, access);
+
+  if (access & O_WRITE) return;
+
+  // Falls back to `m_file` if the reader can't handle this file
+  m_reader = new SdReader;
+
+  if (!m_reader->open(path)) {
+    delete m_reader;
+    m_reader = nullptr;
+  }
 }
 
 FileCtrlSd::~FileCtrlSd() {
-  m_file.close();
+  close();
 }
 
 bool FileCtrlSd::is_open() {
-  return m_file.operator bool();
+  return (m_writer != nullptr || m_file.operator bool());
 }
 
 const char *FileCtrlSd::name() {
-  return m_file.name();
+  return (m_writer != nullptr ? m_writer->name() : m_file.name());
 }
 
-uint16_t FileCtrlSd::size() {
-  return m_file.size();
+uint32_t FileCtrlSd::size() {
+  if (m_writer != nullptr) return m_writer->position();
+
+  return (m_reader != nullptr ? m_reader->size() : m_file.size());
 }
 
-bool FileCtrlSd::seek(uint16_t position) {
-  return m_file.seek(position);
+bool FileCtrlSd::seek(uint32_t position) {
+  // Contiguous files are only written front to back
+  if (m_writer != nullptr) return (position == m_writer->position());
+
+  // Checksums are only worked out from data that is accessed in order, but reading can start over
+  if (m_sums != nullptr && !m_sums_done && position != m_sums->size) {
+    if (position == 0 && !m_writing) {
+      char name[sizeof(m_sums->name)];
+      strcpy(name, m_sums->name);
+
+      Catalog::begin(m_sums, name);
+    }
+    else {
+      drop_checksums();
+    }
+  }
+
+  return (m_reader != nullptr ? m_reader->seek(position) : m_file.seek(position));
 }
 
 uint8_t FileCtrlSd::read() {
-  return m_file.read();
+  uint8_t val = 0x00;
+  read(&val, 1);
+
+  return val;
 }
 
 uint16_t FileCtrlSd::read(uint8_t *buf, uint16_t size) {
-  return m_file.read(buf, size);
+  if (m_writer != nullptr) return 0;
+
+  const uint16_t len = (m_reader != nullptr ? m_reader->read(buf, size) : m_file.read(buf, size));
+  add_checksums(buf, len);
+
+  return len;
 }
 
 void FileCtrlSd::write(uint8_t val) {
-  m_file.write(val);
+  write(&val, 1);
 }
 
 uint16_t FileCtrlSd::write(const uint8_t *buf, uint16_t size) {
-  return m_file.write(buf, size);
+  const uint16_t len = (m_writer != nullptr ? m_writer->write(buf, size) : m_file.write(buf, size));
+  add_checksums(buf, len);
+
+  return len;
 }
 
 void FileCtrlSd::flush() {
-  m_file.flush();
+  // A contiguous file can't be flushed without ending its multi-block write, so that waits for `close()`
+  if (m_writer == nullptr) m_file.flush();
 }
 
 void FileCtrlSd::close() {
+  delete m_reader;
+  m_reader = nullptr;
+
+  delete m_writer;
+  m_writer = nullptr;
+
   m_file.close();
+
+  // Only now is the file's directory entry up to date
+  if (m_sums != nullptr && m_sums_store) Catalog::store(m_sums);
+
+  drop_checksums();
+}
+
+FileCtrl::Span FileCtrlSd::acquire_read(uint16_t max) {
+  // The SD library's block cache can't be lent out, so other files are read into a spare buffer
+  if (m_reader == nullptr) return FileCtrl::acquire_read(max);
+
+  uint16_t len;
+  m_lent = m_reader->acquire(max, &len);
+
+  return {m_lent, len};
+}
+
+void FileCtrlSd::commit(uint16_t n) {
+  if (m_reader == nullptr) {
+    FileCtrl::commit(n);
+    return;
+  }
+
+  add_checksums(m_lent, n);
+  m_reader->commit(n);
+}
+
+const Catalog::Entry *FileCtrlSd::checksums() {
+  return (m_sums_done ? m_sums : nullptr);
+}
+
+// Loads the file's checksums from the catalog, or gets ready to work them out, if it is in the catalog's directory
+void FileCtrlSd::begin_checksums(const char *path, uint8_t access) {
+  const char *name = Catalog::name_in_dir(path);
+  if (name == nullptr) return;
+
+  // Appending or changing part of a file can't be followed
+  if ((access & O_WRITE) && !(access & O_TRUNC)) return;
+
+  m_sums = (Catalog::Entry *) malloc(sizeof(Catalog::Entry));
+  if (m_sums == nullptr) return;
+
+  m_writing = (access & O_WRITE);
+
+  if (!m_writing && Catalog::find(name, m_sums)) {
+    m_sums_done = true;
+    return;
+  }
+
+  Catalog::begin(m_sums, name);
+
+  // A new file is all written here, so its checksums are always right
+  m_sums_store = m_writing;
+}
+
+void FileCtrlSd::add_checksums(const uint8_t *buf, uint16_t len) {
+  if (m_sums == nullptr || m_sums_done) return;
+
+  if (!Catalog::add(m_sums, buf, len)) {
+    drop_checksums();
+    return;
+  }
+
+  // Only reads can tell when the whole file has been seen
+  if (!m_writing && m_sums->size == size()) {
+    m_sums_done  = true;
+    m_sums_store = true;
+  }
+}
+
+void FileCtrlSd::drop_checksums() {
+  free(m_sums);
+  m_sums = nullptr;
+
+  m_sums_done  = false;
+  m_sums_store = false;
 }
 
 FileCtrlSerial::FileCtrlSerial(const char *path, uint8_t access) {
@@ -276,124 +543,572 @@ FileCtrlSerial::FileCtrlSerial(const char *path, uint8_t access) {
   Comm::send(&pkt);
 
   fsys = FileSystem::ON_SERIAL;
+
+  m_pkt = (Comm::Packet *) malloc(sizeof(Comm::Packet));
 }
 
 FileCtrlSerial::~FileCtrlSerial() {
-  // Empty
+  free(m_pkt);
 }
 
 bool FileCtrlSerial::is_open() {
-  return true;
+  return m_pkt != nullptr;
 }
 
 const char *FileCtrlSerial::name() {
   return "<serial-file>";
 }
 
-uint16_t FileCtrlSerial::size() {
+uint32_t FileCtrlSerial::size() {
+  end_stream();
+
   Comm::Packet pkt = {0x00, {PKT_FILESIZE}};
   Comm::send(&pkt);
-  Comm::recv(&pkt);
 
-  if (pkt.buffer[0] != PKT_FILESIZE) {
+  if (!Comm::recv(&pkt, TIMEOUT_FILEREAD) || pkt.buffer[0] != PKT_FILESIZE) {
     return 0; // Recieved the wrong packet, error
   }
 
-  return pkt.buffer[1] | (pkt.buffer[2] << 8);
+  uint32_t size = pkt.buffer[1] | ((uint16_t) pkt.buffer[2] << 8);
+
+  if (pkt.end >= 4) {
+    size |= ((uint32_t) pkt.buffer[3] << 16) | ((uint32_t) pkt.buffer[4] << 24);
+  }
+
+  return size;
 }
 
-bool FileCtrlSerial::seek(uint16_t position) {
+bool FileCtrlSerial::seek(uint32_t position) {
+  drop_stream();
+
   Comm::Packet pkt = {0x02, {PKT_FILESEEK, (uint8_t) (position & 0xFF), (uint8_t) (position >> 8)}};
+
+  if (Comm::get_caps() & CAP_OFFSET32) {
+    pkt.end = 0x04;
+    pkt.buffer[3] = (position >> 16) & 0xFF;
+    pkt.buffer[4] = position >> 24;
+  }
+  else if (position > 0xFFFF) {
+    return false;  // Computer only knows about 16-bit offsets
+  }
+
   Comm::send(&pkt);
+  m_pos = position;
 
   return true;
 }
 
 uint8_t FileCtrlSerial::read() {
+  end_stream();
+
   Comm::Packet pkt = {0x01, {PKT_FILEREAD, 0x00}};
   Comm::send(&pkt);
-  Comm::recv(&pkt);
+
+  if (!Comm::recv(&pkt, TIMEOUT_FILEREAD)) {
+    return 0x00; // Computer stopped responding
+  }
+
+  ++m_pos;
 
   return pkt.buffer[0];
 }
 
 uint16_t FileCtrlSerial::read(uint8_t *buf, uint16_t size) {
-  Comm::Packet pkt = {0x01, {PKT_FILEREAD, 0xFF /* dummy */}};
-  Comm::Packet data;
-
-  uint16_t offset = 0;
-
-  while (size > offset) {
-    bool full_page = (size - offset) >= 0x0100;
-    pkt.buffer[1] = full_page ? 0xFF : (uint8_t) (size & 0xFF) - 1;
-
-    Comm::send(&pkt);
-    if (!Comm::recv(&data, TIMEOUT_FILEREAD)) {
-      break;  // Abort (file exhausted)
-    }
+  uint16_t done = 0;
 
-    memcpy(buf + offset, data.buffer, (uint16_t) data.end + 1);
+  while (done < size) {
+    const Span span = acquire_read(size - done);
+    if (span.len == 0) break;
 
-    offset = full_page ? offset + 0x0100 : size;
+    memcpy(buf + done, span.data, span.len);
+    commit(span.len);
 
-    // Didn't get enough data
-    if (data.end < pkt.buffer[1]) {
-      offset += (uint16_t) data.end + 1;
-      break;  // Abort (file exhausted) after updating offset
-    }
+    done += span.len;
   }
 
-  return offset;
+  return done;
 }
 
 void FileCtrlSerial::write(uint8_t val) {
+  end_stream();
+
   Comm::Packet pkt = {0x00, {PKT_FILEWRIT}};
   Comm::send(&pkt);
   pkt.buffer[0] = val;
   Comm::send(&pkt);
 
   // Wait for operation to finish
-  Comm::recv(&pkt);
+  Comm::recv(&pkt, TIMEOUT_FILEREAD);
+
+  ++m_pos;
 }
 
 uint16_t FileCtrlSerial::write(const uint8_t *buf, uint16_t size) {
-  Comm::Packet pkt = {0x00, {PKT_FILEWRIT}};
-  Comm::Packet data;
-
-  uint16_t offset = 0;
+  end_stream();
 
-  while (size > offset) {
-    if ((size - offset) >= 0x0100) {
-      data.end = 0xFF;
-      memcpy(data.buffer, buf + offset, 0x0100);
-      offset += 0x0100;
-    }
-    else {
-      data.end = (uint8_t) (size & 0xFF) - 1;
-      memcpy(data.buffer, buf + offset, size & 0xFF);
-      offset = size;
-    }
-
-    Comm::send(&pkt);
-    Comm::send(&data);
+  Comm::Packet pkt = {0x02, {PKT_STREAMWR, (uint8_t) (size & 0xFF), (uint8_t) (size >> 8)}};
+  Comm::send(&pkt);
 
-    // Wait for operation to finish
-    Comm::recv(&data);
-  }
+  const uint16_t len = Comm::stream_send(buf, size);
+  m_pos += len;
 
-  return size;
+  return len;
 }
 
 void FileCtrlSerial::flush() {
+  end_stream();
+
   Comm::Packet pkt = {0x00, {PKT_FILEFLUS}};
   Comm::send(&pkt);
 }
 
 void FileCtrlSerial::close() {
+  drop_stream();
+
   Comm::Packet pkt = {0x00, {PKT_FILECLOS}};
   Comm::send(&pkt);
 }
 
+FileCtrl::Span FileCtrlSerial::acquire_read(uint16_t max) {
+  if (m_pkt == nullptr || max == 0) return {nullptr, 0};
+
+  if (m_pkt_pos == m_pkt_len) {
+    if (m_stream_left == 0) {
+      // Asks for all of `max` at once, so the computer can keep the stream's window full
+      Comm::Packet req = {0x03, {PKT_STREAMRD, (uint8_t) (max & 0xFF), (uint8_t) (max >> 8), STREAM_WINDOW}};
+      Comm::send(&req);
+
+      m_stream_left = max;
+      m_seq = 0;
+    }
+
+    const int16_t count = Comm::stream_recv_packet(m_pkt, &m_seq, TIMEOUT_FILEREAD);
+
+    m_pkt_pos = 0;
+    m_pkt_len = (count < 0 ? 0 : MIN((uint16_t) count, m_stream_left));
+
+    // A short packet ends the stream early, at the end of the file
+    m_stream_left = (count < STREAM_CHUNK ? 0 : m_stream_left - m_pkt_len);
+  }
+
+  return {m_pkt->buffer + 2 + m_pkt_pos, (uint16_t) MIN(max, m_pkt_len - m_pkt_pos)};
+}
+
+void FileCtrlSerial::commit(uint16_t n) {
+  m_pkt_pos += n;
+  m_pos     += n;
+}
+
+// Lets the rest of the current stream arrive and throws it away, so that the computer takes requests again
+void FileCtrlSerial::drop_stream() {
+  while (m_stream_left > 0) {
+    const int16_t count = Comm::stream_recv_packet(m_pkt, &m_seq, TIMEOUT_FILEREAD);
+    if (count < STREAM_CHUNK) break;
+
+    m_stream_left -= MIN((uint16_t) count, m_stream_left);
+  }
+
+  m_stream_left = 0;
+  m_pkt_pos = m_pkt_len = 0;
+}
+
+// Same, but the computer is then put back where the file was committed up to, as it had sent more than that
+void FileCtrlSerial::end_stream() {
+  if (m_stream_left == 0 && m_pkt_pos == m_pkt_len) return;
+
+  seek(m_pos);
+}
+
+FileCtrlXram::FileCtrlXram(uint8_t *base, uint16_t capacity, uint16_t *size, uint8_t access) :
+  m_base(base), m_capacity(capacity), m_size(size) {
+  fsys = FileSystem::IN_XRAM;
+
+  if (access & O_TRUNC) *m_size = 0;
+}
+
+FileCtrlXram::~FileCtrlXram() {
+  // Empty
+}
+
+bool FileCtrlXram::is_open() {
+  return xram::is_initialized();
+}
+
+const char *FileCtrlXram::name() {
+  return "<ram-disk>";
+}
+
+uint32_t FileCtrlXram::size() {
+  return *m_size;
+}
+
+bool FileCtrlXram::seek(uint32_t position) {
+  if (position > *m_size) return false;
+
+  m_pos = position;
+  return true;
+}
+
+uint8_t FileCtrlXram::read() {
+  uint8_t val = 0x00;
+  read(&val, 1);
+
+  return val;
+}
+
+uint16_t FileCtrlXram::read(uint8_t *buf, uint16_t size) {
+  const uint16_t len = MIN(size, *m_size - m_pos);
+
+  memcpy(buf, m_base + m_pos, len);
+  m_pos += len;
+
+  return len;
+}
+
+void FileCtrlXram::write(uint8_t val) {
+  write(&val, 1);
+}
+
+uint16_t FileCtrlXram::write(const uint8_t *buf, uint16_t size) {
+  const uint16_t len = MIN(size, m_capacity - m_pos);
+
+  // `buf` may be in XRAM too
+  memmove(m_base + m_pos, buf, len);
+  m_pos += len;
+
+  if (m_pos > *m_size) *m_size = m_pos;
+
+  return len;
+}
+
+void FileCtrlXram::flush() {
+  // Empty
+}
+
+void FileCtrlXram::close() {
+  // Empty
+}
+
+FileCtrl::Span FileCtrlXram::acquire_read(uint16_t max) {
+  return {m_base + m_pos, (uint16_t) MIN(max, *m_size - m_pos)};
+}
+
+void FileCtrlXram::commit(uint16_t n) {
+  m_pos += n;
+}
+
+FileCtrlEeprom::FileCtrlEeprom() {
+  fsys = FileSystem::ON_EEPROM;
+}
+
+FileCtrlEeprom::~FileCtrlEeprom() {
+  // Empty
+}
+
+bool FileCtrlEeprom::is_open() {
+  return true;
+}
+
+const char *FileCtrlEeprom::name() {
+  return "<eeprom>";
+}
+
+uint32_t FileCtrlEeprom::size() {
+  return SIZE;
+}
+
+bool FileCtrlEeprom::seek(uint32_t position) {
+  if (position > SIZE) return false;
+
+  m_pos = position;
+  return true;
+}
+
+uint8_t FileCtrlEeprom::read() {
+  uint8_t val = 0x00;
+  read(&val, 1);
+
+  return val;
+}
+
+uint16_t FileCtrlEeprom::read(uint8_t *buf, uint16_t size) {
+  const uint16_t len = MIN(size, SIZE - m_pos);
+  if (len == 0) return 0;
+
+  ee.read(m_pos, m_pos + len - 1, buf);
+  m_pos += len;
+
+  return len;
+}
+
+void FileCtrlEeprom::write(uint8_t val) {
+  write(&val, 1);
+}
+
+uint16_t FileCtrlEeprom::write(const uint8_t *buf, uint16_t size) {
+  const uint16_t len = MIN(size, SIZE - m_pos);
+  if (len == 0) return 0;
+
+  ee.write(m_pos, (uint8_t *) buf, len);
+  m_pos += len;
+
+  return len;
+}
+
+void FileCtrlEeprom::flush() {
+  // Empty, every write is finished before it returns
+}
+
+void FileCtrlEeprom::close() {
+  // Empty
+}
+
+FileCtrlCompressed::FileCtrlCompressed(FileCtrl *file, uint32_t size) : m_file(file), m_size(size) {
+  m_window = (uint8_t *) malloc(256);
+
+  fsys = file->fsys;
+
+  restart();
+}
+
+FileCtrlCompressed::~FileCtrlCompressed() {
+  free(m_window);
+
+  release_in();
+  delete m_file;
+}
+
+bool FileCtrlCompressed::is_open() {
+  return m_window != nullptr && m_file->is_open();
+}
+
+const char *FileCtrlCompressed::name() {
+  return m_file->name();
+}
+
+uint32_t FileCtrlCompressed::size() {
+  return m_size;
+}
+
+bool FileCtrlCompressed::seek(uint32_t position) {
+  if (position < m_pos) {
+    release_in();
+    if (!m_file->seek(HEADER_SIZE)) return false;
+
+    restart();
+  }
+
+  uint8_t discard[32];
+
+  while (m_pos < position) {
+    if (read(discard, MIN(sizeof(discard), position - m_pos)) == 0) return false;
+  }
+
+  return true;
+}
+
+uint8_t FileCtrlCompressed::read() {
+  uint8_t val = 0x00;
+  read(&val, 1);
+
+  return val;
+}
+
+uint16_t FileCtrlCompressed::read(uint8_t *buf, uint16_t size) {
+  uint16_t done = 0;
+
+  while (done < size && m_pos < m_size) {
+    if (m_count == 0 && !next_token()) break;  // Compressed data ended early
+
+    uint8_t val;
+
+    switch (m_mode) {
+    case Mode::LITERAL:
+      if (!next_in(&val)) return done;
+      break;
+
+    case Mode::RUN:
+      val = m_value;
+      break;
+
+    case Mode::MATCH:
+      val = m_window[(uint8_t) (m_win_pos - m_value - 1)];
+      break;
+    }
+
+    m_window[m_win_pos++] = val;
+    buf[done++] = val;
+
+    --m_count;
+    ++m_pos;
+  }
+
+  return done;
+}
+
+void FileCtrlCompressed::write(uint8_t val) {
+  UNUSED_VAR(val);
+}
+
+uint16_t FileCtrlCompressed::write(const uint8_t *buf, uint16_t size) {
+  UNUSED_VAR(buf);
+  UNUSED_VAR(size);
+
+  return 0;
+}
+
+void FileCtrlCompressed::flush() {
+  // Nothing to flush
+}
+
+void FileCtrlCompressed::close() {
+  release_in();
+  m_file->close();
+}
+
+FileCtrl *FileCtrlCompressed::open_if_compressed(FileCtrl *file) {
+  static const char MAGIC[] PROGMEM = "E3Z";
+
+  if (!FileCtrl::check_valid(file)) return file;
+
+  uint8_t header[HEADER_SIZE];
+
+  if (file->read(header, HEADER_SIZE) == HEADER_SIZE && memcmp_P(header, MAGIC, 3) == 0 && header[3] == VERSION) {
+    const uint32_t size = header[4] | ((uint32_t) header[5] << 8) | ((uint32_t) header[6] << 16) | ((uint32_t) header[7] << 24);
+
+    SER_LOG_PRINT("Opened E3Z file, %lu bytes decompressed.\n", size);
+
+    Memory::Scope scope(Memory::Tag::FILES);
+    return new FileCtrlCompressed(file, size);
+  }
+
+  file->seek(0);
+  return file;
+}
+
+// Gets the next compressed byte, borrowing another piece of the file if needed
+bool FileCtrlCompressed::next_in(uint8_t *val) {
+  if (m_in_pos == m_in_len) {
+    release_in();
+
+    const Span span = m_file->acquire_read(IN_BUF_SIZE);
+
+    m_in     = span.data;
+    m_in_len = span.len;
+
+    if (m_in_len == 0) return false;
+  }
+
+  *val = m_in[m_in_pos++];
+  return true;
+}
+
+bool FileCtrlCompressed::next_token() {
+  uint8_t tag, next;
+
+  if (!next_in(&tag)) return false;
+
+  if (tag < 0x80) {
+    m_mode  = Mode::LITERAL;
+    m_count = tag + 1;
+    return true;
+  }
+
+  if (!next_in(&next)) return false;
+
+  if (tag < 0xC0) {
+    m_mode  = Mode::RUN;
+    m_count = (((tag & 0x3F) << 8) | next) + 3;
+    return next_in(&m_value);
+  }
+
+  m_mode  = Mode::MATCH;
+  m_count = (tag & 0x3F) + 3;
+  m_value = next;
+  return true;
+}
+
+void FileCtrlCompressed::restart() {
+  m_pos     = 0;
+  m_in_pos  = 0;
+  m_in_len  = 0;
+  m_count   = 0;
+  m_win_pos = 0;
+}
+
+// Gives back what was borrowed from `m_file`, so that it can be used directly again
+void FileCtrlCompressed::release_in() {
+  if (m_in_len != 0) m_file->commit(m_in_len);
+
+  m_in     = nullptr;
+  m_in_pos = 0;
+  m_in_len = 0;
+}
+
+FileTransfer::FileTransfer(FileCtrl *src, FileCtrl *dst, uint32_t len, Mode mode) :
+  m_src(src), m_dst(dst), m_len(len), m_mode(mode) {
+  // Empty body because all work done in init list
+}
+
+uint16_t FileTransfer::num_blocks() {
+  return (m_len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+bool FileTransfer::step() {
+  if (m_status != Status::OK || is_done()) return (m_status == Status::OK);
+
+  m_block_len = MIN(m_len - m_pos, BLOCK_SIZE);
+
+  // A block takes as many pieces as the files lend out at a time
+  for (uint16_t done = 0; done < m_block_len && m_status == Status::OK;) {
+    const FileCtrl::Span src = m_src->acquire_read(m_block_len - done);
+    uint16_t count = src.len;
+
+    if (count == 0) {
+      m_status = Status::ERR_SHORT;
+      break;
+    }
+
+    if (m_mode == Mode::COPY) {
+      count = m_dst->write(src.data, src.len);
+
+      if (count != src.len) m_status = Status::ERR_SHORT;
+    }
+    else {
+      const FileCtrl::Span dst = m_dst->acquire_read(src.len);
+      count = dst.len;
+
+      if (count == 0)                                 m_status = Status::ERR_SHORT;
+      else if (memcmp(src.data, dst.data, count) != 0) m_status = Status::ERR_MISMATCH;
+
+      m_dst->commit(count);
+    }
+
+    m_src->commit(count);
+    done += count;
+  }
+
+  m_pos += m_block_len;
+
+  return (m_status == Status::OK);
+}
+
+bool FileTransfer::is_done() {
+  return m_pos == m_len;
+}
+
+FileTransfer::Status FileTransfer::status() {
+  return m_status;
+}
+
+uint32_t FileTransfer::block_offset() {
+  return m_pos - m_block_len;
+}
+
+uint16_t FileTransfer::block_len() {
+  return m_block_len;
+}
+
 uint8_t get_available_file_systems() {
   uint8_t avail = FileSystem::NONE;
 
@@ -405,5 +1120,9 @@ uint8_t get_available_file_systems() {
     avail |= FileSystem::ON_SD_CARD;
   }
 
+  if (xram::is_initialized()) {
+    avail |= FileSystem::IN_XRAM;
+  }
+
   return avail;
 }
@@ -4,6 +4,8 @@
 #include <Arduino.h>
 #include "constants.hpp"
 
+#include "catalog.hpp"
+#include "comm.hpp"
 #include "gui.hpp"
 #include "sd.hpp"
 #include "tft.hpp"
@@ -26,6 +28,8 @@ enum FileSystem : uint8_t {
   NONE       = 0x00,
   ON_SD_CARD = 0x01,
   ON_SERIAL  = 0x02,
+  IN_XRAM    = 0x04,
+  ON_EEPROM  = 0x08,  // Never asked for, see `FileCtrlEeprom`
 };
 
 /*
@@ -39,15 +43,15 @@ uint8_t get_available_file_systems();
 class FileCtrl {
 public:
   FileCtrl() {};
-  virtual ~FileCtrl() {};
+  virtual ~FileCtrl();
 
   virtual bool is_open();
 
   virtual const char *name();
 
-  virtual uint16_t size();
+  virtual uint32_t size();
 
-  virtual bool seek(uint16_t position);
+  virtual bool seek(uint32_t position);
 
   virtual uint8_t read();
   virtual uint16_t read(uint8_t *buf, uint16_t size);  // Reads `size` bytes from file into `buf`. Returns number of bytes read.
@@ -59,13 +63,39 @@ public:
 
   virtual void close();
 
+  struct Span {
+    const uint8_t *data;
+    uint16_t len;  // 0 at the end of the file, or if it can't be read
+  };
+
+  // Lends out up to `max` bytes from the current position, straight out of the file system's own buffer where
+  // there is one, so that they can be used without copying them. `commit()` then moves past the first `n` of them,
+  // and any others are lent again next time. The data is only valid until then, and the file must not be read,
+  // written or seeked while any of it is lent out.
+  virtual Span acquire_read(uint16_t max);
+  virtual void commit(uint16_t n);
+
+  // Checksums of the whole file from the SD card's catalog (see `Catalog`), or nullptr if they aren't known
+  virtual const Catalog::Entry *checksums();
+
   // Creates a FileCtrl for a file with `access` at `path`. Selects file system using `fsys`.
-  static FileCtrl *create_file(FileSystem fsys, const char *path, uint8_t access);
+  // If the file is being replaced (`O_TRUNC`) and `size` is given, exactly that many bytes are expected to be written.
+  static FileCtrl *create_file(FileSystem fsys, const char *path, uint8_t access, uint32_t size = 0);
 
   // Checks if a file was opened correctly
   static bool check_valid(FileCtrl *file);
 
   FileSystem fsys = FileSystem::NONE;
+
+  // Most bytes lent at a time by file systems without a buffer of their own
+  static constexpr uint16_t SPARE_SIZE = 256;
+
+private:
+  // Where `acquire_read()` reads into for those, allocated when first needed
+  uint8_t *m_spare = nullptr;
+
+  uint16_t m_spare_pos = 0;
+  uint16_t m_spare_len = 0;
 };
 
 /*
@@ -73,16 +103,16 @@ public:
  */
 class FileCtrlSd : public FileCtrl {
 public:
-  FileCtrlSd(const char *path, uint8_t access);
+  FileCtrlSd(const char *path, uint8_t access, uint32_t size = 0);
   ~FileCtrlSd() override;
 
   bool is_open() override;
 
   const char *name() override;
 
-  uint16_t size() override;
+  uint32_t size() override;
 
-  bool seek(uint16_t position) override;
+  bool seek(uint32_t position) override;
 
   uint8_t read() override;
   uint16_t read(uint8_t *buf, uint16_t size) override;
@@ -94,8 +124,29 @@ public:
 
   void close() override;
 
+  Span acquire_read(uint16_t max) override;
+  void commit(uint16_t n) override;
+
+  const Catalog::Entry *checksums() override;
+
 private:
+  void begin_checksums(const char *path, uint8_t access);
+  void add_checksums(const uint8_t *buf, uint16_t len);
+  void drop_checksums();
+
   File m_file;
+  SdReader *m_reader = nullptr;  // Used instead of `m_file` for reading, if the file is only read
+  SdWriter *m_writer = nullptr;  // Used instead of `m_file` altogether, if the file is replaced and its size is known
+
+  // Catalog entry for the file, worked out from the data read or written so far, if it is in `Strings::M_FILE_DIR`
+  // and has been accessed from its start in order
+  Catalog::Entry *m_sums = nullptr;
+
+  bool m_sums_done  = false;  // `m_sums` covers the whole file
+  bool m_sums_store = false;  // `m_sums` goes into the catalog when the file is closed
+  bool m_writing    = false;
+
+  const uint8_t *m_lent = nullptr;  // What `m_reader` lent out last, for the checksums
 };
 
 /*
@@ -110,9 +161,9 @@ public:
 
   const char *name() override;
 
-  uint16_t size() override;
+  uint32_t size() override;
 
-  bool seek(uint16_t position) override;
+  bool seek(uint32_t position) override;
 
   uint8_t read() override;
   uint16_t read(uint8_t *buf, uint16_t size) override;
@@ -123,12 +174,233 @@ public:
   void flush() override;
 
   void close() override;
+
+  // Lends out the data of each packet of a `PKT_STREAMRD` stream as it arrives
+  Span acquire_read(uint16_t max) override;
+  void commit(uint16_t n) override;
+
+private:
+  void drop_stream();
+  void end_stream();
+
+  Comm::Packet *m_pkt = nullptr;  // Last packet of the current stream
+
+  uint32_t m_pos = 0;          // Position in the file, up to what was committed
+  uint16_t m_stream_left = 0;  // Bytes of the current stream still to come
+
+  uint8_t m_seq     = 0;
+  uint8_t m_pkt_pos = 0;  // Data in `m_pkt` up to here was committed
+  uint8_t m_pkt_len = 0;
+};
+
+/*
+ * Implementation of `FileCtrl` for a fixed-size file in external RAM, such as the RAM disk.
+ *
+ * The file can hold up to `capacity` bytes; anything past that is cut off. How much of it is in use is kept in
+ * `*size`, outside the `FileCtrl`, so the data can be opened again later.
+ */
+class FileCtrlXram : public FileCtrl {
+public:
+  FileCtrlXram(uint8_t *base, uint16_t capacity, uint16_t *size, uint8_t access);
+  ~FileCtrlXram() override;
+
+  bool is_open() override;
+
+  const char *name() override;
+
+  uint32_t size() override;
+
+  bool seek(uint32_t position) override;
+
+  uint8_t read() override;
+  uint16_t read(uint8_t *buf, uint16_t size) override;
+
+  void write(uint8_t val) override;
+  uint16_t write(const uint8_t *buf, uint16_t size) override;
+
+  void flush() override;
+
+  void close() override;
+
+  // Lends out the file's data where it is
+  Span acquire_read(uint16_t max) override;
+  void commit(uint16_t n) override;
+
+  // The RAM disk is the 8K buffer, which "Read Range" and XRAM tuning also use, so they overwrite it
+  static constexpr uint16_t RAM_DISK_ADDR = XRAM_8K_BUF;
+  static constexpr uint16_t RAM_DISK_SIZE = 0x2000;
+
+private:
+  uint8_t *m_base;
+  uint16_t m_capacity;
+  uint16_t *m_size;
+
+  uint16_t m_pos = 0;
+};
+
+/*
+ * Implementation of `FileCtrl` that presents the EEPROM itself as a 32 KiB file, so that it can be copied to and
+ * compared with files on any other file system.
+ */
+class FileCtrlEeprom : public FileCtrl {
+public:
+  FileCtrlEeprom();
+  ~FileCtrlEeprom() override;
+
+  bool is_open() override;
+
+  const char *name() override;
+
+  uint32_t size() override;
+
+  bool seek(uint32_t position) override;
+
+  uint8_t read() override;
+  uint16_t read(uint8_t *buf, uint16_t size) override;
+
+  void write(uint8_t val) override;
+  uint16_t write(const uint8_t *buf, uint16_t size) override;
+
+  void flush() override;
+
+  void close() override;
+
+  static constexpr uint32_t SIZE = 0x8000;
+
+private:
+  uint16_t m_pos = 0;
+};
+
+/*
+ * Read-only `FileCtrl` that decompresses an E3Z file held by another `FileCtrl`.
+ *
+ * An E3Z file is the magic "E3Z", a version byte, the decompressed size (32-bit LE), then tokens:
+ * - `0x00-0x7F`: literal, the next `tag + 1` bytes are copied as is
+ * - `0x80-0xBF`: run, `(tag & 0x3F) << 8 | next` + 3 copies of the byte after that
+ * - `0xC0-0xFF`: match, `(tag & 0x3F) + 3` bytes copied from `next + 1` bytes back in the output
+ *
+ * So the decompressor only needs to remember the last 256 bytes it produced. See `software/src/e3z.py`
+ * for the compressor.
+ */
+class FileCtrlCompressed : public FileCtrl {
+public:
+  // Takes ownership of `file`, which must be positioned just after the header
+  FileCtrlCompressed(FileCtrl *file, uint32_t size);
+  ~FileCtrlCompressed() override;
+
+  bool is_open() override;
+
+  const char *name() override;
+
+  uint32_t size() override;
+
+  // Seeking backwards starts over from the beginning, so it is slow
+  bool seek(uint32_t position) override;
+
+  uint8_t read() override;
+  uint16_t read(uint8_t *buf, uint16_t size) override;
+
+  // Writing is not supported
+  void write(uint8_t val) override;
+  uint16_t write(const uint8_t *buf, uint16_t size) override;
+
+  void flush() override;
+
+  void close() override;
+
+  // If `file` is an E3Z file, returns a `FileCtrlCompressed` which owns it.
+  // Otherwise rewinds `file` and returns it as is.
+  static FileCtrl *open_if_compressed(FileCtrl *file);
+
+  static constexpr uint8_t HEADER_SIZE = 8;
+  static constexpr uint8_t VERSION     = 1;
+
+  // Compressed bytes are borrowed from `m_file` this many at a time, enough to keep a serial stream's window full
+  static constexpr uint16_t IN_BUF_SIZE = 512;
+
+private:
+  enum class Mode : uint8_t {
+    LITERAL, RUN, MATCH,
+  };
+
+  bool next_in(uint8_t *val);
+  bool next_token();
+  void restart();
+  void release_in();
+
+  FileCtrl *m_file;
+
+  uint8_t *m_window = nullptr;  // Last 256 bytes of output, indexed by `m_win_pos`
+  const uint8_t *m_in = nullptr;  // Lent by `m_file`
+
+  uint32_t m_size;
+  uint32_t m_pos;
+
+  uint16_t m_in_pos;
+  uint16_t m_in_len;
+
+  Mode m_mode;
+  uint16_t m_count;  // Bytes left in the current token
+  uint8_t m_value;   // Byte repeated by a run, or distance - 1 of a match
+  uint8_t m_win_pos;
+};
+
+/*
+ * Copies one `FileCtrl` to another, or compares them, a block at a time, whatever file systems they are on.
+ *
+ * Both files are used from where they are positioned. `step()` does one block, so that the caller can show
+ * progress and stop between blocks. Data is used where the files lend it out (see `FileCtrl::acquire_read()`),
+ * so there is no buffer of its own.
+ */
+class FileTransfer {
+public:
+  enum class Mode : uint8_t {
+    COPY,     // From `src` to `dst`
+    COMPARE,  // `src` with `dst`, both only read
+  };
+
+  enum class Status : uint8_t {
+    OK,            // Every block so far went through
+    ERR_SHORT,     // A file ended early, or couldn't take all of a block
+    ERR_MISMATCH,  // The last block differed between the files
+  };
+
+  FileTransfer(FileCtrl *src, FileCtrl *dst, uint32_t len, Mode mode);
+
+  uint16_t num_blocks();
+
+  // Copies or compares the next block. Returns false if it failed; nothing more is done after that.
+  bool step();
+
+  // Whether all `len` bytes went through
+  bool is_done();
+
+  Status status();
+
+  // Where the last block started (counted from where the files were), and its length, e.g. to point out a mismatch
+  uint32_t block_offset();
+  uint16_t block_len();
+
+  static constexpr uint16_t BLOCK_SIZE = 0x0400;
+
+private:
+  FileCtrl *m_src;
+  FileCtrl *m_dst;
+
+  uint32_t m_len;
+  Mode m_mode;
+
+  uint32_t m_pos = 0;
+  uint16_t m_block_len = 0;
+
+  Status m_status = Status::OK;
 };
 
 namespace Gui {
 
 /*
  * Yet another `MenuXXX`, this one to ask user to select a file from an SD card.
+ * Shows `rows` x `cols` files at a time, with buttons to go through the pages.
  */
 class MenuSdFileSel : public MenuChoice {
 public:
@@ -149,6 +421,7 @@ public:
 
 private:
   void init_files();
+  void show_page();
 
   // The supplied `cols` or the maximum number of cols that will fit, whichever is smaller
   static inline uint8_t calc_num_cols(uint8_t cols) {
@@ -168,10 +441,18 @@ private:
     );
   }
 
-  SdFileInfo *m_files = nullptr;
-  uint8_t m_num_files = 0;
+  SdDirIndex *m_index = nullptr;  // Owned by `sd`
+
+  uint16_t m_page = 0;
+  uint16_t m_num_pages = 1;
 
   uint8_t m_num_rows;
+  uint8_t m_num_slots;  // Buttons for files, the first ones in the menu
+
+  // The rest, in order
+  inline uint8_t btn_cancel() { return m_num_slots + 0; }
+  inline uint8_t btn_prev()   { return m_num_slots + 1; }
+  inline uint8_t btn_next()   { return m_num_slots + 2; }
 };
 
 };
@@ -186,8 +467,8 @@ enum AskFileStatus : uint8_t {
 };
 
 // Get path to any file on any available file system, returns `FileCtrl *` for the file.
-// Puts resulting status into `status`.
-FileCtrl *ask_file(const char *prompt, uint8_t access, AskFileStatus *status, bool must_exist);
+// Puts resulting status into `status`. See `FileCtrl::create_file()` for `size`.
+FileCtrl *ask_file(const char *prompt, uint8_t access, AskFileStatus *status, bool must_exist, uint32_t size = 0);
 
 // Asks user to select a file on SD card, writes the file's path into `out`.
 // Returns resulting status.
@@ -197,7 +478,7 @@ AskFileStatus ask_file_sd(const char *prompt, char *out, uint8_t len, bool must_
 // Returns resulting status.
 Gui::MenuSdFileSel::Status ask_sel_file_sd(const char *prompt, char *out, uint8_t len);
 
-// Asks user to select a file in the software.
+// Asks user to select a file in the software, or to cancel while waiting for it.
 // Returns resulting status.
 AskFileStatus ask_file_serial(const char *prompt, bool must_exist);
 
@@ -3,6 +3,7 @@
 
 #include "ad_array.hpp"
 #include "dialog.hpp"
+#include "memory.hpp"
 #include "strfmt.hpp"
 #include "tft.hpp"
 #include "tft_calc.hpp"
@@ -72,7 +73,7 @@ void Btn::draw_highlight() {
 
 void Btn::wait_for_press() {
   while (!is_pressed()) {
-    /* wait for press */;
+    Util::idle();
   }
 }
 
@@ -94,6 +95,8 @@ Menu::~Menu() {
 }
 
 Btn *Menu::add_btn(Btn *btn) {
+  Memory::Scope scope(Memory::Tag::GUI);
+
   auto new_arr = (Btn **) malloc((m_num_btns + 1) * sizeof(Btn *));
 
   if (new_arr == nullptr) return nullptr;
@@ -179,6 +182,7 @@ uint8_t Menu::wait_for_press() {
   int16_t btn = 0;
 
   do {
+    Util::idle();
     btn = get_pressed();
   }
   while (btn < 0);
@@ -0,0 +1,315 @@
+#include <Arduino.h>
+#include "constants.hpp"
+
+#include "file.hpp"
+#include "memory.hpp"
+
+#include "hex.hpp"
+
+// Value of hex digit `c`, or -1 if it isn't one
+static int8_t hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+
+  return -1;
+}
+
+HexReader::HexReader(FileCtrl *file, Format format) : m_file(file), m_format(format) {
+  Memory::Scope scope(Memory::Tag::FILES);
+
+  m_rec = (uint8_t *) malloc(REC_SIZE);
+}
+
+HexReader::~HexReader() {
+  // Gives back what is still borrowed, so that the file can be used again
+  if (m_in_len != 0) m_file->commit(m_in_len);
+
+  free(m_rec);
+}
+
+bool HexReader::is_open() {
+  return m_rec != nullptr && m_file->is_open();
+}
+
+HexReader::Format HexReader::detect(FileCtrl *file) {
+  uint8_t first[2];
+
+  file->seek(0);
+  const uint16_t len = file->read(first, 2);
+  file->seek(0);
+
+  if (len < 2) return Format::RAW;
+
+  if (first[0] == ':' && hex_value(first[1]) >= 0)          return Format::INTEL_HEX;
+  if (first[0] == 'S' && first[1] >= '0' && first[1] <= '9') return Format::SREC;
+
+  return Format::RAW;
+}
+
+uint16_t HexReader::line() {
+  return m_rec_line;
+}
+
+uint32_t HexReader::position() {
+  return m_read - (m_in_len - m_in_pos);
+}
+
+bool HexReader::next_char(char *c) {
+  if (m_in_pos == m_in_len) {
+    if (m_in_len != 0) m_file->commit(m_in_len);
+
+    const FileCtrl::Span span = m_file->acquire_read(IN_BUF_SIZE);
+
+    m_in     = span.data;
+    m_in_len = span.len;
+    m_in_pos = 0;
+    m_read  += m_in_len;
+
+    if (m_in_len == 0) return false;
+  }
+
+  *c = m_in[m_in_pos++];
+
+  if (*c == '\n') ++m_line;
+
+  return true;
+}
+
+// Reads the next record into `m_rec` and its type into `type`, skipping blank lines
+HexReader::Status HexReader::read_record(uint8_t *type) {
+  char c;
+
+  do {
+    if (!next_char(&c)) return Status::END;
+  }
+  while (c == '\r' || c == '\n');
+
+  m_rec_line = m_line;
+
+  if (m_format == Format::INTEL_HEX) {
+    if (c != ':') return Status::ERR_SYNTAX;
+  }
+  else {
+    if (c != 'S' || !next_char(&c) || c < '0' || c > '9') return Status::ERR_SYNTAX;
+
+    *type = c - '0';
+  }
+
+  m_rec_len = 0;
+
+  bool more;
+
+  // Pairs of hex digits up to the end of the line
+  while ((more = next_char(&c)) && hex_value(c) >= 0) {
+    char lo;
+
+    if (!next_char(&lo) || hex_value(lo) < 0 || m_rec_len == REC_SIZE) return Status::ERR_SYNTAX;
+
+    m_rec[m_rec_len++] = (hex_value(c) << 4) | hex_value(lo);
+  }
+
+  if (more && c != '\r' && c != '\n') return Status::ERR_SYNTAX;
+
+  uint8_t sum = 0;
+
+  for (uint16_t i = 0; i < m_rec_len; ++i) {
+    sum += m_rec[i];
+  }
+
+  if (m_format == Format::INTEL_HEX) {
+    // Count, address (2), type, data, checksum; all of it adds up to 0
+    if (m_rec_len < 5 || m_rec[0] != m_rec_len - 5) return Status::ERR_SYNTAX;
+    if (sum != 0x00) return Status::ERR_CHECKSUM;
+
+    *type = m_rec[3];
+  }
+  else {
+    // Count, then that many bytes of address, data and checksum; all of it adds up to 0xFF
+    if (m_rec_len < 2 || m_rec[0] != m_rec_len - 1) return Status::ERR_SYNTAX;
+    if (sum != 0xFF) return Status::ERR_CHECKSUM;
+  }
+
+  return Status::OK;
+}
+
+HexReader::Status HexReader::next(Run *run) {
+  while (!m_ended) {
+    uint8_t type;
+    const Status status = read_record(&type);
+
+    if (status != Status::OK) return status;
+
+    const uint8_t *rec = m_rec;
+    const uint8_t len  = m_rec[0];
+
+    if (m_format == Format::INTEL_HEX) {
+      switch (type) {
+      case 0x00:  // Data
+        run->addr = m_base + (((uint16_t) rec[1] << 8) | rec[2]);
+        run->data = rec + 4;
+        run->len  = len;
+
+        if (len == 0) continue;
+        return Status::OK;
+
+      case 0x01:  // End of file
+        m_ended = true;
+        break;
+
+      case 0x02:  // Extended segment address
+        if (len != 2) return Status::ERR_SYNTAX;
+
+        m_base = (((uint32_t) rec[4] << 8) | rec[5]) << 4;
+        break;
+
+      case 0x04:  // Extended linear address
+        if (len != 2) return Status::ERR_SYNTAX;
+
+        m_base = (((uint32_t) rec[4] << 8) | rec[5]) << 16;
+        break;
+
+      case 0x03:  // Start segment address
+      case 0x05:  // Start linear address
+        break;
+
+      default:
+        return Status::ERR_SYNTAX;
+      }
+    }
+    else {
+      switch (type) {
+      case 1: case 2: case 3: {  // Data, with a 2, 3 or 4 byte address
+        const uint8_t addr_len = type + 1;
+
+        if (len < addr_len + 1) return Status::ERR_SYNTAX;
+
+        run->addr = 0;
+
+        for (uint8_t i = 0; i < addr_len; ++i) {
+          run->addr = (run->addr << 8) | rec[1 + i];
+        }
+
+        run->data = rec + 1 + addr_len;
+        run->len  = len - addr_len - 1;
+
+        if (run->len == 0) continue;
+        return Status::OK;
+      }
+
+      case 7: case 8: case 9:  // Start address, which also ends the file
+        m_ended = true;
+        break;
+
+      case 0:           // Header
+      case 5: case 6:   // Record count
+        break;
+
+      default:
+        return Status::ERR_SYNTAX;
+      }
+    }
+  }
+
+  return Status::END;
+}
+
+HexWriter::HexWriter(FileCtrl *file, HexReader::Format format, uint8_t fill) : m_file(file), m_format(format), m_fill(fill) {
+  Memory::Scope scope(Memory::Tag::FILES);
+
+  m_out = (uint8_t *) malloc(OUT_BUF_SIZE);
+
+  if (m_out != nullptr && m_format == HexReader::Format::SREC) {
+    write_record(0, 0x0000, nullptr, 0);  // Empty header
+  }
+}
+
+HexWriter::~HexWriter() {
+  free(m_out);
+}
+
+bool HexWriter::is_open() {
+  return m_out != nullptr && m_file->is_open();
+}
+
+bool HexWriter::write(uint16_t addr, const uint8_t *data, uint16_t len) {
+  if (m_out == nullptr || m_failed) return false;
+
+  while (len > 0) {
+    const uint8_t count = MIN(len, LINE_LEN - (addr % LINE_LEN));
+
+    bool unused = true;
+
+    for (uint8_t i = 0; i < count && unused; ++i) {
+      unused = (data[i] == m_fill);
+    }
+
+    if (!unused) {
+      write_record((m_format == HexReader::Format::INTEL_HEX ? 0x00 : 1), addr, data, count);
+    }
+
+    addr += count;
+    data += count;
+    len  -= count;
+  }
+
+  return !m_failed;
+}
+
+bool HexWriter::finish() {
+  if (m_out == nullptr || m_failed) return false;
+
+  write_record((m_format == HexReader::Format::INTEL_HEX ? 0x01 : 9), 0x0000, nullptr, 0);
+  flush();
+
+  return !m_failed;
+}
+
+void HexWriter::write_record(uint8_t type, uint16_t addr, const uint8_t *data, uint8_t len) {
+  m_sum = 0;
+
+  if (m_format == HexReader::Format::INTEL_HEX) {
+    put_char(':');
+    put_byte(len);
+    put_byte(addr >> 8);
+    put_byte(addr & 0xFF);
+    put_byte(type);
+  }
+  else {
+    put_char('S');
+    put_char('0' + type);
+    put_byte(len + 3);  // Address and checksum are counted too
+    put_byte(addr >> 8);
+    put_byte(addr & 0xFF);
+  }
+
+  for (uint8_t i = 0; i < len; ++i) {
+    put_byte(data[i]);
+  }
+
+  const uint8_t sum = m_sum;
+  put_byte(m_format == HexReader::Format::INTEL_HEX ? -sum : ~sum);
+
+  put_char('\n');
+}
+
+void HexWriter::put_char(char c) {
+  m_out[m_out_len++] = c;
+
+  if (m_out_len == OUT_BUF_SIZE) flush();
+}
+
+// Puts `val` as two hex digits, a lot quicker than going through `printf()`
+void HexWriter::put_byte(uint8_t val) {
+  m_sum += val;
+
+  for (int8_t shift = 4; shift >= 0; shift -= 4) {
+    const uint8_t digit = (val >> shift) & 0x0F;
+    put_char(digit < 10 ? '0' + digit : 'A' - 10 + digit);
+  }
+}
+
+void HexWriter::flush() {
+  if (m_out_len > 0 && m_file->write(m_out, m_out_len) != m_out_len) m_failed = true;
+  m_out_len = 0;
+}
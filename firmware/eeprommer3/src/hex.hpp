@@ -0,0 +1,132 @@
+#ifndef HEX_HPP
+#define HEX_HPP
+
+#include <Arduino.h>
+#include "constants.hpp"
+
+#include "file.hpp"
+
+/*
+ * Reads an Intel HEX or Motorola S-record file a record at a time, as the assemblers (ca65, vasm, ...) emit them.
+ *
+ * Only one record is held at a time, so files of any size can be read without staging the image. Each record's
+ * checksum is checked as it is read. Records that don't carry data (headers, start addresses, counts) are skipped,
+ * and the first end-of-file record ends the file.
+ */
+class HexReader {
+public:
+  enum class Format : uint8_t {
+    RAW,        // Not a text image, so a plain binary
+    INTEL_HEX,  // Lines starting with ':'
+    SREC,       // Lines starting with 'S' and a digit
+  };
+
+  enum class Status : uint8_t {
+    OK,            // Got a run of data
+    END,           // No more data
+    ERR_SYNTAX,    // A line isn't a valid record
+    ERR_CHECKSUM,  // A record's checksum doesn't match its contents
+  };
+
+  // Bytes at consecutive addresses, from a single record
+  struct Run {
+    uint32_t addr;
+    const uint8_t *data;
+    uint8_t len;
+  };
+
+  // Does not take ownership of `file`, which must be of `format` and positioned at its start
+  HexReader(FileCtrl *file, Format format);
+  ~HexReader();
+
+  bool is_open();
+
+  // Gets the next run of data; it is only valid until the next call
+  Status next(Run *run);
+
+  // Line of the file the last record was on, to point out errors
+  uint16_t line();
+
+  // Bytes of the file read so far
+  uint32_t position();
+
+  // Tells what `file` holds from its first two characters, and rewinds it
+  static Format detect(FileCtrl *file);
+
+  // Most characters borrowed from the file at a time
+  static constexpr uint16_t IN_BUF_SIZE = 128;
+
+  // Largest record: a count byte, then up to 255 bytes of address, data and checksum (plus Intel HEX's 4 other bytes)
+  static constexpr uint16_t REC_SIZE = 260;
+
+private:
+  bool next_char(char *c);
+  Status read_record(uint8_t *type);
+
+  FileCtrl *m_file;
+  Format m_format;
+
+  const uint8_t *m_in = nullptr;  // Lent by `m_file`
+  uint8_t *m_rec = nullptr;       // Binary contents of the current record
+
+  uint8_t m_in_pos = 0;
+  uint8_t m_in_len = 0;
+
+  uint32_t m_read = 0;  // Bytes read from `m_file`, including any still in `m_in`
+
+  uint16_t m_rec_len = 0;
+
+  uint32_t m_base = 0;  // Added to Intel HEX addresses, set by extended address records
+
+  uint16_t m_line     = 1;
+  uint16_t m_rec_line = 0;
+
+  bool m_ended = false;
+};
+
+/*
+ * Writes data to a file as Intel HEX or Motorola S-records, 16 bytes per record, through a small output buffer.
+ *
+ * Records are aligned to 16-byte lines, and lines made up entirely of the fill value are left out, so sparse images
+ * give small files that also compare well line by line. Addresses are 16-bit (S1 records, no extended addresses).
+ */
+class HexWriter {
+public:
+  // Does not take ownership of `file`; `format` must not be `RAW`
+  HexWriter(FileCtrl *file, HexReader::Format format, uint8_t fill);
+  ~HexWriter();
+
+  bool is_open();
+
+  // Writes the `len` bytes at `data`, which belong at `addr`.
+  // Returns false if writing to the file has failed, now or before.
+  bool write(uint16_t addr, const uint8_t *data, uint16_t len);
+
+  // Writes the end-of-file record and everything still buffered.
+  // Returns false if writing to the file has failed, now or before.
+  bool finish();
+
+  static constexpr uint8_t  LINE_LEN     = 16;
+  static constexpr uint16_t OUT_BUF_SIZE = 256;
+
+private:
+  void write_record(uint8_t type, uint16_t addr, const uint8_t *data, uint8_t len);
+
+  void put_char(char c);
+  void put_byte(uint8_t val);
+
+  void flush();
+
+  FileCtrl *m_file;
+  HexReader::Format m_format;
+  uint8_t m_fill;
+
+  uint8_t *m_out = nullptr;
+  uint16_t m_out_len = 0;
+
+  uint8_t m_sum = 0;  // Of the bytes put so far in the current record
+
+  bool m_failed = false;  // The file took fewer bytes than it was given
+};
+
+#endif
@@ -0,0 +1,238 @@
+#include <Arduino.h>
+#include "constants.hpp"
+
+#include "comm.hpp"
+#include "memory.hpp"
+
+#include "log.hpp"
+
+namespace Log {
+
+// Records are `[len, site, time(4), args(len)...]`, `site` being a pointer to the `Site` in flash
+static constexpr uint8_t HEADER_SIZE = 1 + sizeof(const Site *) + 4;
+
+// On the computer's end, `site` is just the low 16 bits of it (the whole pointer on the ATmega)
+static constexpr uint8_t WIRE_HEADER_SIZE = 1 + 2 + 4;
+
+static uint8_t boot_buf[BOOT_BUF_SIZE];
+
+static uint8_t *buf = boot_buf;
+static uint16_t buf_mask = BOOT_BUF_SIZE - 1;
+
+static uint16_t head = 0;  // Where the next record goes
+static uint16_t tail = 0;  // Oldest record
+static uint16_t used = 0;
+
+static uint16_t dropped = 0;  // Records dropped since the last `PKT_LOGDATA`
+
+// IDs of the sites whose format string was sent; in XRAM after the ring buffer
+static uint16_t *sites = nullptr;
+static uint8_t num_sites = 0;
+
+// Last site sent, so that records keep going out even once `sites` is full
+static uint16_t last_site = 0;
+
+static uint16_t site_id(const Site *site) {
+  return (uint16_t) (uintptr_t) site;
+}
+
+static void ring_write(const void *data, uint16_t len) {
+  const auto *bytes = (const uint8_t *) data;
+
+  for (uint16_t i = 0; i < len; ++i) {
+    buf[head] = bytes[i];
+    head = (head + 1) & buf_mask;
+  }
+
+  used += len;
+}
+
+// Copies `len` bytes from `offset` bytes after the oldest record's start
+static void ring_read(uint16_t offset, void *data, uint16_t len) {
+  auto *bytes = (uint8_t *) data;
+
+  for (uint16_t i = 0; i < len; ++i) {
+    bytes[i] = buf[(tail + offset + i) & buf_mask];
+  }
+}
+
+static const Site *oldest_site() {
+  const Site *site;
+  ring_read(1, &site, sizeof(site));
+
+  return site;
+}
+
+static void drop_oldest() {
+  const uint16_t size = HEADER_SIZE + buf[tail];
+
+  tail  = (tail + size) & buf_mask;
+  used -= size;
+}
+
+static void count_dropped() {
+  if (dropped < UINT16_MAX) ++dropped;
+}
+
+static bool is_sent(uint16_t id) {
+  if (id == last_site) return true;
+
+  for (uint8_t i = 0; i < num_sites; ++i) {
+    if (sites[i] == id) return true;
+  }
+
+  return false;
+}
+
+// `[PKT_LOGFMT, id(2), line(2), file name..., 0x00, format...]`, cut off if it doesn't fit
+static void send_site(Comm::Packet *pkt, const Site *site) {
+  Site copy;
+  memcpy_P(&copy, site, sizeof(copy));
+
+  const uint16_t id = site_id(site);
+
+  pkt->buffer[0] = PKT_LOGFMT;
+  pkt->buffer[1] = id & 0xFF;
+  pkt->buffer[2] = id >> 8;
+  pkt->buffer[3] = copy.line & 0xFF;
+  pkt->buffer[4] = copy.line >> 8;
+
+  uint16_t pos = 5;
+
+  // Only the name, not the whole path
+  const char *name = copy.file;
+
+  for (const char *c = copy.file; pgm_read_byte(c) != '\0'; ++c) {
+    if (pgm_read_byte(c) == '/' || pgm_read_byte(c) == '\\') name = c + 1;
+  }
+
+  for (const char *c = name; pgm_read_byte(c) != '\0' && pos < sizeof(pkt->buffer) - 1; ++c) {
+    pkt->buffer[pos++] = pgm_read_byte(c);
+  }
+
+  pkt->buffer[pos++] = '\0';
+
+  for (const char *c = copy.fmt; pgm_read_byte(c) != '\0' && pos < sizeof(pkt->buffer); ++c) {
+    pkt->buffer[pos++] = pgm_read_byte(c);
+  }
+
+  pkt->end = pos - 1;
+  Comm::send(pkt);
+
+  if (num_sites < MAX_SITES) sites[num_sites++] = id;
+  last_site = id;
+}
+
+// `[PKT_LOGDATA, dropped(2), records...]` with as many whole records as fit, up to one whose site wasn't sent
+static void send_records(Comm::Packet *pkt) {
+  pkt->buffer[0] = PKT_LOGDATA;
+  pkt->buffer[1] = dropped & 0xFF;
+  pkt->buffer[2] = dropped >> 8;
+
+  uint16_t pos = 3;
+
+  while (used > 0) {
+    const uint8_t len = buf[tail];
+    const uint16_t id = site_id(oldest_site());
+
+    if (!is_sent(id) || sizeof(pkt->buffer) - pos < (uint16_t) (WIRE_HEADER_SIZE + len)) break;
+
+    pkt->buffer[pos++] = len;
+    pkt->buffer[pos++] = id & 0xFF;
+    pkt->buffer[pos++] = id >> 8;
+
+    ring_read(1 + sizeof(const Site *), pkt->buffer + pos, 4 + len);
+    pos += 4 + len;
+
+    drop_oldest();
+  }
+
+  dropped = 0;
+
+  pkt->end = pos - 1;
+  Comm::send(pkt);
+}
+
+bool set_buffer() {
+  if (buf != boot_buf) return true;
+
+  Memory::Scope scope(Memory::Tag::COMM);
+
+  auto *new_buf = (uint8_t *) malloc(BUF_SIZE + MAX_SITES * sizeof(uint16_t));
+  if (new_buf == nullptr) return false;
+
+  // Oldest record first
+  ring_read(0, new_buf, used);
+
+  buf      = new_buf;
+  buf_mask = BUF_SIZE - 1;
+  tail     = 0;
+  head     = used;
+
+  sites = (uint16_t *) (new_buf + BUF_SIZE);
+  reset_sites();
+
+  return true;
+}
+
+void release_buffer() {
+  if (buf == boot_buf) return;
+
+  free(buf);
+
+  buf      = boot_buf;
+  buf_mask = BOOT_BUF_SIZE - 1;
+  head     = 0;
+  tail     = 0;
+  used     = 0;
+
+  sites = nullptr;
+  reset_sites();
+}
+
+void reset_sites() {
+  num_sites = 0;
+  last_site = 0;
+}
+
+void drain() {
+  if (sites == nullptr || (used == 0 && dropped == 0)) return;
+
+  Comm::Packet pkt;
+
+  if (used > 0 && !is_sent(site_id(oldest_site()))) {
+    send_site(&pkt, oldest_site());
+  }
+  else {
+    send_records(&pkt);
+  }
+}
+
+bool begin(const Site *site, uint16_t len) {
+  const uint16_t size = HEADER_SIZE + len;
+
+  if (len > MAX_ARGS || size > buf_mask + 1) {
+    count_dropped();
+    return false;
+  }
+
+  while (buf_mask + 1 - used < size) {
+    drop_oldest();
+    count_dropped();
+  }
+
+  const uint8_t len8 = len;
+  const uint32_t time = millis();
+
+  ring_write(&len8, 1);
+  ring_write(&site, sizeof(site));
+  ring_write(&time, 4);
+
+  return true;
+}
+
+void put(const void *data, uint8_t len) {
+  ring_write(data, len);
+}
+
+};
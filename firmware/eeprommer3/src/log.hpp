@@ -0,0 +1,103 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <Arduino.h>
+
+/*
+ * Deferred binary logging, behind `SER_LOG_PRINT()`.
+ *
+ * Nothing is formatted on the device. Each call site has its format string, file and line in flash (a `Site`),
+ * and a call only copies the site's address, the time and its arguments into a ring buffer. `Comm::poll()` sends
+ * the buffer to the computer in `PKT_LOGDATA` packets while the link is idle, if the computer reported `CAP_LOG`
+ * in its ping, and the computer puts the text back together (see `software/src/devlog.py`). Before the first
+ * record of a site, its format string is sent once in a `PKT_LOGFMT` packet.
+ *
+ * The buffer is a small internal one until `set_buffer()` moves it to XRAM. When it is full, the oldest records
+ * are dropped, and the computer is told how many.
+ */
+namespace Log {
+  struct Site {
+    uint16_t line;
+    const char *file;  // In PROGMEM
+    const char *fmt;   // In PROGMEM
+  };
+
+  // Path of the source file that includes this, for `Site`s
+  static const char FILE_NAME[] PROGMEM = __BASE_FILE__;
+
+  // Moves the ring buffer to the heap (in XRAM), keeping what it holds. Returns false if out of memory.
+  bool set_buffer();
+
+  // Goes back to the internal buffer, dropping what the heap one holds (for `ProgrammerDupCore`)
+  void release_buffer();
+
+  // Forgets which format strings were sent, e.g. because the computer pinged again
+  void reset_sites();
+
+  // Sends the next `PKT_LOGFMT` or `PKT_LOGDATA` packet, if there is anything to send.
+  // The format strings are only kept track of once the buffer is in XRAM, so nothing is sent before then.
+  void drain();
+
+  constexpr uint16_t BOOT_BUF_SIZE = 128;   // Power of 2
+  constexpr uint16_t BUF_SIZE      = 1024;  // Power of 2
+
+  constexpr uint8_t MAX_SITES = 64;  // Sites whose format string is remembered as sent
+  constexpr uint8_t MAX_ARGS  = 64;  // Bytes of arguments in a record; records with more are dropped
+  constexpr uint8_t MAX_STR   = 32;  // Strings passed as arguments are cut off after this many characters
+
+  /******************************** INTERNALS OF SER_LOG_PRINT ********************************/
+
+  // Makes room for a record of `site` with `len` bytes of arguments, and writes its header.
+  // Returns false if the record can't be logged.
+  bool begin(const Site *site, uint16_t len);
+
+  // Adds `len` bytes of arguments to the record
+  void put(const void *data, uint8_t len);
+
+  // Arguments are packed as `printf()` takes them: integers are promoted to at least an `int`,
+  // and strings are copied, since they may be gone by the time the record is sent.
+
+  template<typename T>
+  inline uint16_t arg_size(T arg) {
+    (void) arg;
+    return (sizeof(T) < sizeof(int) ? sizeof(int) : sizeof(T));
+  }
+
+  inline uint16_t arg_size(const char *arg) {
+    const size_t len = strlen(arg);
+    return (len < MAX_STR ? len : MAX_STR) + 1;
+  }
+
+  inline uint16_t arg_size(char *arg) {
+    return arg_size((const char *) arg);
+  }
+
+  template<typename T>
+  inline void put_arg(T arg) {
+    if constexpr (sizeof(T) < sizeof(int)) {
+      const int val = (int) arg;
+      put(&val, sizeof(val));
+    }
+    else {
+      put(&arg, sizeof(arg));
+    }
+  }
+
+  inline void put_arg(const char *arg) {
+    put(arg, arg_size(arg) - 1);
+    put("", 1);
+  }
+
+  inline void put_arg(char *arg) {
+    put_arg((const char *) arg);
+  }
+
+  template<typename... Args>
+  inline void write(const Site *site, Args... args) {
+    if (!begin(site, (arg_size(args) + ... + 0))) return;
+
+    (put_arg(args), ...);
+  }
+};
+
+#endif
@@ -0,0 +1,274 @@
+#include <Arduino.h>
+#include "constants.hpp"
+
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include "comm.hpp"
+#include "strfmt.hpp"
+#include "util.hpp"
+
+#include "memory.hpp"
+
+// NOLINTBEGIN: avr linker and avr-libc allocator symbols
+extern int __bss_start, __bss_end;
+extern int __heap_start, __heap_end;
+extern int *__brkval;
+extern uint8_t _end;
+
+struct __freelist {
+  size_t sz;
+  struct __freelist *nx;
+};
+
+extern struct __freelist *__flp;
+// NOLINTEND
+
+static Memory::TagStats tag_stats[Memory::NUM_TAGS];
+
+static uint16_t heap_in_use   = 0;
+static uint16_t heap_peak     = 0;
+static uint16_t heap_hw       = 0;
+static uint16_t heap_failures = 0;
+
+// avr-libc stores the usable size of each block in the two bytes just before it
+static inline uint16_t block_size(void *ptr) {
+  return *((size_t *) ptr - 1) + sizeof(size_t);
+}
+
+static void record_alloc(void *ptr, size_t len) {
+  if (ptr == nullptr) {
+    if (len > 0) ++heap_failures;
+    return;
+  }
+
+  auto &stats = tag_stats[Memory::cur_tag];
+  ++stats.allocs;
+  stats.bytes += len;
+
+  heap_in_use += block_size(ptr);
+  heap_peak = MAX(heap_peak, heap_in_use);
+
+  const char *top = (const char *) __brkval;
+  heap_hw = MAX(heap_hw, (uint16_t) (top - __malloc_heap_start));
+}
+
+static void record_free(void *ptr) {
+  if (ptr == nullptr) return;
+
+  heap_in_use -= block_size(ptr);
+}
+
+extern "C" {
+
+void *__real_malloc(size_t len);
+void *__real_realloc(void *ptr, size_t len);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t len) {
+  void *ptr = __real_malloc(len);
+  record_alloc(ptr, len);
+  return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t len) {
+  const uint16_t old_size = (ptr == nullptr ? 0 : block_size(ptr));
+  void *new_ptr = __real_realloc(ptr, len);
+
+  if (new_ptr != nullptr) {
+    heap_in_use -= old_size;
+  }
+
+  record_alloc(new_ptr, len);
+  return new_ptr;
+}
+
+void __wrap_free(void *ptr) {
+  record_free(ptr);
+  __real_free(ptr);
+}
+
+// Runs from .init1, right after reset and before anything has used the stack. It has to be naked and
+// written in assembly because r1 is not cleared until .init2. Fills all free internal RAM with the canary.
+void paint_stack() __attribute__((naked, used, section(".init1")));
+
+void paint_stack() {
+  asm volatile (
+    "  ldi r30, lo8(_end)   \n"
+    "  ldi r31, hi8(_end)   \n"
+    "  ldi r24, %[canary]   \n"
+    "  ldi r25, hi8(%[top]) \n"
+    "  rjmp 2f              \n"
+    "1:                     \n"
+    "  st Z+, r24           \n"
+    "2:                     \n"
+    "  cpi r30, lo8(%[top]) \n"
+    "  cpc r31, r25         \n"
+    "  brlo 1b              \n"
+    "  breq 1b              \n"
+    :
+    : [canary] "M" (Memory::STACK_CANARY), [top] "i" (RAMEND)
+    : "r24", "r25", "r30", "r31", "memory"
+  );
+}
+
+}
+
+void Memory::calculate_bords() {
+  // Internal
+  bords[0] = RAMSTART;
+  bords[1] = (uint16_t) &__bss_start;
+  bords[2] = (uint16_t) &__bss_end;
+  bords[3] = SP;
+  bords[4] = RAMEND;
+
+  // External
+  bords[5] = (uint16_t) &__heap_start;
+  bords[6] = (uint16_t) __brkval;
+  bords[7] = (uint16_t) &__heap_end;
+  bords[8] = 0xFFFF;
+
+  // __brkval may be zero if heap is empty
+  if (bords[6] == 0) bords[6] = bords[5];
+}
+
+void Memory::print_ram_analysis() {
+  calculate_bords();
+
+#ifdef LOGGING
+  SER_LOG_PRINT("RAM Analysis:\n");
+
+  for (uint8_t i = 0; i <= NUM_TYPES; ++i) {
+    SER_LOG_PRINT("+----------------------+ < 0x%04X\n", bords[i]);
+
+    if (i >= NUM_TYPES) break;
+
+    const char *name = Util::strdup_P(NAMES[i]);
+    uint16_t size = bords[i + 1] - bords[i];
+    uint8_t percentage = 100 * ((float) size / (float) bords[8]);
+
+    SER_LOG_PRINT("| %-6s %5db (%3d%%) |\n", name, size, percentage);
+
+    free((void *) name);
+  }
+
+  HeapStats heap;
+  get_heap_stats(&heap);
+
+  StackStats stack;
+  get_stack_stats(&stack);
+
+  SER_LOG_PRINT("Heap: %u in use, %u peak, %u high-water, %u%% fragmented.\n", heap.in_use, heap.peak, heap.high_water, heap.fragmentation);
+  SER_LOG_PRINT("Stack: %u in use, %u high-water, %u available.\n", stack.current, stack.high_water, stack.size);
+
+  SER_LOG_PRINT("\n");
+#endif
+}
+
+void Memory::get_heap_stats(HeapStats *out) {
+  out->in_use     = heap_in_use;
+  out->peak       = heap_peak;
+  out->high_water = heap_hw;
+  out->failures   = heap_failures;
+
+  uint16_t listed  = 0;
+  uint16_t largest = 0;
+
+  for (auto *block = __flp; block != nullptr; block = block->nx) {
+    listed += block->sz + sizeof(size_t);
+    largest = MAX(largest, block->sz);
+  }
+
+  const char *top = (__brkval == nullptr ? __malloc_heap_start : (const char *) __brkval);
+  const char *end = (__malloc_heap_end != nullptr ? __malloc_heap_end : (const char *) SP - __malloc_margin);
+
+  const uint16_t unclaimed = (end > top ? end - top : 0);
+
+  out->free_listed  = listed;
+  out->unclaimed    = unclaimed;
+  out->largest_free = MAX(largest, (unclaimed > sizeof(size_t) ? unclaimed - sizeof(size_t) : 0));
+
+  const uint32_t total_free = (uint32_t) listed + unclaimed;
+
+  out->fragmentation = (total_free == 0 ? 0 : 100 - (uint8_t) (100 * (uint32_t) out->largest_free / total_free));
+}
+
+void Memory::get_stack_stats(StackStats *out) {
+  const uint8_t *bottom = &_end;
+  const uint8_t *sp     = (const uint8_t *) SP;
+  const uint8_t *p      = bottom;
+
+  while (p < sp && *p == STACK_CANARY) ++p;
+
+  out->size       = RAMEND - (uint16_t) bottom + 1;
+  out->current    = RAMEND - (uint16_t) sp;
+  out->high_water = RAMEND - (uint16_t) p + 1;
+}
+
+const Memory::TagStats &Memory::get_tag_stats(Tag tag) {
+  return tag_stats[tag];
+}
+
+void Memory::pack_stats(Comm::Packet *pkt) {
+  uint8_t i = 0;
+
+  auto put = [&pkt, &i](uint32_t val, uint8_t width) {
+    while (width --> 0) {
+      pkt->buffer[i++] = val & 0xFF;
+      val >>= 8;
+    }
+  };
+
+  HeapStats heap;
+  get_heap_stats(&heap);
+
+  StackStats stack;
+  get_stack_stats(&stack);
+
+  put(PKT_MEMSTAT, 1);
+
+  put(heap.in_use, 2);
+  put(heap.peak, 2);
+  put(heap.high_water, 2);
+  put(heap.free_listed, 2);
+  put(heap.largest_free, 2);
+  put(heap.unclaimed, 2);
+  put(heap.fragmentation, 1);
+  put(heap.failures, 2);
+
+  put(stack.size, 2);
+  put(stack.current, 2);
+  put(stack.high_water, 2);
+
+  put(NUM_TAGS, 1);
+
+  for (uint8_t tag = 0; tag < NUM_TAGS; ++tag) {
+    put(tag_stats[tag].allocs, 2);
+    put(tag_stats[tag].bytes, 4);
+  }
+
+  pkt->end = i - 1;
+}
+
+void Memory::init() {
+  Comm::add_handler(
+    PKT_MEMSTAT,
+    [](Comm::Packet *pkt) -> void {
+      pack_stats(pkt);
+      Comm::send(pkt);
+    }
+  );
+}
+
+void Memory::relocate_heap(void *buf, uint16_t len) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    __malloc_heap_start = (char *) buf;
+    __malloc_heap_end   = (char *) buf + len;
+
+    // An empty free list and no break yet, as if nothing had ever been allocated
+    __brkval = nullptr;
+    __flp    = nullptr;
+
+    heap_in_use = 0;
+  }
+}
@@ -0,0 +1,119 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+#include <Arduino.h>
+#include "constants.hpp"
+
+#include "comm.hpp"
+
+/*
+ * `Memory` keeps track of heap and stack usage.
+ *
+ * Every call to `malloc()`, `realloc()` and `free()` goes through wrappers (see `--wrap` in CMakeLists.txt)
+ * which count allocations and charge them to the subsystem that is currently active (see `Memory::Scope`).
+ * The free internal RAM is painted with a canary value at boot so that the deepest point the stack
+ * has ever reached can be measured later.
+ */
+struct Memory {
+  static void calculate_bords();
+  static void print_ram_analysis();
+
+  static constexpr uint8_t NUM_TYPES = 8;
+
+  static inline const char NAME_0[] PROGMEM = "Data";
+  static inline const char NAME_1[] PROGMEM = "BSS";
+  static inline const char NAME_2[] PROGMEM = "Free";
+  static inline const char NAME_3[] PROGMEM = "Stack";
+  static inline const char NAME_4[] PROGMEM = "Unused";
+  static inline const char NAME_5[] PROGMEM = "Heap";
+  static inline const char NAME_6[] PROGMEM = "Free";
+  static inline const char NAME_7[] PROGMEM = "8k Buf";
+
+  static inline const char *NAMES[NUM_TYPES] {
+    NAME_0, NAME_1, NAME_2, NAME_3, NAME_4, NAME_5, NAME_6, NAME_7,
+  };
+
+  static inline uint16_t bords[NUM_TYPES + 1];
+
+  // Subsystems that heap allocations are charged to
+  enum Tag : uint8_t {
+    OTHER,  // Anything not inside a `Memory::Scope`
+    GUI,    // Menus, buttons, keyboards
+    FILES,  // File controllers and file selection
+    COMM,   // Serial communication
+    PROG,   // Programmer actions
+    NUM_TAGS,
+  };
+
+  static inline const char TAG_0[] PROGMEM = "Other";
+  static inline const char TAG_1[] PROGMEM = "GUI";
+  static inline const char TAG_2[] PROGMEM = "Files";
+  static inline const char TAG_3[] PROGMEM = "Comm";
+  static inline const char TAG_4[] PROGMEM = "Prog";
+
+  static inline const char *TAG_NAMES[NUM_TAGS] {
+    TAG_0, TAG_1, TAG_2, TAG_3, TAG_4,
+  };
+
+  // Charges all allocations made during its lifetime to `tag`
+  class Scope {
+  public:
+    Scope(Tag tag) : m_prev(cur_tag) {
+      cur_tag = tag;
+    }
+
+    ~Scope() {
+      cur_tag = m_prev;
+    }
+
+  private:
+    Tag m_prev;
+  };
+
+  struct TagStats {
+    uint16_t allocs;  // Number of successful allocations
+    uint32_t bytes;   // Total bytes requested by those allocations
+  };
+
+  struct HeapStats {
+    uint16_t in_use;        // Bytes currently allocated, including allocator headers
+    uint16_t peak;          // Largest value `in_use` has ever had
+    uint16_t high_water;    // Largest size the heap has ever grown to
+    uint16_t free_listed;   // Bytes sitting in the allocator's free list
+    uint16_t largest_free;  // Largest block that can be allocated right now
+    uint16_t unclaimed;     // Bytes between the top of the heap and its end
+    uint8_t fragmentation;  // Percentage of free memory that is not in the largest free block
+    uint16_t failures;      // Number of allocations that returned null
+  };
+
+  struct StackStats {
+    uint16_t size;        // Bytes between the end of .bss and the top of internal RAM
+    uint16_t current;     // Bytes currently used
+    uint16_t high_water;  // Most bytes ever used since boot
+  };
+
+  // Walks the allocator's free list and fills in `out`
+  static void get_heap_stats(HeapStats *out);
+
+  // Scans the painted stack area and fills in `out`
+  static void get_stack_stats(StackStats *out);
+
+  // Returns the per-subsystem counters of `tag`
+  static const TagStats &get_tag_stats(Tag tag);
+
+  // Packs all statistics into `pkt` as a `PKT_MEMSTAT` response
+  static void pack_stats(Comm::Packet *pkt);
+
+  // Registers the `PKT_MEMSTAT` handler with `Comm`
+  static void init();
+
+  // Starts a new, empty heap in the `len` bytes at `buf` (e.g. an array on the stack), so that all of XRAM can be
+  // used for something else. Everything allocated before is lost, so the only way back is `Util::restart()`.
+  static void relocate_heap(void *buf, uint16_t len);
+
+  static constexpr uint8_t STACK_CANARY = 0xC5;
+
+  static inline Tag cur_tag = Tag::OTHER;
+};
+
+#endif
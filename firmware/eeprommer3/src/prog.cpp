@@ -6,6 +6,7 @@
 #include "eeprom.hpp"
 #include "error.hpp"
 #include "gui.hpp"
+#include "memory.hpp"
 #include "new_delete.hpp"
 #include "sd.hpp"
 #include "strfmt.hpp"
@@ -20,7 +21,7 @@
 extern TftCtrl tft;
 extern TouchCtrl tch;
 
-Programmer::Programmer() : m_menu(10, 10, 50, 10, 2, 30, true) {
+Programmer::Programmer() : m_menu(10, 10, 50, 10, 2, 24, true) {
   // Empty body because all work done in init list
 }
 
@@ -38,6 +39,8 @@ void show_help(uint8_t btn_id, bool is_confirm) {
     Strings::H_W_MULTI,
     Strings::H_DRAW_TEST,
     Strings::H_DEBUGS,
+    Strings::H_DUP,
+    Strings::H_CHECKSUM,
     Strings::H_INFO,
     Strings::H_X_CLOSE,
   };
@@ -70,6 +73,8 @@ void Programmer::init() {
   m_menu.add_btn_calc(Strings::A_W_MULTI,   TftColor::BLACK,          TftColor::ORANGE        );
   m_menu.add_btn_calc(Strings::A_DRAW_TEST, TftColor::DGRAY,          TftColor::GRAY          );
   m_menu.add_btn_calc(Strings::A_DEBUGS,    TftColor::DGRAY,          TftColor::GRAY          );
+  m_menu.add_btn_calc(Strings::A_DUP,       TftColor::WHITE,          TftColor::PURPLE        );
+  m_menu.add_btn_calc(Strings::A_CHECKSUM,  TftColor::YELLOW,         TftColor::OLIVE         );
 
   m_menu.add_btn(new Gui::Btn(TftCalc::right(tft, 24, 10), 10, 24, 24, Strings::A_INFO,    TftColor::WHITE,  TftColor::BLUE));
   m_menu.add_btn(new Gui::Btn(TftCalc::right(tft, 24, 44), 10, 24, 24, Strings::A_X_CLOSE, TftColor::YELLOW, TftColor::RED));
@@ -110,6 +115,7 @@ void Programmer::run() {
 
     // Run the action function if available
     if (cur_choice < NUM_ACTIONS) {
+      Memory::Scope scope(Memory::Tag::PROG);
       status_code = (*action)();
     }
 
@@ -129,6 +135,7 @@ void Programmer::show_status(ProgrammerBaseCore::Status code) {
     Strings::S_CODE_2,
     Strings::S_CODE_3,
     Strings::S_CODE_4,
+    Strings::S_CODE_5,
   };
 
   bool success = (code == ProgrammerBaseCore::Status::OK);
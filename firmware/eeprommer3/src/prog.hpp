@@ -26,7 +26,7 @@ public:
   void run();
   void show_status(ProgrammerBaseCore::Status code);
 
-  static constexpr uint8_t NUM_ACTIONS = 12;
+  static constexpr uint8_t NUM_ACTIONS = 14;
 
 #define FUNC(type, name) ((ProgrammerBaseCore::Func) &Programmer##type##Core::name)
 
@@ -41,6 +41,8 @@ public:
     FUNC(Multi,  write),
     FUNC(Other,  paint),
     FUNC(Other,  debug),
+    FUNC(Dup,    duplicate),
+    FUNC(Multi,  checksum),
     FUNC(Other,  about),
     FUNC(Other,  restart),
   };
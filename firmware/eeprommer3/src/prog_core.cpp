@@ -1,10 +1,14 @@
 #include <Arduino.h>
 #include "constants.hpp"
 
+#include "catalog.hpp"
+#include "comm.hpp"
+#include "crc.hpp"
 #include "dialog.hpp"
 #include "eeprom.hpp"
 #include "error.hpp"
 #include "file.hpp"
+#include "memory.hpp"
 #include "new_delete.hpp"
 #include "sd.hpp"
 #include "tft.hpp"
@@ -36,6 +40,20 @@ Status ProgrammerBaseCore::nop() {
   return Status::OK;
 }
 
+bool ProgrammerBaseCore::run_transfer(FileTransfer *xfer) {
+  Gui::ProgressIndicator bar(xfer->num_blocks(), 10, 50, TftCalc::fraction_x(tft, 10, 1), 40);
+
+  bar.for_each(
+    [&xfer] GUI_PROGRESS_INDICATOR_LAMBDA {
+      UNUSED_VAR(progress);
+
+      return !xfer->step() || tch.is_touching();
+    }
+  );
+
+  return xfer->is_done() && xfer->status() == FileTransfer::Status::OK;
+}
+
 /***************************/
 /******** BYTE CORE ********/
 /***************************/
@@ -102,8 +120,28 @@ Status ProgrammerByteCore::verify(uint16_t addr, void *data) {
 Status ProgrammerFileCore::read() {
   using AFStatus = Dialog::AskFileStatus;
 
+  // The choices are in the same order as `HexReader::Format`
+  const auto format = (HexReader::Format) Dialog::ask_choice(
+    Strings::P_OFORMAT, 1, 45, 0, 3,
+    Strings::L_FMT_RAW,  TftColor::CYAN,   TftColor::BLUE,
+    Strings::L_FMT_IHEX, TftColor::LGREEN, TftColor::DGREEN,
+    Strings::L_FMT_SREC, TftColor::ORANGE, TftColor::DRED
+  );
+
+  tft.fillScreen(TftColor::BLACK);
+
+  uint8_t fill = 0xFF;
+
+  if (format != HexReader::Format::RAW) {
+    fill = Dialog::ask_int<uint8_t>(Strings::P_FILL);
+    tft.fillScreen(TftColor::BLACK);
+  }
+
+  // Only a raw dump's size is known in advance
+  const uint32_t size = (format == HexReader::Format::RAW ? 0x8000 : 0);
+
   AFStatus fstatus;
-  FileCtrl *file = Dialog::ask_file(Strings::P_OFILE, O_CREAT | O_TRUNC | O_WRITE, &fstatus, false);
+  FileCtrl *file = Dialog::ask_file(Strings::P_OFILE, O_CREAT | O_TRUNC | O_WRITE, &fstatus, false, size);
 
   tft.fillScreen(TftColor::BLACK);
 
@@ -114,36 +152,77 @@ Status ProgrammerFileCore::read() {
     return Status::ERR_FILE;
   }
 
-  read_operation_core(file);
+  Status status;
+
+  if (format == HexReader::Format::RAW) {
+    status = read_operation_core(file);
+  }
+  else {
+    HexWriter writer(file, format, fill);
+
+    if (!writer.is_open()) {
+      delete file;
+      return Status::ERR_MEMORY;
+    }
+
+    status = read_operation_core(file, &writer);
+  }
+
   file->flush();
   file->close();
   delete file;
 
   tft.fillScreen(TftColor::BLACK);
 
-  return Status::OK;
+  return status;
 }
 
-void ProgrammerFileCore::read_operation_core(FileCtrl *file) {
-  uint8_t *buffer = (uint8_t *) xram::access(XRAM_8K_BUF);
+Status ProgrammerFileCore::read_operation_core(FileCtrl *file, HexWriter *writer) {
+  FileCtrlEeprom chip;
+  Status status = Status::OK;
 
   tft.drawText_P(10, 10, Strings::W_OFILE, TftColor::CYAN, 3);
 
-  Gui::ProgressIndicator bar(4, 10, 50, TftCalc::fraction_x(tft, 10, 1), 40);
+  if (writer == nullptr) {
+    FileTransfer xfer(&chip, file, FileCtrlEeprom::SIZE, FileTransfer::Mode::COPY);
 
-  bar.for_each(
-    [&buffer, &file] GUI_PROGRESS_INDICATOR_LAMBDA {
-      uint16_t addr = progress << 13;
+    // Canceled or failed, the dump is incomplete either way
+    if (!run_transfer(&xfer)) status = Status::ERR_FILE;
+  }
+  else {
+    Memory::Scope scope(Memory::Tag::PROG);
 
-      ee.read(addr, addr + 0x1FFF, buffer);
-      file->write(buffer, 0x2000);
+    auto *buffer = (uint8_t *) malloc(FileTransfer::BLOCK_SIZE);
+    if (buffer == nullptr) return Status::ERR_MEMORY;
 
-      return tch.is_touching();
-    }
-  );
+    Gui::ProgressIndicator bar(FileCtrlEeprom::SIZE / FileTransfer::BLOCK_SIZE, 10, 50, TftCalc::fraction_x(tft, 10, 1), 40);
+
+    bool canceled = false;
+
+    bar.for_each(
+      [&buffer, &chip, &writer, &canceled] GUI_PROGRESS_INDICATOR_LAMBDA {
+        const uint16_t addr = progress * FileTransfer::BLOCK_SIZE;
+
+        chip.read(buffer, FileTransfer::BLOCK_SIZE);
+        if (!writer->write(addr, buffer, FileTransfer::BLOCK_SIZE)) return true;
+
+        canceled = tch.is_touching();
+        return canceled;
+      }
+    );
+
+    free(buffer);
+
+    // The end-of-file record only goes after a complete dump
+    if (canceled || !writer->finish()) status = Status::ERR_FILE;
+  }
+
+  if (status != Status::OK) return status;
 
   tft.drawText_P(10, 110, Strings::F_READ, TftColor::CYAN);
   TftUtil::wait_continue();
+
+  return status;
 }
 
 Status ProgrammerFileCore::write() {
@@ -167,21 +246,39 @@ Status ProgrammerFileCore::write() {
     return Status::ERR_FILE;
   }
 
+  const HexReader::Format format = HexReader::detect(file);
+
+  if (format != HexReader::Format::RAW) {
+    Status status = write_from_image(file, format);
+    tft.fillScreen(TftColor::BLACK);
+
+    if (status == Status::OK) {
+      bool should_verify = Dialog::ask_yesno(Strings::P_VERIFY);
+      tft.fillScreen(TftColor::BLACK);
+
+      if (should_verify) status = verify_image(file, format);
+    }
+
+    file->close();
+    delete file;
+
+    return status;
+  }
+
   uint16_t addr = Dialog::ask_addr(Strings::P_ADDR_FILE);
   tft.fillScreen(TftColor::BLACK);
 
-  bool success = write_from_file(file, addr);
+  Status status = write_from_file(file, addr);
   tft.fillScreen(TftColor::BLACK);
 
-  if (!success) {
+  if (status != Status::OK) {
     delete file;
-    return Status::ERR_INVALID;
+    return status;
   }
 
   bool should_verify = Dialog::ask_yesno(Strings::P_VERIFY);
   tft.fillScreen(TftColor::BLACK);
 
-  Status status = Status::OK;
   if (should_verify) status = verify(addr, file);
 
   file->close();
@@ -190,79 +287,288 @@ Status ProgrammerFileCore::write() {
   return status;
 }
 
-bool ProgrammerFileCore::write_from_file(FileCtrl *file, uint16_t addr) {
-  if (file->size() > (0x7FFF - addr + 1)) {
+Status ProgrammerFileCore::write_from_file(FileCtrl *file, uint16_t addr) {
+  if (file->size() > 0x8000UL - addr) {
     Dialog::wait_error(ErrorLevel::WARNING, 0x3, Strings::T_TOO_BIG, Strings::E_TOO_BIG);
-    return false;
+    return Status::ERR_INVALID;
   }
 
-  write_operation_core(file, addr);
-  return true;
+  const Catalog::Entry *sums = file->checksums();
+
+  return (sums != nullptr ? write_changed_pages(file, addr, sums) : write_operation_core(file, addr));
 }
 
-void ProgrammerFileCore::write_operation_core(FileCtrl *file, uint16_t addr) {
-  uint16_t cur_addr = addr;
-  uint8_t *buffer = (uint8_t *) xram::access(XRAM_8K_BUF);
+Status ProgrammerFileCore::write_operation_core(FileCtrl *file, uint16_t addr) {
+  FileCtrlEeprom chip;
+  chip.seek(addr);
 
   tft.drawText_P(10, 10, Strings::W_IFILE, TftColor::CYAN, 3);
 
-  Gui::ProgressIndicator bar(ceil((float) file->size() / 0x2000), 10, 50, TftCalc::fraction_x(tft, 10, 1), 40);
+  FileTransfer xfer(file, &chip, file->size(), FileTransfer::Mode::COPY);
+
+  run_transfer(&xfer);
+
+  tft.drawText_P(10, 110, Strings::F_WRITE, TftColor::CYAN);
+  TftUtil::wait_continue();
+
+  return (xfer.status() == FileTransfer::Status::OK ? Status::OK : Status::ERR_FILE);
+}
+
+Status ProgrammerFileCore::write_changed_pages(FileCtrl *file, uint16_t addr, const Catalog::Entry *sums) {
+  Memory::Scope scope(Memory::Tag::PROG);
+
+  auto *expected = (uint8_t *) malloc(2 * Catalog::PAGE_SIZE);
+  if (expected == nullptr) return Status::ERR_MEMORY;
+
+  uint8_t *reality = expected + Catalog::PAGE_SIZE;
+
+  FileCtrlEeprom chip;
+  uint8_t unchanged = 0;
+  Status status = Status::OK;
+
+  tft.drawText_P(10, 10, Strings::W_IFILE, TftColor::CYAN, 3);
+
+  Gui::ProgressIndicator bar(Catalog::num_pages(sums), 10, 50, TftCalc::fraction_x(tft, 10, 1), 40);
 
   bar.for_each(
-    [&buffer, &file, &cur_addr] GUI_PROGRESS_INDICATOR_LAMBDA {
-      UNUSED_VAR(progress);
+    [&expected, &reality, &file, &addr, &sums, &chip, &unchanged, &status] GUI_PROGRESS_INDICATOR_LAMBDA {
+      const uint32_t offset = (uint32_t) progress * Catalog::PAGE_SIZE;
+      const uint16_t len    = MIN(sums->size - offset, Catalog::PAGE_SIZE);
 
-      uint16_t len = file->read(buffer, 0x2000);
+      // Reading the EEPROM is much quicker than writing it, so only pages that differ are written
+      chip.seek(addr + offset);
+      chip.read(reality, len);
 
-      if (len == 0) {
-        return false;  // Nothing to write
+      if (Crc::crc32(reality, len) == sums->pages[progress]) {
+        ++unchanged;
       }
+      else {
+        file->seek(offset);
+
+        // Whatever is left in the buffer from the last page mustn't end up in the chip
+        if (file->read(expected, len) != len) {
+          status = Status::ERR_FILE;
+          return true;
+        }
 
-      ee.write(cur_addr, buffer, len);
+        chip.seek(addr + offset);
+        chip.write(expected, len);
+      }
 
-      cur_addr += 0x2000;  // Next page
+      // The chip is only partly written, so it mustn't look like a finished write that can be verified
+      if (tch.is_touching()) {
+        status = Status::ERR_FILE;
+        return true;
+      }
 
-      return tch.is_touching();
+      return false;
     }
   );
 
+  free(expected);
+
+  if (status != Status::OK) return status;
+
   tft.drawText_P(10, 110, Strings::F_WRITE, TftColor::CYAN);
+  tft.drawText(10, 130, STRFMT_P_NOBUF(Strings::F_UNCHANGED, unchanged, Catalog::num_pages(sums)), TftColor::CYAN);
   TftUtil::wait_continue();
+
+  return Status::OK;
 }
 
-Status ProgrammerFileCore::verify(uint16_t addr, void *data) {
-  auto *file = (FileCtrl *) data;
+// Reads every run of data in an image file and passes it to `action`, until that returns true.
+// Shows a progress bar meanwhile, and a dialog if the file turns out to be invalid partway through.
+template<typename Func>
+Status ProgrammerFileCore::for_each_image_run(FileCtrl *file, HexReader::Format format, Func action) {
   file->seek(0);
 
-  uint8_t *expected = (uint8_t *) xram::access(XRAM_8K_BUF + 0x0000);
-  uint8_t *reality  = (uint8_t *) xram::access(XRAM_8K_BUF + 0x1000);
+  HexReader reader(file, format);
+  if (!reader.is_open()) return Status::ERR_MEMORY;
 
-  tft.drawText(10, 10, STRFMT_P_NOBUF(Strings::W_VERIFY, file->name(), addr), TftColor::CYAN);
+  HexReader::Status status = HexReader::Status::OK;
+  HexReader::Run run;
 
-  Gui::ProgressIndicator bar(ceil((float) file->size() / 0x1000), 10, 50, TftCalc::fraction_x(tft, 10, 1), 40);
+  bool in_range = true;
+  uint32_t step_end = 0;
 
-  bool complete = bar.for_each(
-    [&expected, &reality, &file, &addr] GUI_PROGRESS_INDICATOR_LAMBDA {
+  Gui::ProgressIndicator bar(ceil((float) file->size() / IMAGE_STEP), 10, 50, TftCalc::fraction_x(tft, 10, 1), 40);
+
+  bar.for_each(
+    [&reader, &status, &run, &in_range, &step_end, &action] GUI_PROGRESS_INDICATOR_LAMBDA {
       UNUSED_VAR(progress);
 
-      uint16_t nbytes = file->read(expected, 0x1000);
+      step_end += IMAGE_STEP;
+
+      while (reader.position() < step_end) {
+        status = reader.next(&run);
 
-      if (nbytes == 0) {
-        return false;  // Nothing to check
+        if (status == HexReader::Status::END) return false;  // Let the bar run out
+        if (status != HexReader::Status::OK) return true;
+
+        if (run.addr + run.len > 0x10000) {
+          in_range = false;
+          return true;
+        }
+
+        if (action(run)) return true;
       }
 
-      ee.read(addr, (addr + nbytes) - 1, reality);
+      return false;
+    }
+  );
+
+  const char *error = nullptr;
+
+  if      (!in_range)                                error = Strings::E_IMG_RNGE;
+  else if (status == HexReader::Status::ERR_SYNTAX)   error = Strings::E_IMG_SYNT;
+  else if (status == HexReader::Status::ERR_CHECKSUM) error = Strings::E_IMG_CSUM;
+
+  if (error == nullptr) return Status::OK;
+
+  Dialog::wait_error(ErrorLevel::ERROR, 0x1, Strings::T_BAD_IMG, STRFMT_P_NOBUF(error, reader.line()));
+  return Status::ERR_INVALID;
+}
+
+// The EEPROM takes up 32 KiB of a 64 KiB address space, so record addresses wrap around it,
+// e.g. a ROM assembled for 0x8000-0xFFFF goes to 0x0000-0x7FFF
+Status ProgrammerFileCore::write_from_image(FileCtrl *file, HexReader::Format format) {
+  // Not in XRAM, which may hold the image itself (RAM disk)
+  uint8_t page[EepromCtrl::PAGE_SIZE];
+
+  uint16_t page_addr = 0;
+  uint8_t  page_len  = 0;
+
+  // Bytes are gathered until they leave an EEPROM page or stop being consecutive, then written together
+  auto flush_page = [&page, &page_addr, &page_len]() {
+    if (page_len > 0) ee.write(page_addr, page, page_len);
+    page_len = 0;
+  };
+
+  tft.drawText_P(10, 10, Strings::W_IFILE, TftColor::CYAN, 3);
+
+  Status status = for_each_image_run(
+    file, format,
+    [&page, &page_addr, &page_len, &flush_page](const HexReader::Run &run) {
+      for (uint8_t i = 0; i < run.len; ++i) {
+        const uint16_t addr = (run.addr + i) & 0x7FFF;
+
+        if (page_len > 0 && addr != page_addr + page_len) flush_page();
+        if (page_len == 0) page_addr = addr;
+
+        page[page_len++] = run.data[i];
+
+        if ((addr + 1) % EepromCtrl::PAGE_SIZE == 0) flush_page();
+      }
 
-      if (memcmp(expected, reality, nbytes) != 0) {
-        tft.drawText(10, 150, STRFMT_P_NOBUF(Strings::E_MISMATCH, addr, addr + 0x0FFF), TftColor::RED);
+      return tch.is_touching();
+    }
+  );
+
+  flush_page();
+
+  if (status != Status::OK) return status;
+
+  tft.drawText_P(10, 110, Strings::F_WRITE, TftColor::CYAN);
+  TftUtil::wait_continue();
+
+  return Status::OK;
+}
+
+Status ProgrammerFileCore::verify_image(FileCtrl *file, HexReader::Format format) {
+  bool mismatch = false;
+
+  tft.drawText(10, 10, STRFMT_P_NOBUF(Strings::W_VRF_IMG, file->name()), TftColor::CYAN);
+
+  Status status = for_each_image_run(
+    file, format,
+    [&mismatch](const HexReader::Run &run) {
+      for (uint8_t i = 0; i < run.len; ++i) {
+        if (ee.read((run.addr + i) & 0x7FFF) != run.data[i]) {
+          const uint16_t addr = run.addr & 0x7FFF;
+
+          tft.drawText(10, 150, STRFMT_P_NOBUF(Strings::E_MISMATCH, addr, addr + run.len - 1), TftColor::RED);
+          mismatch = true;
+          return true;  // Request to quit loop
+        }
+      }
+
+      return false;
+    }
+  );
+
+  if (status != Status::OK) return status;
+
+  tft.drawText_P(10, 110, Strings::F_VERIFY, TftColor::CYAN);
+  TftUtil::wait_continue();
+
+  tft.fillScreen(TftColor::BLACK);
+  return (mismatch ? Status::ERR_VERIFY : Status::OK);
+}
+
+Status ProgrammerFileCore::verify_checksums(FileCtrl *file, uint16_t addr, const Catalog::Entry *sums) {
+  Memory::Scope scope(Memory::Tag::PROG);
+
+  auto *reality = (uint8_t *) malloc(Catalog::PAGE_SIZE);
+  if (reality == nullptr) return Status::ERR_MEMORY;
+
+  FileCtrlEeprom chip;
+  chip.seek(addr);
+
+  tft.drawText(10, 10, STRFMT_P_NOBUF(Strings::W_VERIFY, file->name(), addr), TftColor::CYAN);
+
+  Gui::ProgressIndicator bar(Catalog::num_pages(sums), 10, 50, TftCalc::fraction_x(tft, 10, 1), 40);
+
+  bool complete = bar.for_each(
+    [&reality, &addr, &sums, &chip] GUI_PROGRESS_INDICATOR_LAMBDA {
+      const uint32_t offset = (uint32_t) progress * Catalog::PAGE_SIZE;
+      const uint16_t len    = MIN(sums->size - offset, Catalog::PAGE_SIZE);
+
+      chip.read(reality, len);
+
+      if (Crc::crc32(reality, len) != sums->pages[progress]) {
+        const uint16_t page_addr = addr + offset;
+
+        tft.drawText(10, 150, STRFMT_P_NOBUF(Strings::E_MISMATCH, page_addr, page_addr + len - 1), TftColor::RED);
         return true;  // Request to quit loop
       }
 
-      addr += 0x1000;  // Next sector
       return false;
     }
   );
 
+  free(reality);
+
+  tft.drawText_P(10, 110, Strings::F_VERIFY, TftColor::CYAN);
+  TftUtil::wait_continue();
+
+  tft.fillScreen(TftColor::BLACK);
+  return (complete ? Status::OK : Status::ERR_VERIFY);
+}
+
+Status ProgrammerFileCore::verify(uint16_t addr, void *data) {
+  auto *file = (FileCtrl *) data;
+
+  // Known checksums spare reading the file again
+  const Catalog::Entry *sums = file->checksums();
+  if (sums != nullptr) return verify_checksums(file, addr, sums);
+
+  file->seek(0);
+
+  FileCtrlEeprom chip;
+  chip.seek(addr);
+
+  tft.drawText(10, 10, STRFMT_P_NOBUF(Strings::W_VERIFY, file->name(), addr), TftColor::CYAN);
+
+  FileTransfer xfer(file, &chip, file->size(), FileTransfer::Mode::COMPARE);
+
+  const bool complete = run_transfer(&xfer);
+
+  if (xfer.status() != FileTransfer::Status::OK) {
+    const uint16_t block_addr = addr + xfer.block_offset();
+
+    tft.drawText(10, 150, STRFMT_P_NOBUF(Strings::E_MISMATCH, block_addr, block_addr + xfer.block_len() - 1), TftColor::RED);
+  }
+
   tft.drawText_P(10, 110, Strings::F_VERIFY, TftColor::CYAN);
   TftUtil::wait_continue();
 
@@ -464,24 +770,10 @@ Status ProgrammerMultiCore::store_file(uint8_t *data, uint16_t len) {
 void ProgrammerMultiCore::store_file_operation_core(uint8_t *data, uint16_t len, FileCtrl *file) {
   tft.drawText_P(10, 10, Strings::W_WAIT, TftColor::CYAN, 3);
 
-  Gui::ProgressIndicator bar(ceil((float) len / 256.0), 10, 50, TftCalc::fraction_x(tft, 10, 1), 40);
-
-  bar.for_each(
-    [&data, &len, &file] GUI_PROGRESS_INDICATOR_LAMBDA {
-      UNUSED_VAR(progress);
-
-      file->write(data, min(256, len));
-
-      if (len < 0x0100) {
-        return false;  // Request to quit loop
-      }
+  FileCtrlXram source(data, len, &len, O_RDONLY);
+  FileTransfer xfer(&source, file, len, FileTransfer::Mode::COPY);
 
-      data += 0x0100;
-      len -= 0x0100;
-
-      return tch.is_touching();
-    }
-  );
+  run_transfer(&xfer);
 
   file->flush();
 
@@ -554,6 +846,219 @@ Status ProgrammerMultiCore::verify(uint16_t addr, void *data) {
   return Status::OK;
 }
 
+Status ProgrammerMultiCore::checksum() {
+  uint16_t addr1 = Dialog::ask_addr(Strings::P_ADDR_BEG);
+  tft.fillScreen(TftColor::BLACK);
+  uint16_t addr2 = Dialog::ask_addr(Strings::P_ADDR_END);
+  tft.fillScreen(TftColor::BLACK);
+
+  Util::validate_addrs(&addr1, &addr2);
+
+  static const char *const names[] PROGMEM {
+    Strings::L_CRC16,
+    Strings::L_CRC32,
+    Strings::L_FLETCHER,
+  };
+
+  // The choices are in the same order as `Crc::Algo`
+  const auto algo = (Crc::Algo) Dialog::ask_choice(
+    Strings::P_CHECKSUM, 1, 45, Crc::Algo::CRC32, 3,
+    Strings::L_CRC16,    TftColor::CYAN,   TftColor::BLUE,
+    Strings::L_CRC32,    TftColor::LGREEN, TftColor::DGREEN,
+    Strings::L_FLETCHER, TftColor::ORANGE, TftColor::DRED
+  );
+
+  tft.fillScreen(TftColor::BLACK);
+  tft.drawText_P(10, 10, Strings::W_RMULTI, TftColor::CYAN, 3);
+
+  const uint16_t nbytes = addr2 - addr1 + 1;
+
+  Crc::Engine sum(algo);
+  Gui::ProgressIndicator bar((nbytes + CHECKSUM_STEP - 1) / CHECKSUM_STEP, 10, 50, TftCalc::fraction_x(tft, 10, 1), 40);
+
+  const bool finished = bar.for_each(
+    [&addr1, &addr2, &sum] GUI_PROGRESS_INDICATOR_LAMBDA {
+      const uint16_t start = addr1 + progress * CHECKSUM_STEP;
+      const uint16_t end   = (addr2 - start < CHECKSUM_STEP ? addr2 : start + CHECKSUM_STEP - 1);
+
+      // Nothing is kept, each byte goes into the checksum as it comes off the bus
+      ee.read(start, end, nullptr, &sum);
+
+      return tch.is_touching();
+    }
+  );
+
+  tft.fillScreen(TftColor::BLACK);
+
+  if (!finished) {
+    Dialog::wait_error(ErrorLevel::INFO, 0x3, Strings::T_CANCELED, Strings::E_CANCELED);
+    tft.fillScreen(TftColor::BLACK);
+
+    return Status::OK;
+  }
+
+  char name[16];
+  strncpy_P(name, (const char *) pgm_read_word_near(names + algo), sizeof(name) - 1);
+  name[sizeof(name) - 1] = '\0';
+
+  Dialog::wait_error(
+    ErrorLevel::INFO, 0x1, Strings::T_CHECKSUM,
+    (sum.size() == 4 ? STRFMT_P_NOBUF(Strings::G_CSUM_32, name, addr1, addr2, sum.result())
+                     : STRFMT_P_NOBUF(Strings::G_CSUM_16, name, addr1, addr2, (uint16_t) sum.result()))
+  );
+
+  tft.fillScreen(TftColor::BLACK);
+
+  return Status::OK;
+}
+
+/********************************/
+/******** DUPLICATE CORE ********/
+/********************************/
+
+Status ProgrammerDupCore::duplicate() {
+  auto *image = (uint8_t *) xram::access(0x8000);
+
+  Dialog::wait_error(ErrorLevel::WARNING, 0x3, Strings::T_DUP, Strings::E_DUP);
+  tft.fillScreen(TftColor::BLACK);
+
+  if (!Dialog::ask_yesno(Strings::P_DUP_MSTR)) {
+    tft.fillScreen(TftColor::BLACK);
+    Dialog::wait_error(ErrorLevel::INFO, 0x3, Strings::T_CANCELED, Strings::E_CANCELED);
+    return Status::OK;
+  }
+
+  tft.fillScreen(TftColor::BLACK);
+
+  // Nothing may be left in XRAM once the heap is gone; the serial RX ring and the log are the only things that
+  // are used on their own
+  ser.release_rx_buffer();
+  Log::release_buffer();
+
+  uint8_t heap[HEAP_SIZE];
+  Memory::relocate_heap(heap, sizeof(heap));
+
+  tft.drawText_P(10, 10, Strings::W_DUP_READ, TftColor::CYAN, 3);
+
+  Gui::ProgressIndicator bar(EE_SIZE / STEP, 10, 50, TftCalc::fraction_x(tft, 10, 1), 40);
+
+  Crc::Engine sum(Crc::Algo::CRC32);
+
+  bar.for_each(
+    [&image, &sum] GUI_PROGRESS_INDICATOR_LAMBDA {
+      const uint16_t addr = (uint16_t) progress * STEP;
+
+      ee.read(addr, addr + STEP - 1, image + addr, &sum);
+
+      return false;
+    }
+  );
+
+  const uint32_t crc = sum.result();
+
+  uint16_t passed = 0, failed = 0;
+  uint16_t bad_addr = 0;
+  CopyResult last = CopyResult::COPIED;
+
+  while (true) {
+    tft.fillScreen(TftColor::BLACK);
+    tft.drawText_P(10, 10, Strings::T_DUP, TftColor::CYAN, 3);
+    tft.drawText(10,  50, STRFMT_P_NOBUF(Strings::L_DUP_CRC, crc), TftColor::WHITE);
+    tft.drawText(10,  80, STRFMT_P_NOBUF(Strings::L_DUP_PASS, passed), TftColor::GREEN);
+    tft.drawText(10, 105, STRFMT_P_NOBUF(Strings::L_DUP_FAIL, failed), TftColor::RED);
+
+    if (last == CopyResult::MISMATCH) {
+      tft.drawText(10, 140, STRFMT_P_NOBUF(Strings::T_MSMCH_AT, bad_addr), TftColor::RED);
+    }
+    else if (last == CopyResult::CANCELED) {
+      tft.drawText_P(10, 140, Strings::T_CANCELED, TftColor::RED);
+    }
+
+    tft.drawText_P(10, 175, Strings::L_DUP_NEXT, TftColor::LGRAY);
+
+    if (!ask_next()) break;
+
+    tft.fillScreen(TftColor::BLACK);
+    tft.drawText_P(10, 10, Strings::W_DUP_WRITE, TftColor::CYAN, 3);
+
+    last = copy(image, &bad_addr);
+
+    if (last == CopyResult::COPIED) ++passed;
+    else                            ++failed;
+  }
+
+  tft.fillScreen(TftColor::BLACK);
+  tft.drawText_P(10, 10, Strings::W_RESTART, TftColor::CYAN, 3);
+
+  // The old heap is gone for good
+  SER_LOG_PRINT("Duplicated %u chips (%u failed), restarting...\n\n", passed, failed);
+  delay(1000);
+  Util::restart();
+
+  return Status::OK;
+}
+
+bool ProgrammerDupCore::ask_next() {
+  Gui::Btn prog_btn(10, TftCalc::bottom(tft, 24, 44), TftCalc::fraction_x(tft, 10, 1), 24, Strings::L_PROGRAM, TftColor::BLACK, TftColor::GREEN);
+  Gui::Btn done_btn(BOTTOM_BTN(Strings::L_DONE));
+
+  prog_btn.draw();
+  done_btn.draw();
+
+  while (true) {
+    if (prog_btn.is_pressed()) break;
+    if (done_btn.is_pressed()) return false;
+  }
+
+  // Otherwise the press would cancel the copy right away
+  while (tch.is_touching()) {
+    /* wait */;
+  }
+
+  return true;
+}
+
+ProgrammerDupCore::CopyResult ProgrammerDupCore::copy(uint8_t *image, uint16_t *bad_addr) {
+  Gui::ProgressIndicator bar(EE_SIZE / STEP, 10, 50, TftCalc::fraction_x(tft, 10, 1), 40);
+
+  CopyResult result = CopyResult::COPIED;
+
+  bar.for_each(
+    [&image, &bad_addr, &result] GUI_PROGRESS_INDICATOR_LAMBDA {
+      const uint16_t addr = (uint16_t) progress * STEP;
+
+      for (uint16_t page = addr; page < addr + STEP; page += EepromCtrl::PAGE_SIZE) {
+        uint8_t reality[EepromCtrl::PAGE_SIZE];
+
+        // Groups that already match (e.g. blank ones of the master) needn't be written
+        ee.read(page, page + EepromCtrl::PAGE_SIZE - 1, reality);
+        if (memcmp(reality, image + page, EepromCtrl::PAGE_SIZE) == 0) continue;
+
+        ee.write(page, image + page, EepromCtrl::PAGE_SIZE);
+        ee.read(page, page + EepromCtrl::PAGE_SIZE - 1, reality);
+
+        for (uint8_t i = 0; i < EepromCtrl::PAGE_SIZE; ++i) {
+          if (reality[i] != image[page + i]) {
+            *bad_addr = page + i;
+            result    = CopyResult::MISMATCH;
+
+            return true;
+          }
+        }
+      }
+
+      if (tch.is_touching()) {
+        result = CopyResult::CANCELED;
+        return true;
+      }
+
+      return false;
+    }
+  );
+
+  return result;
+}
+
 /***********************************/
 /******** OTHER CORE - MISC ********/
 /***********************************/
@@ -567,22 +1072,24 @@ Status ProgrammerOtherCore::paint() {
 }
 
 Status ProgrammerOtherCore::debug() {
-  const auto w1 = TftCalc::fraction_x(tft, 10, 1);
   const auto w2 = TftCalc::fraction_x(tft, 10, 2);
   const auto x2 = w2 + 20;
 
   Gui::Menu menu;
-  menu.add_btn(new Gui::Btn(10, 50,  w2, 28, Strings::D_WE_HI,     TftColor::LGREEN, TftColor::DGREEN));
-  menu.add_btn(new Gui::Btn(x2, 50,  w2, 28, Strings::D_WE_LO,     TftColor::PINKK,  TftColor::RED   ));
-  menu.add_btn(new Gui::Btn(10, 88,  w1, 28, Strings::D_SET_ADDR,  TftColor::BLACK,  TftColor::YELLOW));
-  menu.add_btn(new Gui::Btn(10, 126, w2, 28, Strings::D_RD_DATA,   TftColor::BLUE,   TftColor::CYAN  ));
-  menu.add_btn(new Gui::Btn(x2, 126, w2, 28, Strings::D_WR_DATA,   TftColor::CYAN,   TftColor::BLUE  ));
-  menu.add_btn(new Gui::Btn(10, 164, w2, 28, Strings::D_SET_DDIR,  TftColor::BLACK,  TftColor::ORANGE));
-  menu.add_btn(new Gui::Btn(x2, 164, w2, 28, Strings::D_MON_DATA,  TftColor::YELLOW, TftColor::DCYAN ));
-  menu.add_btn(new Gui::Btn(10, 202, w2, 28, Strings::D_P_CHARSET, TftColor::PINKK,  TftColor::PURPLE));
-  menu.add_btn(new Gui::Btn(x2, 202, w2, 28, Strings::D_SHOW_COL,  TftColor::PINKK,  TftColor::PURPLE));
-  menu.add_btn(new Gui::Btn(10, 240, w2, 28, Strings::D_AUX1,      TftColor::DGRAY,  TftColor::LGRAY ));
-  menu.add_btn(new Gui::Btn(x2, 240, w2, 28, Strings::D_AUX2,      TftColor::DGRAY,  TftColor::LGRAY ));
+  menu.add_btn(new Gui::Btn(10, 50,  w2, 26, Strings::D_WE_HI,     TftColor::LGREEN, TftColor::DGREEN));
+  menu.add_btn(new Gui::Btn(x2, 50,  w2, 26, Strings::D_WE_LO,     TftColor::PINKK,  TftColor::RED   ));
+  menu.add_btn(new Gui::Btn(10, 84,  w2, 26, Strings::D_SET_ADDR,  TftColor::BLACK,  TftColor::YELLOW));
+  menu.add_btn(new Gui::Btn(x2, 84,  w2, 26, Strings::D_MEM_STAT,  TftColor::BLACK,  TftColor::LIME  ));
+  menu.add_btn(new Gui::Btn(10, 118, w2, 26, Strings::D_RD_DATA,   TftColor::BLUE,   TftColor::CYAN  ));
+  menu.add_btn(new Gui::Btn(x2, 118, w2, 26, Strings::D_WR_DATA,   TftColor::CYAN,   TftColor::BLUE  ));
+  menu.add_btn(new Gui::Btn(10, 152, w2, 26, Strings::D_SET_DDIR,  TftColor::BLACK,  TftColor::ORANGE));
+  menu.add_btn(new Gui::Btn(x2, 152, w2, 26, Strings::D_MON_DATA,  TftColor::YELLOW, TftColor::DCYAN ));
+  menu.add_btn(new Gui::Btn(10, 186, w2, 26, Strings::D_P_CHARSET, TftColor::PINKK,  TftColor::PURPLE));
+  menu.add_btn(new Gui::Btn(x2, 186, w2, 26, Strings::D_SHOW_COL,  TftColor::PINKK,  TftColor::PURPLE));
+  menu.add_btn(new Gui::Btn(10, 220, w2, 26, Strings::D_XRAM_TST,  TftColor::BLACK,  TftColor::LIME  ));
+  menu.add_btn(new Gui::Btn(x2, 220, w2, 26, Strings::D_XRAM_TUNE, TftColor::BLACK,  TftColor::LIME  ));
+  menu.add_btn(new Gui::Btn(10, 254, w2, 26, Strings::D_AUX1,      TftColor::DGRAY,  TftColor::LGRAY ));
+  menu.add_btn(new Gui::Btn(x2, 254, w2, 26, Strings::D_AUX2,      TftColor::DGRAY,  TftColor::LGRAY ));
   menu.add_btn(new Gui::Btn(BOTTOM_BTN(Strings::L_CLOSE)));
 
   while (true) {
@@ -608,12 +1115,15 @@ void ProgrammerOtherCore::do_debug_action(DebugAction action) {
   case DebugAction::DISABLE_WRITE:       ee.set_we(true);      return;
   case DebugAction::ENABLE_WRITE:        ee.set_we(false);     return;
   case DebugAction::SET_ADDR_BUS_AND_OE: set_addr_and_oe();    return;
+  case DebugAction::SHOW_MEMORY_STATS:   show_memory_stats();  return;
   case DebugAction::READ_DATA_BUS:       read_data_bus();      return;
   case DebugAction::WRITE_DATA_BUS:      write_data_bus();     return;
   case DebugAction::SET_DATA_DIR:        set_data_dir();       return;
   case DebugAction::MONITOR_DATA_BUS:    monitor_data_bus();   return;
   case DebugAction::PRINT_CHARSET:       print_charset_wait(); return;
   case DebugAction::SHOW_COLORS:         tft_show_colors();    return;
+  case DebugAction::TEST_XRAM:           test_xram();          return;
+  case DebugAction::TUNE_XRAM:           tune_xram();          return;
   case DebugAction::ACTION_AUX1:         debug_action_aux1();  return;
   case DebugAction::ACTION_AUX2:         debug_action_aux2();  return;
   }
@@ -625,6 +1135,37 @@ void ProgrammerOtherCore::set_addr_and_oe() {
   );
 }
 
+void ProgrammerOtherCore::show_memory_stats() {
+  Memory::HeapStats heap;
+  Memory::get_heap_stats(&heap);
+
+  Memory::StackStats stack;
+  Memory::get_stack_stats(&stack);
+
+  SerialCtrl::Stats serial;
+  ser.get_stats(&serial);
+
+  const uint16_t heap_free = heap.free_listed + heap.unclaimed;
+
+  tft.drawText_P(10, 10, Strings::T_MEM_STAT, TftColor::CYAN, 3);
+
+  tft.drawText(10,  50, STRFMT_P_NOBUF(Strings::L_MEM_HEAP1, heap.in_use, heap.peak),                            TftColor::WHITE);
+  tft.drawText(10,  75, STRFMT_P_NOBUF(Strings::L_MEM_HEAP2, heap.high_water, heap.failures),                    TftColor::WHITE);
+  tft.drawText(10, 100, STRFMT_P_NOBUF(Strings::L_MEM_HEAP3, heap_free, heap.largest_free, heap.fragmentation),  TftColor::WHITE);
+  tft.drawText(10, 125, STRFMT_P_NOBUF(Strings::L_MEM_STACK, stack.current, stack.high_water, stack.size),       TftColor::WHITE);
+  tft.drawText(10, 150, STRFMT_P_NOBUF(Strings::L_MEM_SERRX, serial.overruns, serial.high_water, serial.size),   TftColor::WHITE);
+
+  for (uint8_t tag = 0; tag < Memory::NUM_TAGS; ++tag) {
+    const auto &stats = Memory::get_tag_stats((Memory::Tag) tag);
+
+    const char *name = Util::strdup_P(Memory::TAG_NAMES[tag]);
+    tft.drawText(10, 180 + 20 * tag, STRFMT_P_NOBUF(Strings::L_MEM_TAG, name, stats.allocs, stats.bytes), TftColor::LGRAY);
+    free((void *) name);
+  }
+
+  TftUtil::wait_bottom_btn(Strings::L_CLOSE);
+}
+
 void ProgrammerOtherCore::read_data_bus() {
   Dialog::wait_error(
     ErrorLevel::INFO, 0x1, Strings::T_VALUE,
@@ -675,6 +1216,56 @@ void ProgrammerOtherCore::print_charset_wait() {
   tch.wait_for_press();
 }
 
+void ProgrammerOtherCore::test_xram() {
+  tft.drawText_P(10, 10, Strings::W_XRAM_TST, TftColor::CYAN, 3);
+
+  xram::test_reset();
+
+  // Each step of the bar covers 512 bytes
+  Gui::ProgressIndicator bar(0x8000 / 0x200, 10, 50, TftCalc::fraction_x(tft, 10, 1), 40);
+
+  bar.for_each(
+    [] GUI_PROGRESS_INDICATOR_LAMBDA {
+      UNUSED_VAR(progress);
+
+      for (uint8_t i = 0; i < 0x200 / xram::TEST_CHUNK; ++i) {
+        xram::test_step();
+      }
+
+      return false;
+    }
+  );
+
+  const auto &res = xram::test_results();
+  const uint16_t color = (res.successes == 0x8000 ? TftColor::GREEN : TftColor::RED);
+
+  tft.drawText(10, 110, STRFMT_P_NOBUF(Strings::F_XRAM_TST, res.successes, res.time), color);
+  TftUtil::wait_continue();
+}
+
+void ProgrammerOtherCore::tune_xram() {
+  tft.drawText_P(10, 10, Strings::W_XRAM_TUNE, TftColor::CYAN, 3);
+
+  // The heap is in use, so only the 8K buffer can be overwritten
+  auto res = xram::tune(XRAM_8K_BUF, 0x2000);
+
+  // Nothing passed, so keep whatever was saved rather than settling for the slowest setting for good
+  if (res.passed != 0x00) xram::save_waits(res.waits);
+
+  for (uint8_t waits = 0; waits <= xram::MAX_WAITS; ++waits) {
+    const bool passed = (res.passed & (1 << waits));
+
+    tft.drawText(
+      10, 50 + 25 * waits,
+      STRFMT_P_NOBUF(Strings::L_XRAM_WAIT, waits, (passed ? "OK" : "FAIL")),
+      (passed ? TftColor::GREEN : TftColor::RED)
+    );
+  }
+
+  tft.drawText(10, 160, STRFMT_P_NOBUF(Strings::F_XRAM_TUNE, res.waits), TftColor::WHITE);
+  TftUtil::wait_continue();
+}
+
 void ProgrammerOtherCore::debug_action_aux1() {
   uint8_t temp[] {
     0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1,
@@ -715,3 +1306,321 @@ Status ProgrammerOtherCore::restart() {
 
 #undef RETURN_VERIFICATION_OR_VALUE
 #undef RETURN_VERIFICATION_OR_OK
+
+/*****************************/
+/******** REMOTE CORE ********/
+/*****************************/
+
+void ProgrammerRemoteCore::init() {
+  Comm::add_handler(PKT_PING,   handle_ping);
+  Comm::add_handler(PKT_EEINFO, handle_info);
+  Comm::add_handler(PKT_EEREAD, handle_read);
+  Comm::add_handler(PKT_EEWRIT, handle_write);
+  Comm::add_handler(PKT_EEVRFY, handle_verify);
+  Comm::add_handler(PKT_EEFILL, handle_fill);
+  Comm::add_handler(PKT_EECSUM, handle_checksum);
+  Comm::add_handler(PKT_EEDUMP, handle_dump);
+  Comm::add_handler(PKT_EEHASH, handle_hash);
+}
+
+void ProgrammerRemoteCore::handle_ping(Comm::Packet *pkt) {
+  // A late reply to one of our own pings has capabilities in it, only a bare ping is a request
+  if (pkt->end != 0) return;
+
+  Comm::ping();
+}
+
+void ProgrammerRemoteCore::handle_info(Comm::Packet *pkt) {
+  const uint32_t baud = Comm::get_baud();
+
+  pkt->buffer[2]  = VERSION;
+  pkt->buffer[3]  = EE_SIZE & 0xFF;
+  pkt->buffer[4]  = EE_SIZE >> 8;
+  pkt->buffer[5]  = BLOCK_SIZE & 0xFF;
+  pkt->buffer[6]  = BLOCK_SIZE >> 8;
+  pkt->buffer[7]  = Comm::get_caps();
+  pkt->buffer[8]  = baud & 0xFF;
+  pkt->buffer[9]  = (baud >> 8) & 0xFF;
+  pkt->buffer[10] = (baud >> 16) & 0xFF;
+  pkt->buffer[11] = baud >> 24;
+
+  reply(pkt, Status::OK, 10);
+}
+
+void ProgrammerRemoteCore::handle_read(Comm::Packet *pkt) {
+  uint16_t addr, len;
+
+  if (!get_range(pkt, &addr, &len)) {
+    reply(pkt, Status::ERR_INVALID);
+    return;
+  }
+
+  uint8_t *buf = alloc_block();
+
+  if (buf == nullptr) {
+    reply(pkt, Status::ERR_MEMORY);
+    return;
+  }
+
+  reply(pkt, Status::OK);
+
+  for (uint16_t done = 0; done < len; done += BLOCK_SIZE) {
+    const uint16_t count = MIN(BLOCK_SIZE, len - done);
+
+    ee.read(addr + done, addr + done + count - 1, buf);
+
+    if (Comm::stream_send(buf, count) < count) break;  // Computer stopped acknowledging; it times out by itself
+  }
+
+  free(buf);
+}
+
+void ProgrammerRemoteCore::handle_write(Comm::Packet *pkt) {
+  uint16_t addr, len;
+
+  if (pkt->end < 5 || !get_range(pkt, &addr, &len)) {
+    reply(pkt, Status::ERR_INVALID);
+    return;
+  }
+
+  recv_blocks(pkt, addr, len, true, pkt->buffer[5] & FLAG_VERIFY);
+}
+
+void ProgrammerRemoteCore::handle_verify(Comm::Packet *pkt) {
+  uint16_t addr, len;
+
+  if (!get_range(pkt, &addr, &len)) {
+    reply(pkt, Status::ERR_INVALID);
+    return;
+  }
+
+  recv_blocks(pkt, addr, len, false, true);
+}
+
+void ProgrammerRemoteCore::handle_fill(Comm::Packet *pkt) {
+  uint16_t addr, len;
+
+  if (pkt->end < 5 || !get_range(pkt, &addr, &len)) {
+    reply(pkt, Status::ERR_INVALID);
+    return;
+  }
+
+  uint8_t *buf = alloc_block();
+
+  if (buf == nullptr) {
+    reply(pkt, Status::ERR_MEMORY);
+    return;
+  }
+
+  memset(buf, pkt->buffer[5], MIN(BLOCK_SIZE, len));
+
+  for (uint16_t done = 0; done < len; done += BLOCK_SIZE) {
+    ee.write(addr + done, buf, MIN(BLOCK_SIZE, len - done));
+  }
+
+  free(buf);
+
+  reply(pkt, Status::OK);
+}
+
+void ProgrammerRemoteCore::handle_checksum(Comm::Packet *pkt) {
+  uint16_t addr, len;
+
+  if (!get_range(pkt, &addr, &len)) {
+    reply(pkt, Status::ERR_INVALID);
+    return;
+  }
+
+  // Older software doesn't send the algorithm, and expects a CRC-16
+  const auto algo = (Crc::Algo) (pkt->end >= 5 ? pkt->buffer[5] : Crc::Algo::CRC16);
+
+  if (algo > Crc::Algo::FLETCHER16) {
+    reply(pkt, Status::ERR_INVALID);
+    return;
+  }
+
+  // Worked out as the bytes are read, so nothing needs to be buffered
+  Crc::Engine sum(algo);
+  ee.read(addr, addr + len - 1, nullptr, &sum);
+
+  const uint32_t result = sum.result();
+
+  for (uint8_t i = 0; i < sum.size(); ++i) {
+    pkt->buffer[2 + i] = (result >> (8 * i)) & 0xFF;
+  }
+
+  reply(pkt, Status::OK, sum.size());
+}
+
+void ProgrammerRemoteCore::handle_dump(Comm::Packet *pkt) {
+  uint16_t addr, len;
+
+  if (!get_range(pkt, &addr, &len)) {
+    reply(pkt, Status::ERR_INVALID);
+    return;
+  }
+
+  reply(pkt, Status::OK);
+
+  // Nothing but NAKs should come in meanwhile, and the parser resends the frames they ask for
+  Comm::Parser parser;
+  Comm::Packet scratch;
+
+  uint16_t crc_block = Crc::CRC16_INIT;
+  uint16_t crc_all   = Crc::CRC16_INIT;
+
+  for (uint16_t done = 0; done < len;) {
+    const uint8_t count = MIN(DUMP_CHUNK, len - done);
+
+    // Each packet goes into the TX ring whole, and is sent while the next one is read
+    pkt->buffer[0] = PKT_DUMPDT;
+
+    for (uint8_t i = 0; i < count; ++i) {
+      pkt->buffer[1 + i] = ee.read(addr + done + i);
+    }
+
+    pkt->end = count;
+    Comm::send(pkt);
+
+    crc_block = Crc::crc16(pkt->buffer + 1, count, crc_block);
+    crc_all   = Crc::crc16(pkt->buffer + 1, count, crc_all);
+    done += count;
+
+    if (done % DUMP_BLOCK == 0 || done == len) {
+      pkt->buffer[0] = PKT_DUMPCK;
+      pkt->buffer[1] = done & 0xFF;
+      pkt->buffer[2] = done >> 8;
+      pkt->buffer[3] = crc_block & 0xFF;
+      pkt->buffer[4] = crc_block >> 8;
+      pkt->end = 4;
+
+      Comm::send(pkt);
+
+      crc_block = Crc::CRC16_INIT;
+    }
+
+    parser.update(&scratch);
+  }
+
+  pkt->buffer[0] = PKT_EEDUMP;
+  pkt->buffer[2] = crc_all & 0xFF;
+  pkt->buffer[3] = crc_all >> 8;
+
+  reply(pkt, Status::OK, 2);
+}
+
+void ProgrammerRemoteCore::handle_hash(Comm::Packet *pkt) {
+  uint16_t addr, len;
+
+  if (!get_range(pkt, &addr, &len)) {
+    reply(pkt, Status::ERR_INVALID);
+    return;
+  }
+
+  const uint8_t num_pages = (len + HASH_PAGE - 1) / HASH_PAGE;
+
+  uint8_t *page;
+  uint32_t *hashes;
+
+  {
+    Memory::Scope scope(Memory::Tag::PROG);
+
+    page   = (uint8_t *) malloc(HASH_PAGE);
+    hashes = (uint32_t *) malloc(num_pages * sizeof(uint32_t));
+  }
+
+  if (page == nullptr || hashes == nullptr) {
+    free(page);
+    free(hashes);
+
+    reply(pkt, Status::ERR_MEMORY);
+    return;
+  }
+
+  for (uint8_t i = 0; i < num_pages; ++i) {
+    const uint16_t start = addr + i * HASH_PAGE;
+    const uint16_t count = MIN(HASH_PAGE, len - i * HASH_PAGE);
+
+    ee.read(start, start + count - 1, page);
+    hashes[i] = Crc::crc32(page, count);
+  }
+
+  free(page);
+
+  pkt->buffer[2] = HASH_PAGE & 0xFF;
+  pkt->buffer[3] = HASH_PAGE >> 8;
+  pkt->buffer[4] = num_pages;
+
+  reply(pkt, Status::OK, 3);
+
+  // Little-endian in memory, the same as on the wire
+  Comm::stream_send((const uint8_t *) hashes, num_pages * sizeof(uint32_t));
+
+  free(hashes);
+}
+
+bool ProgrammerRemoteCore::get_range(Comm::Packet *pkt, uint16_t *addr, uint16_t *len) {
+  if (pkt->end < 4) return false;
+
+  *addr = pkt->buffer[1] | (pkt->buffer[2] << 8);
+  *len  = pkt->buffer[3] | (pkt->buffer[4] << 8);
+
+  return *len > 0 && (uint32_t) *addr + *len <= EE_SIZE;
+}
+
+// Sends `[type, status, extra...]`, where the `num_extra` extra bytes are already in `pkt->buffer + 2`
+void ProgrammerRemoteCore::reply(Comm::Packet *pkt, Status status, uint8_t num_extra) {
+  pkt->buffer[1] = status;
+  pkt->end = 1 + num_extra;
+
+  Comm::send(pkt);
+}
+
+uint8_t *ProgrammerRemoteCore::alloc_block() {
+  Memory::Scope scope(Memory::Tag::PROG);
+  return (uint8_t *) malloc(BLOCK_SIZE);
+}
+
+void ProgrammerRemoteCore::recv_blocks(Comm::Packet *pkt, uint16_t addr, uint16_t len, bool write, bool verify) {
+  uint8_t *buf = alloc_block();
+
+  if (buf == nullptr) {
+    reply(pkt, Status::ERR_MEMORY);
+    return;
+  }
+
+  reply(pkt, Status::OK);
+
+  for (uint16_t done = 0; done < len; done += BLOCK_SIZE) {
+    const uint16_t count = MIN(BLOCK_SIZE, len - done);
+
+    if (Comm::stream_recv(buf, count) < count) {
+      reply(pkt, Status::ERR_COMM);
+      break;
+    }
+
+    if (write) {
+      ee.write(addr + done, buf, count);
+    }
+
+    uint16_t mismatches = 0;
+    uint16_t first = 0x0000;
+
+    if (verify) {
+      for (uint16_t i = 0; i < count; ++i) {
+        if (ee.read(addr + done + i) != buf[i] && mismatches++ == 0) {
+          first = addr + done + i;
+        }
+      }
+    }
+
+    pkt->buffer[2] = mismatches & 0xFF;
+    pkt->buffer[3] = mismatches >> 8;
+    pkt->buffer[4] = first & 0xFF;
+    pkt->buffer[5] = first >> 8;
+
+    reply(pkt, (mismatches == 0 ? Status::OK : Status::ERR_VERIFY), 4);
+  }
+
+  free(buf);
+}
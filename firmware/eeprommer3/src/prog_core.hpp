@@ -5,9 +5,12 @@
 #include "constants.hpp"
 
 #include "ad_array.hpp"
+#include "catalog.hpp"
+#include "comm.hpp"
 #include "eeprom.hpp"
 #include "file.hpp"
 #include "gui.hpp"
+#include "hex.hpp"
 #include "sd.hpp"
 #include "tft.hpp"
 #include "touch.hpp"
@@ -33,11 +36,17 @@ public:
     ERR_FILE,     // Unable to open file
     ERR_VERIFY,   // Verification failed (expectation != reality)
     ERR_MEMORY,   // Memory allocator returned null
+    ERR_COMM,     // Serial transfer was cut off
   };
 
   typedef Status (*Func)();
 
   static Status nop();
+
+protected:
+  // Steps through `xfer` with a progress bar until it is done, fails or the screen is touched.
+  // Returns true only if every block went through.
+  static bool run_transfer(FileTransfer *xfer);
 };
 
 /*************************************************/
@@ -54,10 +63,26 @@ class ProgrammerFileCore : public ProgrammerBaseCore {
   ADD_RWV_METHODS
 
 private:
-  static void read_operation_core(FileCtrl *file);
+  // Writes to `file` through `writer` if it is given, otherwise as a raw binary.
+  // Returns `ERR_FILE` if writing failed or was canceled, since the dump is then incomplete.
+  static Status read_operation_core(FileCtrl *file, HexWriter *writer = nullptr);
+
+  static Status write_from_file(FileCtrl *file, uint16_t addr);
+  static Status write_operation_core(FileCtrl *file, uint16_t addr);
+
+  // With the file's checksums from the SD catalog, only pages that differ are read from the file and written,
+  // and verifying doesn't read the file at all
+  static Status write_changed_pages(FileCtrl *file, uint16_t addr, const Catalog::Entry *sums);
+  static Status verify_checksums(FileCtrl *file, uint16_t addr, const Catalog::Entry *sums);
+
+  // Intel HEX and S-record files say where their data goes, so these take no address
+  static Status write_from_image(FileCtrl *file, HexReader::Format format);
+  static Status verify_image(FileCtrl *file, HexReader::Format format);
 
-  static bool write_from_file(FileCtrl *file, uint16_t addr);
-  static void write_operation_core(FileCtrl *file, uint16_t addr);
+  template<typename Func>
+  static Status for_each_image_run(FileCtrl *file, HexReader::Format format, Func action);
+
+  static constexpr uint16_t IMAGE_STEP = 0x0400;  // Bytes of an image file per step of the progress bar
 };
 
 // Manipulates one 6502 jump vector at a time (NMI, RESET, IRQ)
@@ -69,6 +94,10 @@ class ProgrammerVectorCore : public ProgrammerBaseCore {
 class ProgrammerMultiCore : public ProgrammerBaseCore {
   ADD_RWV_METHODS
 
+public:
+  // Shows a checksum of a range, worked out as it is read, so a chip can be identified without dumping it
+  static Status checksum();
+
 private:
   /******************************** READ RANGE HELPERS ********************************/
 
@@ -82,6 +111,37 @@ private:
   /******************************** WRITE RANGE HELPERS ********************************/
 
   static void write_operation_core(AddrDataArray *buf);
+
+  static constexpr uint16_t CHECKSUM_STEP = 0x0080;  // Bytes per step of the progress bar
+};
+
+/*
+ * Copies a master chip to any number of blanks. The master is read once into all 32K of XRAM, and then each blank
+ * is written and verified in 64-byte groups straight from there, so no SD card is needed. The heap normally lives
+ * in XRAM, so it is moved to a small array on the stack for the run and EEPROMMER3 restarts after.
+ */
+class ProgrammerDupCore : public ProgrammerBaseCore {
+public:
+  static Status duplicate();
+
+private:
+  // Waits for `Program' or `Done' without `Util::idle()`, since `Comm` keeps its buffers in the old heap.
+  // Returns true for `Program'.
+  static bool ask_next();
+
+  enum CopyResult : uint8_t {
+    COPIED,    // Every page matches the master
+    MISMATCH,  // A page didn't match after writing it
+    CANCELED,  // The screen was touched partway through
+  };
+
+  // Programs the inserted chip from `image`, reading each page back as soon as it is written.
+  // On a mismatch, `*bad_addr` is set to the first byte that didn't match.
+  static CopyResult copy(uint8_t *image, uint16_t *bad_addr);
+
+  static constexpr uint16_t EE_SIZE   = 0x8000;
+  static constexpr uint16_t STEP      = 0x0080;  // Bytes per step of the progress bar
+  static constexpr uint16_t HEAP_SIZE = 0x0100;  // Enough for button labels and other short strings
 };
 
 // Miscellaneous other functions
@@ -100,12 +160,15 @@ private:
     DISABLE_WRITE,        // Set !WE high (disable)
     ENABLE_WRITE,         // Set !WE low (enable)
     SET_ADDR_BUS_AND_OE,  // Set 16 bits: 15 = !OE, 14-0 = address
+    SHOW_MEMORY_STATS,    // Show heap and stack usage statistics
     READ_DATA_BUS,        // Read 8 bits from data bus
     WRITE_DATA_BUS,       // Write 8 bits to data bus
     SET_DATA_DIR,         // Set data bus as input or output
     MONITOR_DATA_BUS,     // Poll and show data bus at an interval
     PRINT_CHARSET,        // Print TFT driver's charset, 0x00-0xFF
     SHOW_COLORS,          // Show all colors supported by program
+    TEST_XRAM,            // Run full non-destructive test of external RAM
+    TUNE_XRAM,            // Pick and save fastest safe wait states for external RAM
     ACTION_AUX1,          // Customizable auxiliary action
     ACTION_AUX2,          // Customizable auxiliary action
   };
@@ -113,15 +176,78 @@ private:
   static void do_debug_action(DebugAction action);
 
   static void set_addr_and_oe();
+  static void show_memory_stats();
   static void read_data_bus();
   static void write_data_bus();
   static void set_data_dir();
   static void monitor_data_bus();
   static void print_charset_wait();
+  static void test_xram();
+  static void tune_xram();
   static void debug_action_aux1();
   static void debug_action_aux2();
 };
 
+/*
+ * Runs EEPROM operations that the computer requests over serial, without the GUI, so they can be
+ * scripted (see `software/src/cli.py`). Requests are handled by `Comm::poll()` whenever the firmware
+ * is waiting for user input. Addresses and lengths are 16-bit little-endian; the length must be
+ * nonzero and the range must fit in the EEPROM. Replies start with the request type and a `Status`.
+ *
+ * - `[PKT_EEINFO]`: replies `[version, size(2), block size(2), caps, baud(4)]`
+ * - `[PKT_EEREAD, addr(2), len(2)]`: replies, then streams the data, one `BLOCK_SIZE` stream at a time
+ * - `[PKT_EEWRIT, addr(2), len(2), flags]`: replies, then the computer streams the data one block at a
+ *   time, and the device replies `[mismatches(2), first mismatch(2)]` once each block is written (and
+ *   read back if `FLAG_VERIFY` is set)
+ * - `[PKT_EEVRFY, addr(2), len(2)]`: same as `PKT_EEWRIT` with `FLAG_VERIFY`, but without writing
+ * - `[PKT_EEFILL, addr(2), len(2), value]`: replies once the range is filled
+ * - `[PKT_EECSUM, addr(2), len(2), algo]`: replies with the checksum of the range, worked out by a `Crc::Engine` running
+ *   `algo` (a `Crc::Algo`, CRC-16 if it is left out): `[crc(2)]`, `[crc(4)]` or `[sums(2)]`
+ * - `[PKT_EEDUMP, addr(2), len(2)]`: replies, then sends the data as `[PKT_DUMPDT, data...]` packets of up to
+ *   `DUMP_CHUNK` bytes as fast as it is read, without waiting for acknowledgements. After every `DUMP_BLOCK`
+ *   bytes (and at the end), `[PKT_DUMPCK, offset(2), crc(2)]` has the `Crc::crc16()` of the data since the
+ *   last one, `offset` being the number of bytes sent so far. Finally replies again with `[crc(2)]` of it all.
+ * - `[PKT_EEHASH, addr(2), len(2)]`: replies `[page size(2), count]`, then streams the `Crc::crc32()` of each
+ *   `HASH_PAGE` bytes of the range (4 bytes each, the last page may be shorter), so the computer can find out
+ *   which pages differ from its file without transferring them
+ *
+ * A `[PKT_PING]` from the computer (without any capabilities) makes the device ping it, so that it
+ * can negotiate framing and baud rate before sending requests.
+ */
+class ProgrammerRemoteCore : public ProgrammerBaseCore {
+public:
+  // Registers the request handlers with `Comm`
+  static void init();
+
+  static constexpr uint8_t  VERSION    = 1;
+  static constexpr uint16_t EE_SIZE    = 0x8000;
+  static constexpr uint16_t BLOCK_SIZE = 0x0800;
+
+  static constexpr uint8_t  DUMP_CHUNK = 128;
+  static constexpr uint16_t DUMP_BLOCK = 0x0400;
+
+  static constexpr uint16_t HASH_PAGE  = 0x0100;
+
+  static constexpr uint8_t FLAG_VERIFY = 0x01;
+
+private:
+  static void handle_ping(Comm::Packet *pkt);
+  static void handle_info(Comm::Packet *pkt);
+  static void handle_read(Comm::Packet *pkt);
+  static void handle_write(Comm::Packet *pkt);
+  static void handle_verify(Comm::Packet *pkt);
+  static void handle_fill(Comm::Packet *pkt);
+  static void handle_checksum(Comm::Packet *pkt);
+  static void handle_dump(Comm::Packet *pkt);
+  static void handle_hash(Comm::Packet *pkt);
+
+  static bool get_range(Comm::Packet *pkt, uint16_t *addr, uint16_t *len);
+  static void reply(Comm::Packet *pkt, Status status, uint8_t num_extra = 0);
+
+  static uint8_t *alloc_block();
+  static void recv_blocks(Comm::Packet *pkt, uint16_t addr, uint16_t len, bool write, bool verify);
+};
+
 #undef ADD_RWV_METHODS
 
 #endif
@@ -1,10 +1,24 @@
 #include <Arduino.h>
 #include "constants.hpp"
 
+#include <SPI/src/SPI.h>
 #include <SD/src/SD.h>
 
+#include "memory.hpp"
+#include "util.hpp"
+
 #include "sd.hpp"
 
+// SD commands used by `SdReader` (the SD library keeps its own to itself)
+#define SD_CMD12 0x0C  // STOP_TRANSMISSION
+#define SD_CMD18 0x12  // READ_MULTIPLE_BLOCK
+
+#define SD_DATA_START 0xFE
+
+// Own view of the volume `SD` mounted, for finding files and their clusters
+static SdVolume volume;
+static bool volume_ok = false;
+
 SdCtrl::SdCtrl(uint8_t cs, int8_t en)
   : m_cs(cs), m_en(en) {
   // Empty
@@ -35,6 +49,8 @@ SdCtrl::Status SdCtrl::init() {
       return Status::FAILED;
     }
 
+    volume_ok = volume.init(SdVolume::sdCard());
+
     return Status::OK;
   }
 }
@@ -43,35 +59,600 @@ bool SdCtrl::is_enabled() {
   return m_enabled;
 }
 
-uint8_t SdCtrl::get_files(const char *dir, SdFileInfo *out, uint8_t num) {
-  File root = SD.open(dir);
-  File file;
+SdDirIndex *SdCtrl::get_index(const char *dir) {
+  return (m_index.load(dir) ? &m_index : nullptr);
+}
+
+void SdCtrl::invalidate_index() {
+  m_index.invalidate();
+}
 
-  uint8_t file_num = 0;
+bool SdCtrl::is_directory(const char *file) {
+  File f = SD.open(file);
+  bool is_dir = f.isDirectory();
+  f.close();
 
-  while ((file = root.openNextFile())) {
-    if (file_num >= num) break;
+  return is_dir;
+}
 
-    auto this_file = out + file_num;
+// Waits until the card stops holding MISO low
+static bool sd_wait_ready() {
+  const unsigned long t1 = millis();
 
-    strcpy(this_file->name, file.name());
-    this_file->is_dir = file.isDirectory();
+  while (SPI.transfer(0xFF) != 0xFF) {
+    if (millis() - t1 > SdReader::TIMEOUT_BUSY) return false;
+  }
 
-    ++file_num;
+  return true;
+}
 
-    file.close();
+// Sends a command and returns its R1 response (0x00 if all is well); the card must be selected
+static uint8_t sd_command(uint8_t cmd, uint32_t arg) {
+  // CMD12 interrupts a transfer, so the card is busy sending data by definition
+  if (cmd != SD_CMD12) sd_wait_ready();
+
+  SPI.transfer(0x40 | cmd);
+
+  for (int8_t shift = 24; shift >= 0; shift -= 8) {
+    SPI.transfer(arg >> shift);
+  }
+
+  SPI.transfer(0xFF);  // CRC, only checked for commands that aren't used here
+
+  if (cmd == SD_CMD12) {
+    SPI.transfer(0xFF);  // Stuff byte
   }
 
-  root.rewindDirectory();
-  root.close();
+  uint8_t r1 = 0xFF;
+
+  for (uint8_t i = 0; i < 0xFF && ((r1 = SPI.transfer(0xFF)) & 0x80); ++i) {
+    /* wait for response */;
+  }
 
-  return file_num;
+  return r1;
 }
 
-bool SdCtrl::is_directory(const char *file) {
-  File f = SD.open(file);
-  bool is_dir = f.isDirectory();
-  f.close();
+// Opens the directory at the first `len` characters of `path` (absolute, 8.3 names) into `dir`
+static bool sd_open_dir(const char *path, uint8_t len, SdFile *dir) {
+  if (!volume_ok || !dir->openRoot(&volume)) return false;
 
-  return is_dir;
+  const char *end = path + len;
+
+  while (true) {
+    while (path < end && *path == '/') ++path;
+
+    if (path == end) return true;
+
+    const char *slash = (const char *) memchr(path, '/', end - path);
+    const char *part_end = (slash == nullptr ? end : slash);
+
+    char name[13];
+    const uint8_t part_len = part_end - path;
+
+    if (part_len >= sizeof(name)) {
+      dir->close();
+      return false;
+    }
+
+    memcpy(name, path, part_len);
+    name[part_len] = '\0';
+
+    SdFile sub;
+
+    const bool found = sub.open(dir, name, O_READ);
+    dir->close();
+
+    if (!found) return false;
+
+    if (!sub.isDir()) {
+      sub.close();
+      return false;
+    }
+
+    *dir = sub;
+    path = part_end;
+  }
+}
+
+// Opens the directory holding `path` into `dir`, and copies the last part of `path` into `name`
+static bool sd_open_parent(const char *path, SdFile *dir, char *name) {
+  const char *slash = strrchr(path, '/');
+  const char *base  = (slash == nullptr ? path : slash + 1);
+
+  const uint8_t len = strlen(base);
+  if (len == 0 || len > 12) return false;
+
+  strcpy(name, base);
+
+  return sd_open_dir(path, base - path, dir);
+}
+
+// Directories first, then by name
+static int compare_file_info(const void *a, const void *b) {
+  const auto *info_a = (const SdFileInfo *) a;
+  const auto *info_b = (const SdFileInfo *) b;
+
+  if (info_a->is_dir() != info_b->is_dir()) return (info_a->is_dir() ? -1 : 1);
+
+  return strcmp(info_a->name, info_b->name);
+}
+
+SdDirIndex::~SdDirIndex() {
+  free(m_entries);
+}
+
+bool SdDirIndex::load(const char *dir) {
+  if (m_dir[0] != '\0' && strcmp(m_dir, dir) == 0) return true;
+
+  invalidate();
+
+  SdFile file;
+  if (!sd_open_dir(dir, strlen(dir), &file)) return false;
+
+  dir_t entry;
+
+  // `readDir()` skips deleted entries, long name parts and the volume label
+  while (file.readDir(&entry) > 0) {
+    if (m_count == m_capacity && !grow()) break;
+
+    SdFileInfo *info = &m_entries[m_count];
+    SdFile::dirName(entry, info->name);
+
+    // Bookkeeping, not something to pick
+    if (strcmp(info->name, Strings::M_CATALOG) == 0) continue;
+
+    ++m_count;
+
+    info->attributes    = entry.attributes;
+    info->size          = entry.fileSize;
+    info->first_cluster = ((uint32_t) entry.firstClusterHigh << 16) | entry.firstClusterLow;
+    info->write_date    = entry.lastWriteDate;
+    info->write_time    = entry.lastWriteTime;
+  }
+
+  file.close();
+
+  qsort(m_entries, m_count, sizeof(SdFileInfo), compare_file_info);
+
+  // Paths too long to remember are read every time
+  if (strlen(dir) < PATH_LEN) strcpy(m_dir, dir);
+
+  return true;
+}
+
+void SdDirIndex::invalidate() {
+  m_count = 0;
+  m_dir[0] = '\0';
+}
+
+uint16_t SdDirIndex::size() {
+  return m_count;
+}
+
+const SdFileInfo *SdDirIndex::get(uint16_t i) {
+  return (i < m_count ? &m_entries[i] : nullptr);
+}
+
+bool SdDirIndex::grow() {
+  Memory::Scope scope(Memory::Tag::FILES);
+
+  auto *entries = (SdFileInfo *) realloc(m_entries, (m_capacity + GROW_BY) * sizeof(SdFileInfo));
+  if (entries == nullptr) return false;
+
+  m_entries = entries;
+  m_capacity += GROW_BY;
+
+  return true;
+}
+
+SdReader::~SdReader() {
+  close();
+}
+
+bool SdReader::open(const char *path) {
+  close();
+
+  if (volume.fatType() != 16 && volume.fatType() != 32) return false;
+
+  SdFile dir, file;
+  char name[13];
+
+  if (!sd_open_parent(path, &dir, name)) return false;
+
+  const bool found = file.open(&dir, name, O_READ);
+  dir.close();
+
+  if (!found) return false;
+
+  const bool is_file = !file.isDir();
+
+  m_size = file.fileSize();
+  m_first_cluster = file.firstCluster();
+
+  file.close();
+
+  if (!is_file) return false;
+
+  {
+    Memory::Scope scope(Memory::Tag::FILES);
+
+    m_buf = (uint8_t *) malloc(BUF_BLOCKS * BLOCK_SIZE);
+    m_fat = (uint8_t *) malloc(BLOCK_SIZE);
+  }
+
+  if (m_buf == nullptr || m_fat == nullptr) {
+    close();
+    return false;
+  }
+
+  m_pos = 0;
+  m_buf_len = 0;
+  m_ext_len = 0;
+  m_fat_valid = false;
+
+  return true;
+}
+
+void SdReader::close() {
+  free(m_buf);
+  free(m_fat);
+
+  m_buf = nullptr;
+  m_fat = nullptr;
+}
+
+bool SdReader::is_open() {
+  return m_buf != nullptr;
+}
+
+uint32_t SdReader::size() {
+  return m_size;
+}
+
+uint32_t SdReader::position() {
+  return m_pos;
+}
+
+bool SdReader::seek(uint32_t position) {
+  if (position > m_size) return false;
+
+  m_pos = position;
+  return true;
+}
+
+uint16_t SdReader::read(uint8_t *buf, uint16_t len) {
+  if (!is_open()) return 0;
+
+  len = MIN(len, m_size - m_pos);
+
+  uint16_t done = 0;
+
+  while (done < len) {
+    // Anything already in the read-ahead buffer
+    if (m_pos >= m_buf_pos && m_pos < m_buf_pos + m_buf_len) {
+      const uint16_t count = MIN(len - done, m_buf_pos + m_buf_len - m_pos);
+
+      memcpy(buf + done, m_buf + (m_pos - m_buf_pos), count);
+
+      m_pos += count;
+      done  += count;
+      continue;
+    }
+
+    if (!find_extent()) break;
+
+    const uint16_t offset = m_pos % BLOCK_SIZE;
+    const uint32_t block  = m_ext_block + (m_pos - m_ext_pos) / BLOCK_SIZE;
+
+    // Blocks left in the extent, counting the one `m_pos` is in
+    const uint32_t ext_blocks = (m_ext_pos + m_ext_len - (m_pos - offset)) / BLOCK_SIZE;
+
+    if (offset == 0 && len - done >= BUF_BLOCKS * BLOCK_SIZE) {
+      // Big reads go straight to the caller, in whole blocks; smaller ones are better off read ahead
+      const uint16_t count = MIN((len - done) / BLOCK_SIZE, ext_blocks);
+
+      if (!read_blocks(block, count, buf + done)) break;
+
+      m_pos += count * BLOCK_SIZE;
+      done  += count * BLOCK_SIZE;
+      continue;
+    }
+
+    if (!read_ahead()) break;
+  }
+
+  return done;
+}
+
+const uint8_t *SdReader::acquire(uint16_t max, uint16_t *len) {
+  *len = 0;
+
+  if (!is_open()) return nullptr;
+
+  max = MIN(max, m_size - m_pos);
+  if (max == 0) return nullptr;
+
+  if (m_pos < m_buf_pos || m_pos >= m_buf_pos + m_buf_len) {
+    if (!find_extent() || !read_ahead()) return nullptr;
+  }
+
+  *len = MIN(max, m_buf_pos + m_buf_len - m_pos);
+
+  return m_buf + (m_pos - m_buf_pos);
+}
+
+void SdReader::commit(uint16_t n) {
+  m_pos += n;
+}
+
+// Fills the read-ahead buffer with the blocks from the one holding `m_pos`, in the current extent
+bool SdReader::read_ahead() {
+  const uint16_t offset = m_pos % BLOCK_SIZE;
+  const uint32_t block  = m_ext_block + (m_pos - m_ext_pos) / BLOCK_SIZE;
+
+  // Blocks left in the extent, counting the one `m_pos` is in
+  const uint32_t ext_blocks = (m_ext_pos + m_ext_len - (m_pos - offset)) / BLOCK_SIZE;
+  const uint16_t count = MIN(BUF_BLOCKS, ext_blocks);
+
+  if (!read_blocks(block, count, m_buf)) {
+    m_buf_len = 0;
+    return false;
+  }
+
+  m_buf_pos = m_pos - offset;
+  m_buf_len = count * BLOCK_SIZE;
+
+  return true;
+}
+
+// Makes the current extent the one holding `m_pos`, following the cluster chain as needed
+bool SdReader::find_extent() {
+  const uint32_t cluster_size = (uint32_t) volume.blocksPerCluster() * BLOCK_SIZE;
+
+  if (m_ext_len == 0 || m_pos < m_ext_pos) {
+    // Start over from the first cluster
+    m_ext_pos  = 0;
+    m_ext_len  = 0;
+    m_ext_next = m_first_cluster;
+  }
+
+  while (m_pos >= m_ext_pos + m_ext_len) {
+    if (m_ext_next < 2) return false;  // End of the chain (or an empty file)
+
+    const uint32_t first = m_ext_next;
+    uint32_t last = first;
+    uint32_t next;
+
+    // Prefetch: take in every following cluster that is right after the one before it
+    while (true) {
+      if (!fat_next(last, &next)) return false;
+      if (next != last + 1) break;
+
+      last = next;
+    }
+
+    m_ext_pos  += m_ext_len;
+    m_ext_len   = (last - first + 1) * cluster_size;
+    m_ext_block = volume.dataStartBlock() + (first - 2) * volume.blocksPerCluster();
+    m_ext_next  = next;
+  }
+
+  return true;
+}
+
+// Looks up the cluster after `cluster`, or 0 if it is the last one
+bool SdReader::fat_next(uint32_t cluster, uint32_t *next) {
+  const bool fat32 = (volume.fatType() == 32);
+
+  const uint32_t block = volume.fatStartBlock() + (fat32 ? cluster >> 7 : cluster >> 8);
+
+  if (!m_fat_valid || m_fat_block != block) {
+    m_fat_valid = SdVolume::sdCard()->readBlock(block, m_fat);
+    m_fat_block = block;
+
+    if (!m_fat_valid) return false;
+  }
+
+  if (fat32) {
+    memcpy(next, m_fat + ((cluster & 0x7F) << 2), 4);
+    *next &= 0x0FFFFFFF;
+
+    if (*next >= 0x0FFFFFF8) *next = 0;
+  }
+  else {
+    uint16_t entry;
+    memcpy(&entry, m_fat + ((cluster & 0xFF) << 1), 2);
+
+    *next = (entry >= 0xFFF8 ? 0 : entry);
+  }
+
+  return true;
+}
+
+// Reads `count` consecutive blocks starting at card block `block` with a single CMD18
+bool SdReader::read_blocks(uint32_t block, uint16_t count, uint8_t *dst) {
+  Sd2Card *card = SdVolume::sdCard();
+
+  // Standard capacity cards are addressed in bytes, SDHC in blocks
+  const uint32_t arg = (card->type() == SD_CARD_TYPE_SDHC ? block : block << 9);
+
+  SPI.beginTransaction(SPISettings(SPI_CLOCK, MSBFIRST, SPI_MODE0));
+  digitalWrite(SD_CS, LOW);
+
+  bool ok = (sd_command(SD_CMD18, arg) == 0x00);
+
+  for (uint16_t i = 0; ok && i < count; ++i) {
+    const unsigned long t1 = millis();
+    uint8_t token;
+
+    while ((token = SPI.transfer(0xFF)) == 0xFF) {
+      if (millis() - t1 > TIMEOUT_TOKEN) break;
+    }
+
+    if (token != SD_DATA_START) {
+      ok = false;
+      break;
+    }
+
+    uint8_t *out = dst + i * BLOCK_SIZE;
+
+    for (uint16_t j = 0; j < BLOCK_SIZE; ++j) {
+      out[j] = SPI.transfer(0xFF);
+    }
+
+    // CRC isn't checked
+    SPI.transfer(0xFF);
+    SPI.transfer(0xFF);
+  }
+
+  sd_command(SD_CMD12, 0);
+  sd_wait_ready();
+
+  digitalWrite(SD_CS, HIGH);
+  SPI.transfer(0xFF);  // Lets the card release MISO
+  SPI.endTransaction();
+
+  return ok;
+}
+
+SdWriter::~SdWriter() {
+  close();
+}
+
+bool SdWriter::open(const char *path, uint32_t size) {
+  close();
+
+  if (size == 0) return false;
+
+  SdFile dir;
+
+  if (!sd_open_parent(path, &dir, m_name)) return false;
+
+  // The library only creates contiguous files that don't exist yet
+  SdFile::remove(&dir, m_name);
+
+  const bool created = m_file.createContiguous(&dir, m_name, size);
+  dir.close();
+
+  if (!created) return false;
+
+  uint32_t last_block;
+
+  if (m_file.contiguousRange(&m_first_block, &last_block)) {
+    Memory::Scope scope(Memory::Tag::FILES);
+    m_block = (uint8_t *) malloc(BLOCK_SIZE);
+  }
+
+  if (m_block == nullptr) {
+    m_file.remove();
+    return false;
+  }
+
+  m_size = size;
+  m_written = 0;
+  m_block_len = 0;
+  m_started = false;
+  m_failed = false;
+
+  return true;
+}
+
+void SdWriter::close() {
+  if (!is_open()) return;
+
+  // The last block is padded out; the file's size cuts it off again
+  if (m_block_len > 0) {
+    memset(m_block + m_block_len, 0x00, BLOCK_SIZE - m_block_len);
+
+    if (write_block(m_block)) {
+      m_written -= BLOCK_SIZE - m_block_len;
+    }
+  }
+
+  if (m_started) {
+    SdVolume::sdCard()->writeStop();
+  }
+
+  // Only now is the directory entry touched again, and only if less was written than was set aside
+  if (m_written < m_size) {
+    m_file.truncate(m_written);
+  }
+
+  m_file.close();
+
+  free(m_block);
+  m_block = nullptr;
+}
+
+bool SdWriter::is_open() {
+  return m_block != nullptr;
+}
+
+const char *SdWriter::name() {
+  return m_name;
+}
+
+uint32_t SdWriter::position() {
+  return m_written + m_block_len;
+}
+
+uint16_t SdWriter::write(const uint8_t *buf, uint16_t len) {
+  if (!is_open() || m_failed) return 0;
+
+  len = MIN(len, m_size - position());
+
+  uint16_t done = 0;
+
+  while (done < len) {
+    // Whole blocks go straight from the caller's buffer
+    if (m_block_len == 0 && len - done >= BLOCK_SIZE) {
+      if (!write_block(buf + done)) break;
+
+      done += BLOCK_SIZE;
+      continue;
+    }
+
+    const uint16_t count = MIN(len - done, BLOCK_SIZE - m_block_len);
+
+    memcpy(m_block + m_block_len, buf + done, count);
+
+    m_block_len += count;
+    done += count;
+
+    if (m_block_len == BLOCK_SIZE) {
+      if (!write_block(m_block)) {
+        // Whatever was held back from earlier writes is lost too, but `position()` says so
+        m_block_len = 0;
+        done -= count;
+        break;
+      }
+
+      m_block_len = 0;
+    }
+  }
+
+  return done;
+}
+
+// Writes the next block of the file, starting the multi-block write if this is the first one
+bool SdWriter::write_block(const uint8_t *src) {
+  Sd2Card *card = SdVolume::sdCard();
+
+  if (!m_started) {
+    // Lets the card erase the whole file's worth of blocks in one go
+    const uint32_t blocks = (m_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    m_started = card->writeStart(m_first_block, blocks);
+    m_failed  = !m_started;
+  }
+
+  if (!m_failed && !card->writeData(src)) {
+    m_failed  = true;
+    m_started = false;  // The library deselects the card when a write fails
+  }
+
+  if (m_failed) return false;
+
+  m_written += BLOCK_SIZE;
+  return true;
 }
@@ -8,11 +8,55 @@
 #include <SD/src/SD.h>
 
 /*
- * Simple little helper struct to store name of file and whether it is a directory.
+ * Simple little helper struct to store what a directory listing needs to know about a file.
  */
 struct SdFileInfo {
   char name[13];
-  bool is_dir;
+  uint8_t attributes;  // FAT attribute bits, `DIR_ATT_xxx`
+  uint32_t size;
+  uint32_t first_cluster;
+  uint16_t write_date;  // FAT format
+  uint16_t write_time;
+
+  inline bool is_dir() const {
+    return attributes & DIR_ATT_DIRECTORY;
+  }
+};
+
+/*
+ * List of the files in a directory, kept in XRAM so it can be shown again without going back to the card.
+ *
+ * It is read straight from the directory's raw 32-byte entries, without opening any of the files, and sorted
+ * with directories first, then by name. It grows as needed, so it holds as many files as the heap has room for.
+ */
+class SdDirIndex {
+public:
+  SdDirIndex() {};
+  ~SdDirIndex();
+
+  // Makes the index list `dir` (absolute, 8.3 names), reading it only if it doesn't already
+  bool load(const char *dir);
+
+  // Forgets what was read, so that the next `load()` reads the card again
+  void invalidate();
+
+  uint16_t size();
+
+  // Entry `i` in sorted order; only valid until the index is read again
+  const SdFileInfo *get(uint16_t i);
+
+  static constexpr uint8_t GROW_BY  = 32;  // Entries added to the index's buffer at a time
+  static constexpr uint8_t PATH_LEN = 32;  // Longest directory path that is remembered
+
+private:
+  bool grow();
+
+  SdFileInfo *m_entries = nullptr;
+
+  uint16_t m_count    = 0;
+  uint16_t m_capacity = 0;
+
+  char m_dir[PATH_LEN] = {'\0'};  // Directory listed, empty if none
 };
 
 class SdCtrl {
@@ -29,8 +73,11 @@ public:
   Status init();
   bool is_enabled();
 
-  // Get names of at most `num` files from `dir` into `out`; return number of file names gotten
-  uint8_t get_files(const char *dir, SdFileInfo *out, uint8_t num);
+  // Gets the index of `dir`, reading the card only if it hasn't been yet; returns nullptr if `dir` can't be read
+  SdDirIndex *get_index(const char *dir);
+
+  // Must be called when something on the card changes, so that the index is read again
+  void invalidate_index();
 
   // Check if `file` is a directory
   bool is_directory(const char *file);
@@ -40,6 +87,123 @@ private:
   int8_t m_en;
 
   bool m_enabled;
+
+  SdDirIndex m_index;
+};
+
+/*
+ * Reads a file on the SD card without going through the SD library's one-block cache.
+ *
+ * The file's cluster chain is looked up ahead in extents of consecutive clusters, and each extent is
+ * read with multi-block reads (CMD18) at full SPI speed. Reads of at least `BUF_BLOCKS` whole blocks go
+ * straight into the caller's buffer (e.g. in XRAM), anything else goes through a read-ahead buffer that size.
+ *
+ * Only FAT16 and FAT32 are supported, and the file must not be written meanwhile.
+ */
+class SdReader {
+public:
+  SdReader() {};
+  ~SdReader();
+
+  // Opens the file at `path` (absolute, 8.3 names); returns false if it can't be read this way
+  bool open(const char *path);
+  void close();
+
+  bool is_open();
+
+  uint32_t size();
+  uint32_t position();
+
+  bool seek(uint32_t position);
+
+  // Reads up to `len` bytes into `buf`; returns how many were read
+  uint16_t read(uint8_t *buf, uint16_t len);
+
+  // Lends out up to `max` bytes from the read-ahead buffer, reading ahead first if needed, and puts how many into
+  // `*len`. They stay there until the next call that reads; `commit()` moves past the first `n` of them.
+  const uint8_t *acquire(uint16_t max, uint16_t *len);
+  void commit(uint16_t n);
+
+  static constexpr uint16_t BLOCK_SIZE = 512;
+  static constexpr uint8_t  BUF_BLOCKS = 8;
+
+  static constexpr uint32_t SPI_CLOCK = F_CPU / 2;  // Fastest the ATmega can do
+
+  static constexpr uint16_t TIMEOUT_TOKEN = 300;  // For a data block to start, in milliseconds
+  static constexpr uint16_t TIMEOUT_BUSY  = 300;  // For the card to be ready for a command
+
+private:
+  bool find_extent();
+  bool read_ahead();
+  bool fat_next(uint32_t cluster, uint32_t *next);
+  bool read_blocks(uint32_t block, uint16_t count, uint8_t *dst);
+
+  uint8_t *m_buf = nullptr;  // Read-ahead buffer
+  uint8_t *m_fat = nullptr;  // Last block of the FAT that was read
+
+  uint32_t m_fat_block = 0;
+  bool m_fat_valid = false;
+
+  uint32_t m_size = 0;
+  uint32_t m_pos  = 0;
+  uint32_t m_first_cluster = 0;
+
+  uint32_t m_buf_pos = 0;  // File position of `m_buf`
+  uint16_t m_buf_len = 0;
+
+  // Current extent: `m_ext_len` bytes at file position `m_ext_pos`, starting at card block `m_ext_block`
+  uint32_t m_ext_pos   = 0;
+  uint32_t m_ext_len   = 0;
+  uint32_t m_ext_block = 0;
+  uint32_t m_ext_next  = 0;  // Cluster after the extent, 0 at the end of the chain
+};
+
+/*
+ * Writes a new file of known size on the SD card, replacing any file already at that path.
+ *
+ * All of the file's clusters are allocated up front as one contiguous extent, so the FAT and the
+ * directory entry are written once when the file is opened. The data then goes out as a single
+ * multi-block write (CMD25), which the card is told the length of so it can pre-erase. If less than
+ * `size` bytes were written by `close()`, the file is cut down to what was.
+ *
+ * Nothing else may use the SD card between the first write and `close()`.
+ */
+class SdWriter {
+public:
+  SdWriter() {};
+  ~SdWriter();
+
+  // Creates the file at `path` (absolute, 8.3 names) with room for `size` bytes; returns false if there isn't any
+  bool open(const char *path, uint32_t size);
+  void close();
+
+  bool is_open();
+
+  const char *name();
+
+  uint32_t position();
+
+  // Writes up to `len` bytes from `buf`, but not past the size the file was opened with; returns how many were written
+  uint16_t write(const uint8_t *buf, uint16_t len);
+
+  static constexpr uint16_t BLOCK_SIZE = 512;
+
+private:
+  bool write_block(const uint8_t *src);
+
+  SdFile m_file;
+  char m_name[13];
+
+  uint8_t *m_block = nullptr;  // Part of a block not written yet
+  uint16_t m_block_len = 0;
+
+  uint32_t m_first_block = 0;
+
+  uint32_t m_size    = 0;
+  uint32_t m_written = 0;  // Bytes that have been sent to the card
+
+  bool m_started = false;  // Whether the multi-block write is under way
+  bool m_failed  = false;
 };
 
 #endif
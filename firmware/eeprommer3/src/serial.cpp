@@ -0,0 +1,282 @@
+#include <Arduino.h>
+#include "constants.hpp"
+
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "memory.hpp"
+
+#include "serial.hpp"
+
+static uint8_t rx_boot_buf[SerialCtrl::RX_BUF_SIZE_BOOT];
+
+// Ring of received bytes; `rx_head` is only written by the RX interrupt and `rx_tail` only by readers
+static volatile uint8_t *rx_buf = rx_boot_buf;
+static uint16_t rx_mask = SerialCtrl::RX_BUF_SIZE_BOOT - 1;
+
+static volatile uint16_t rx_head = 0;
+static volatile uint16_t rx_tail = 0;
+
+static uint16_t rx_high_water = 0;
+static volatile uint16_t rx_overruns = 0;
+
+static uint8_t tx_buf[SerialCtrl::TX_BUF_SIZE];
+
+static_assert(SerialCtrl::TX_BUF_SIZE <= 256, "TX ring indices are 8-bit");
+
+static volatile uint8_t tx_head = 0;
+static volatile uint8_t tx_tail = 0;
+
+static bool tx_written = false;  // Nothing to wait for in `flush()` until something has been written
+
+#ifdef SER_RTS
+static volatile uint8_t *rts_port;
+static uint8_t rts_mask;
+
+static uint16_t rts_margin = MIN(SerialCtrl::RTS_MARGIN, SerialCtrl::RX_BUF_SIZE_BOOT / 4);
+
+static inline void set_rts(bool stop) {
+  if (stop) *rts_port |= rts_mask;
+  else      *rts_port &= ~rts_mask;
+}
+#endif
+
+ISR(USART0_RX_vect) {
+  if (UCSR0A & _BV(DOR0)) ++rx_overruns;
+
+  const uint8_t val = UDR0;
+  const uint16_t next = (rx_head + 1) & rx_mask;
+
+  if (next == rx_tail) {
+    ++rx_overruns;
+    return;
+  }
+
+  rx_buf[rx_head] = val;
+  rx_head = next;
+
+#ifdef SER_RTS
+  if (((rx_tail - next - 1) & rx_mask) <= rts_margin) set_rts(true);
+#endif
+}
+
+// Sends the next byte of the TX ring; called when UDR0 is empty
+static void tx_udre() {
+  UDR0 = tx_buf[tx_tail];
+  tx_tail = (tx_tail + 1) % SerialCtrl::TX_BUF_SIZE;
+
+  // Clear TXC0 (by writing 1 to it) so `flush()` can tell when this byte is done
+  UCSR0A = (UCSR0A & _BV(U2X0)) | _BV(TXC0);
+
+  if (tx_head == tx_tail) {
+    UCSR0B &= ~_BV(UDRIE0);
+  }
+}
+
+ISR(USART0_UDRE_vect) {
+  tx_udre();
+}
+
+// Number of bytes waiting in the RX ring
+static uint16_t rx_used() {
+  uint16_t head;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    head = rx_head;
+  }
+
+  return (head - rx_tail) & rx_mask;
+}
+
+// Marks `count` bytes of the RX ring as read
+static void rx_consume(uint16_t count) {
+  const uint16_t used = rx_used();
+
+  // The ring only fills between reads, so its fullest point is just before one
+  rx_high_water = MAX(rx_high_water, used);
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    rx_tail = (rx_tail + count) & rx_mask;
+  }
+
+#ifdef SER_RTS
+  if (rx_mask - (used - count) > 2 * rts_margin) set_rts(false);
+#endif
+}
+
+void SerialCtrl::begin(uint32_t baud) {
+  flush();
+
+  // Double speed mode; it has finer steps at high rates
+  UCSR0A = _BV(U2X0);
+  UBRR0  = (F_CPU / 4 / baud - 1) / 2;
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);  // 8N1
+  UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+
+#ifdef SER_RTS
+  pinMode(SER_RTS, OUTPUT);
+
+  rts_port = portOutputRegister(digitalPinToPort(SER_RTS));
+  rts_mask = digitalPinToBitMask(SER_RTS);
+
+  set_rts(false);
+#endif
+}
+
+bool SerialCtrl::set_rx_buffer(uint16_t size) {
+  if (size == 0 || (size & (size - 1)) != 0) return false;
+
+  uint8_t *buf;
+
+  {
+    Memory::Scope scope(Memory::Tag::COMM);
+    buf = (uint8_t *) malloc(size);
+  }
+
+  if (buf == nullptr) return false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // The new ring is at least as large, so nothing waiting gets lost
+    uint16_t count = 0;
+
+    for (uint16_t i = rx_tail; i != rx_head; i = (i + 1) & rx_mask) {
+      buf[count++] = rx_buf[i];
+    }
+
+    if (rx_buf != rx_boot_buf) {
+      free((void *) rx_buf);
+    }
+
+    rx_buf  = buf;
+    rx_mask = size - 1;
+    rx_tail = 0;
+    rx_head = count;
+
+#ifdef SER_RTS
+    rts_margin = MIN(RTS_MARGIN, size / 4);
+#endif
+  }
+
+  return true;
+}
+
+void SerialCtrl::release_rx_buffer() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (rx_buf == rx_boot_buf) return;
+
+    // Keeps the oldest bytes, the rest are lost as if the ring had been full
+    uint16_t count = 0;
+
+    for (uint16_t i = rx_tail; i != rx_head; i = (i + 1) & rx_mask) {
+      if (count < RX_BUF_SIZE_BOOT - 1) {
+        rx_boot_buf[count++] = rx_buf[i];
+      }
+      else {
+        ++rx_overruns;
+      }
+    }
+
+    free((void *) rx_buf);
+
+    rx_buf  = rx_boot_buf;
+    rx_mask = RX_BUF_SIZE_BOOT - 1;
+    rx_tail = 0;
+    rx_head = count;
+
+#ifdef SER_RTS
+    rts_margin = MIN(RTS_MARGIN, RX_BUF_SIZE_BOOT / 4);
+#endif
+  }
+}
+
+int SerialCtrl::available() {
+  return rx_used();
+}
+
+int SerialCtrl::peek() {
+  if (rx_used() == 0) return -1;
+
+  return rx_buf[rx_tail];
+}
+
+int SerialCtrl::read() {
+  if (rx_used() == 0) return -1;
+
+  const uint8_t val = rx_buf[rx_tail];
+  rx_consume(1);
+
+  return val;
+}
+
+uint16_t SerialCtrl::read(uint8_t *buf, uint16_t len) {
+  const uint16_t count = MIN(len, rx_used());
+
+  // At most two pieces: up to the end of the ring, then from its start
+  const uint16_t first = MIN(count, rx_mask + 1 - rx_tail);
+
+  memcpy(buf, (const uint8_t *) rx_buf + rx_tail, first);
+  memcpy(buf + first, (const uint8_t *) rx_buf, count - first);
+
+  rx_consume(count);
+
+  return count;
+}
+
+size_t SerialCtrl::write(uint8_t val) {
+  tx_written = true;
+
+  // Skip the ring if the USART is idle anyway
+  if (tx_head == tx_tail && (UCSR0A & _BV(UDRE0))) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      UDR0 = val;
+      UCSR0A = (UCSR0A & _BV(U2X0)) | _BV(TXC0);
+    }
+
+    return 1;
+  }
+
+  const uint8_t next = (tx_head + 1) % TX_BUF_SIZE;
+
+  while (next == tx_tail) {
+    // With interrupts off (e.g. logging from an ISR), the ring has to be emptied by hand
+    if (bit_is_clear(SREG, SREG_I) && (UCSR0A & _BV(UDRE0))) {
+      tx_udre();
+    }
+  }
+
+  tx_buf[tx_head] = val;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    tx_head = next;
+    UCSR0B |= _BV(UDRIE0);
+  }
+
+  return 1;
+}
+
+size_t SerialCtrl::write(const uint8_t *buf, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    write(buf[i]);
+  }
+
+  return size;
+}
+
+void SerialCtrl::flush() {
+  if (!tx_written) return;
+
+  while ((UCSR0B & _BV(UDRIE0)) || !(UCSR0A & _BV(TXC0))) {
+    if (bit_is_clear(SREG, SREG_I) && (UCSR0B & _BV(UDRIE0)) && (UCSR0A & _BV(UDRE0))) {
+      tx_udre();
+    }
+  }
+}
+
+void SerialCtrl::get_stats(Stats *out) {
+  out->size       = rx_mask + 1;
+  out->high_water = MAX(rx_high_water, rx_used());
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    out->overruns = rx_overruns;
+  }
+}
@@ -0,0 +1,56 @@
+#ifndef SERIAL_HPP
+#define SERIAL_HPP
+
+#include <Arduino.h>
+#include "constants.hpp"
+
+/*
+ * Driver for USART0 (the USB serial port), used instead of Arduino's `HardwareSerial`.
+ *
+ * Received bytes are put into a ring buffer by the RX interrupt. It starts out as a small one in internal RAM,
+ * and is moved to a large one in XRAM by `set_rx_buffer()` once XMEM is running, so the computer can keep sending
+ * while the firmware is busy (e.g. writing to the EEPROM). If `SER_RTS` is defined, that pin is raised while the
+ * ring is nearly full, for USB adapters with a CTS input.
+ */
+class SerialCtrl : public Stream {
+public:
+  // Sets up USART0 for 8N1 at `baud`, keeping anything already received
+  void begin(uint32_t baud);
+
+  // Moves the RX ring to a newly allocated buffer of `size` bytes (a power of 2), keeping its contents
+  bool set_rx_buffer(uint16_t size);
+
+  // Moves the RX ring back to the internal one and frees the XRAM buffer, dropping whatever doesn't fit
+  void release_rx_buffer();
+
+  int available() override;
+  int peek() override;
+  int read() override;
+
+  // Copies up to `len` received bytes into `buf` without waiting; returns how many were copied
+  uint16_t read(uint8_t *buf, uint16_t len);
+
+  size_t write(uint8_t val) override;
+  size_t write(const uint8_t *buf, size_t size) override;
+  using Print::write;
+
+  // Waits until everything written has been sent
+  void flush() override;
+
+  struct Stats {
+    uint16_t size;        // Size of the RX ring
+    uint16_t high_water;  // Most bytes ever waiting in it
+    uint16_t overruns;    // Bytes lost because the ring or the USART was full
+  };
+
+  void get_stats(Stats *out);
+
+  static constexpr uint16_t RX_BUF_SIZE      = 4096;  // In XRAM, see `set_rx_buffer()`
+  static constexpr uint8_t  RX_BUF_SIZE_BOOT =   64;  // In internal RAM, until then
+  static constexpr uint16_t TX_BUF_SIZE      =  256;  // Most of a packet, so `Comm::send()` returns while it goes out
+
+  // `SER_RTS` is raised when this many bytes are left free, and lowered again at twice that
+  static constexpr uint16_t RTS_MARGIN = 64;
+};
+
+#endif
@@ -16,7 +16,7 @@
 void TftCtrl::init(uint16_t driver_id, uint8_t orientation) {
   reset();
 
-  delay(500);
+  delay(T_TFT_RESET);
 
   begin(driver_id);
   setRotation(orientation);
@@ -51,6 +51,107 @@ void TftCtrl::drawTextBg_P(uint16_t x, uint16_t y, const char *text, uint16_t co
   drawText_P(x, y, text, color, size);
 }
 
+ImageReader::~ImageReader() {
+  free(m_palette);
+}
+
+bool ImageReader::open(const char *path) {
+  if (!m_file.open(path)) return false;
+
+  uint8_t header[HEADER_SIZE];
+  if (m_file.read(header, HEADER_SIZE) < HEADER_SIZE) return false;
+
+  if (header[0] != 'E' || header[1] != '3' || header[2] != 'I' || header[3] != VERSION) return false;
+
+  m_width  = header[4] | (header[5] << 8);
+  m_height = header[6] | (header[7] << 8);
+
+  m_palette = (uint16_t *) malloc(256 * 2);
+  if (m_palette == nullptr) return false;
+
+  memset(m_palette, 0x00, 256 * 2);
+
+  // Stored little-endian, as the TFT's 565 colors are in memory
+  const uint16_t palette_len = (header[8] + 1) * 2;
+  return m_file.read((uint8_t *) m_palette, palette_len) == palette_len;
+}
+
+uint16_t ImageReader::width() {
+  return m_width;
+}
+
+uint16_t ImageReader::height() {
+  return m_height;
+}
+
+uint16_t ImageReader::read(uint16_t *buf, uint16_t max) {
+  uint16_t done = 0;
+
+  while (done < max) {
+    if (m_count == 0 && !next_token()) break;
+
+    if (m_run) {
+      const uint16_t count = MIN(m_count, max - done);
+
+      for (uint16_t i = 0; i < count; ++i) buf[done++] = m_color;
+
+      m_count -= count;
+    }
+    else {
+      if (m_in_pos == m_in_len && !next_in()) break;
+
+      // As many indices as there are in this piece of the file
+      const uint16_t count = MIN(MIN(m_count, max - done), m_in_len - m_in_pos);
+
+      for (uint16_t i = 0; i < count; ++i) buf[done++] = m_palette[m_in[m_in_pos++]];
+
+      m_count -= count;
+    }
+  }
+
+  return done;
+}
+
+// Gives back the last piece of the file and borrows the next one
+bool ImageReader::next_in() {
+  m_file.commit(m_in_len);
+
+  m_in     = m_file.acquire(UINT16_MAX, &m_in_len);
+  m_in_pos = 0;
+
+  return m_in_len > 0;
+}
+
+bool ImageReader::next_byte(uint8_t *val) {
+  if (m_in_pos == m_in_len && !next_in()) return false;
+
+  *val = m_in[m_in_pos++];
+  return true;
+}
+
+// Tokens are:
+// - 0x00-0x7F: literal, the next `tag + 1` bytes are palette indices
+// - 0x80-0xFF: run, `(tag & 0x7F) << 8 | next` + 1 pixels of the palette index after that
+bool ImageReader::next_token() {
+  uint8_t tag;
+  if (!next_byte(&tag)) return false;
+
+  m_run = (tag & 0x80);
+
+  if (!m_run) {
+    m_count = tag + 1;
+    return true;
+  }
+
+  uint8_t low, index;
+  if (!next_byte(&low) || !next_byte(&index)) return false;
+
+  m_count = (((uint16_t) (tag & 0x7F) << 8) | low) + 1;
+  m_color = m_palette[index];
+
+  return true;
+}
+
 extern TftCtrl tft;
 extern TouchCtrl tch;
 
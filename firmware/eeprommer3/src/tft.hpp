@@ -7,6 +7,7 @@
 #include <MCUFRIEND_kbv/MCUFRIEND_kbv.h>
 #include <SD/src/SD.h>
 
+#include "sd.hpp"
 #include "touch.hpp"
 
 // Removes color constants from MCUFRIEND_kbv library
@@ -64,6 +65,51 @@ namespace TftColor {
   };
 };
 
+/*
+ * Decodes an E3I image (see `software/src/e3i.py`) from the SD card as it is read.
+ *
+ * An image is a palette of up to 256 colors, stored in the TFT's byte order, and runs and literals of palette
+ * indices. Indices are looked up as they are decoded, so the pixels come out ready for `pushColors()`, and the
+ * data is used where `SdReader` reads it ahead. `startup.e3i` is about 1/16 the size of the raw pixels.
+ */
+class ImageReader {
+public:
+  ImageReader() {};
+  ~ImageReader();
+
+  // Opens the image at `path` and reads its palette; returns false if it isn't a valid image
+  bool open(const char *path);
+
+  uint16_t width();
+  uint16_t height();
+
+  // Decodes up to `max` more pixels into `buf`; returns how many, fewer only if the file ended early
+  uint16_t read(uint16_t *buf, uint16_t max);
+
+  static constexpr uint8_t HEADER_SIZE = 9;
+  static constexpr uint8_t VERSION     = 1;
+
+private:
+  bool next_in();
+  bool next_byte(uint8_t *val);
+  bool next_token();
+
+  SdReader m_file;
+
+  uint16_t *m_palette = nullptr;  // Always 256 colors, unused ones are black
+
+  const uint8_t *m_in = nullptr;  // Lent by `m_file`
+  uint16_t m_in_pos = 0;
+  uint16_t m_in_len = 0;
+
+  uint16_t m_width  = 0;
+  uint16_t m_height = 0;
+
+  uint16_t m_count = 0;  // Pixels left in the current token
+  bool m_run = false;
+  uint16_t m_color;      // Of the current run
+};
+
 /*
  * `TftCtrl` is the main class to interface with the TFT; it is a wrapper
  * around the 3rd-party class `MCUFRIEND_kbv` - prenticedavid/MCUFRIEND_kbv (GitHub).
@@ -85,46 +131,50 @@ public:
   using drawText_t   = decltype(&TftCtrl::drawText);
   using drawTextBg_t = decltype(&TftCtrl::drawTextBg);
 
+  // Draws the E3I image `file` from the SD card (see `ImageReader`), a band of rows at a time,
+  // stopping early once `check_skip()` returns true. Returns false if the image couldn't be read.
   template<typename Func>
-  bool drawRGBBitmapFromFile(uint16_t x, uint16_t y, const char *file, uint16_t width, uint16_t height, bool swap_endian, Func check_skip) {
-    constexpr const uint8_t CHUNK_HEIGHT = 32;
-    const uint16_t CHUNK_SIZE = CHUNK_HEIGHT * 2 * width;
+  bool drawImageFromFile(uint16_t x, uint16_t y, const char *file, Func check_skip) {
+    constexpr const uint8_t  BAND_HEIGHT = 16;
+    constexpr const uint16_t BUF_PIXELS  = 160;
 
-    const uint16_t y0 = y; // Save original value
-    const uint16_t x1 = x + width - 1;
+    ImageReader img;
+    if (!img.open(file)) return false;
 
-    auto *buf = (uint16_t *) malloc(CHUNK_SIZE);
+    auto *buf = (uint16_t *) malloc(BUF_PIXELS * 2);
     if (buf == nullptr) return false;
 
-    File f = SD.open(file);
-    if (!f) return false;
+    const uint16_t y0 = y;  // Save original value
+    const uint16_t x1 = x + img.width() - 1;
 
     bool success = true;
 
-    for (/* no init clause */; y < (y0 + height); y += CHUNK_HEIGHT) {
-      int16_t res = f.read((uint8_t *) buf, CHUNK_SIZE);
+    for (/* no init clause */; y < (y0 + img.height()) && success; y += BAND_HEIGHT) {
+      const uint16_t dy = min(BAND_HEIGHT, y0 + img.height() - y);
 
-      if (res < 0) {
-        success = false;
-        memset(buf, 0xF8, CHUNK_SIZE); // Display magenta chunk to signify read failure
-      }
+      // Each band starts a new window, since checking the touchscreen borrows the TFT's pins
+      setAddrWindow(x, y, x1, y + dy - 1);
+
+      uint32_t left = (uint32_t) img.width() * dy;
+      bool first = true;
+
+      while (left > 0) {
+        const uint16_t count = img.read(buf, min(left, (uint32_t) BUF_PIXELS));
 
-      if (swap_endian) {
-        for (uint16_t i = 0; i < (CHUNK_SIZE / 2); ++i) {
-          buf[i] = __builtin_bswap16(buf[i]);
+        if (count == 0) {
+          success = false;
+          break;
         }
-      }
 
-      const uint16_t dy = min(CHUNK_HEIGHT, y0 + height - y);
-      const uint16_t y1 = y + dy - 1;
+        pushColors(buf, count, first);
 
-      setAddrWindow(x, y, x1, y1);
-      pushColors(buf, width * dy, true);
+        first = false;
+        left -= count;
+      }
 
       if (check_skip()) break;
     }
 
-    f.close();
     free(buf);
     return success;
   }
@@ -3,17 +3,14 @@
 
 #include <avr/io.h>
 
+#include "comm.hpp"
 #include "strfmt.hpp"
+#include "xram.hpp"
+
 #include "util.hpp"
 
 #undef swap
 
-// NOLINTBEGIN: avr linker symbols
-extern int __bss_start, __bss_end;
-extern int __heap_start, __heap_end;
-extern int *__brkval;
-// NOLINTEND
-
 namespace Util {
 
 char *strdup_P(const char *pstr) {
@@ -26,19 +23,25 @@ char *strdup_P(const char *pstr) {
 void hexdump(uint8_t *buf, uint16_t len) {
   SER_LOG_PRINT("Hexdump of 0x%0X:\n", buf);
 
-  for (uint16_t i = 0; i < len; ++i) {
-    if ((i % 16) == 0) {
-      SER_LOG_PRINT("");
-    }
+  uint16_t i = 0;
 
-    PRINTF_P_NOBUF(&Serial, PSTR("%02X "), buf[i]);
+  // A whole row at a time, to keep the log small
+  for (/* no init clause */; i + 16 <= len; i += 16) {
+    const uint8_t *row = buf + i;
+
+    SER_LOG_PRINT(
+      "%02X %02X %02X %02X %02X %02X %02X %02X  %02X %02X %02X %02X %02X %02X %02X %02X\n",
+      row[0], row[1], row[2],  row[3],  row[4],  row[5],  row[6],  row[7],
+      row[8], row[9], row[10], row[11], row[12], row[13], row[14], row[15]
+    );
+  }
 
+  for (/* no init clause */; i < len; ++i) {
     if (((i + 1) % 8) == 0) {
-      Serial.print(" ");
+      SER_LOG_PRINT("%02X  ", buf[i]);
     }
-
-    if (((i + 1) % 16) == 0) {
-      Serial.println();
+    else {
+      SER_LOG_PRINT("%02X ", buf[i]);
     }
   }
 
@@ -60,46 +63,9 @@ void restart() {
   asm volatile ("jmp 0");
 }
 
-};
-
-void Memory::calculate_bords() {
-  // Internal
-  bords[0] = RAMSTART;
-  bords[1] = (uint16_t) &__bss_start;
-  bords[2] = (uint16_t) &__bss_end;
-  bords[3] = SP;
-  bords[4] = RAMEND;
-
-  // External
-  bords[5] = (uint16_t) &__heap_start;
-  bords[6] = (uint16_t) __brkval;
-  bords[7] = (uint16_t) &__heap_end;
-  bords[8] = 0xFFFF;
-
-  // __brkval may be zero if heap is empty
-  if (bords[6] == 0) bords[6] = bords[5];
+void idle() {
+  Comm::poll();
+  xram::test_step();
 }
 
-void Memory::print_ram_analysis() {
-  calculate_bords();
-
-#ifdef LOGGING
-  SER_LOG_PRINT("RAM Analysis:\n");
-
-  for (uint8_t i = 0; i <= NUM_TYPES; ++i) {
-    SER_LOG_PRINT("+----------------------+ < 0x%04X\n", bords[i]);
-
-    if (i >= NUM_TYPES) break;
-
-    const char *name = Util::strdup_P(NAMES[i]);
-    uint16_t size = bords[i + 1] - bords[i];
-    uint8_t percentage = 100 * ((float) size / (float) bords[8]);
-
-    SER_LOG_PRINT("| %-6s %5db (%3d%%) |\n", name, size, percentage);
-
-    free((void *) name);
-  }
-
-  SER_LOG_PRINT("\n");
-#endif
-}
+};
@@ -20,7 +20,7 @@ namespace Util {
   // Caller is responsible for freeing.
   char *strdup_P(const char *pstr);
 
-  // Prints `len` bytes of `buf` using `SER_LOG_PRINT`
+  // Logs `len` bytes of `buf` using `SER_LOG_PRINT`
   void hexdump(uint8_t *buf, uint16_t len);
 
   // `exit_condition` is a template type
@@ -44,28 +44,9 @@ namespace Util {
 
   // Calls assembler instruction to restart program
   void restart();
-};
-
-struct Memory {
-  static void calculate_bords();
-  static void print_ram_analysis();
-
-  static constexpr uint8_t NUM_TYPES = 8;
-
-  static inline const char NAME_0[] PROGMEM = "Data";
-  static inline const char NAME_1[] PROGMEM = "BSS";
-  static inline const char NAME_2[] PROGMEM = "Free";
-  static inline const char NAME_3[] PROGMEM = "Stack";
-  static inline const char NAME_4[] PROGMEM = "Unused";
-  static inline const char NAME_5[] PROGMEM = "Heap";
-  static inline const char NAME_6[] PROGMEM = "Free";
-  static inline const char NAME_7[] PROGMEM = "8k Buf";
-
-  static inline const char *NAMES[NUM_TYPES] {
-    NAME_0, NAME_1, NAME_2, NAME_3, NAME_4, NAME_5, NAME_6, NAME_7,
-  };
 
-  static inline uint16_t bords[NUM_TYPES + 1];
+  // Services background work (such as packets sent by the computer) while waiting for user input
+  void idle();
 };
 
 /*
@@ -109,6 +90,10 @@ namespace Strings {
   ADD_STRING(T, EL_WARN,   "Warning");
   ADD_STRING(T, EL_ERR,    "Error");
   ADD_STRING(T, DEBUGS,    "Debug Tools Menu");
+  ADD_STRING(T, MEM_STAT,  "Memory Statistics");
+  ADD_STRING(T, BAD_IMG,   "Invalid Image File");
+  ADD_STRING(T, DUP,       "Duplicate Chip");
+  ADD_STRING(T, CHECKSUM,  "Checksum");
 
   ADD_STRING(E, CANCELED,  "Operation was canceled.");
   ADD_STRING(E, TOO_BIG,   "File would be too large\nto fit into EEPROM there!\nAborted.");
@@ -116,6 +101,10 @@ namespace Strings {
   ADD_STRING(E, INV_FSYS,  "The selected filesystem: `%d'\ndoes not exist.");
   ADD_STRING(E, NO_DB_MON, "Data bus monitor is not\nsupported because DEBUG_MODE\nis disabled.");
   ADD_STRING(E, MISMATCH,  "Mismatch between %04X and %04X!");
+  ADD_STRING(E, IMG_SYNT,  "Line %u is not a valid\nrecord. Stopped there.");
+  ADD_STRING(E, IMG_CSUM,  "Line %u has the wrong\nchecksum. Stopped there.");
+  ADD_STRING(E, IMG_RNGE,  "Line %u has data past\naddress FFFF.\nStopped there.");
+  ADD_STRING(E, DUP,       "The master is copied into\nall of XRAM, so EEPROMMER3\nrestarts once you are done.");
 
   ADD_STRING(P, ACTION,    "EEPROMMER3: Main Menu");
   ADD_STRING(P, ADDR_GEN,  "Type an address:");
@@ -128,11 +117,15 @@ namespace Strings {
   ADD_STRING(P, ADDR_END,  "Type the end address:");
   ADD_STRING(P, FILE_TYPE, "Select the file type:");
   ADD_STRING(P, OFILE,     "Which file to read to?");
+  ADD_STRING(P, OFORMAT,   "Which file format?");
+  ADD_STRING(P, FILL,      "Value of unused bytes?");
   ADD_STRING(P, IFILE,     "Which file to write from?");
   ADD_STRING(P, VIEW_METH, "Select viewing method:");
   ADD_STRING(P, STORE,     "Where to store data?");
   ADD_STRING(P, VERIFY,    "Verify data?");
   ADD_STRING(P, DATA_DIR,  "Which direction?");
+  ADD_STRING(P, DUP_MSTR,  "Is the master inserted?");
+  ADD_STRING(P, CHECKSUM,  "Which checksum?");
 
   ADD_STRING(W, OFILE,     "Reading EEPROM to file...");
   ADD_STRING(W, IFILE,     "Writing file to EEPROM...");
@@ -141,11 +134,20 @@ namespace Strings {
   ADD_STRING(W, WAIT,      "Please wait...");
   ADD_STRING(W, LOAD,      "Loading...");
   ADD_STRING(W, VERIFY,    "Vrf. `%s' @ %04X~");
+  ADD_STRING(W, VRF_IMG,   "Vrf. `%s'~");
   ADD_STRING(W, SOFTWARE,  "See software...");
+  ADD_STRING(W, XRAM_TST,  "Testing XRAM...");
+  ADD_STRING(W, XRAM_TUNE, "Tuning XRAM...");
+  ADD_STRING(W, DUP_READ,  "Reading master...");
+  ADD_STRING(W, DUP_WRITE, "Programming copy...");
+  ADD_STRING(W, RESTART,   "Restarting...");
 
   ADD_STRING(F, READ,      "Done reading!");
   ADD_STRING(F, WRITE,     "Done writing!");
   ADD_STRING(F, VERIFY,    "Done verifying!");
+  ADD_STRING(F, XRAM_TST,  "%u/32768 bytes OK (%lums)");
+  ADD_STRING(F, XRAM_TUNE, "Using %u wait states.");
+  ADD_STRING(F, UNCHANGED, "%u of %u pages unchanged.");
 
   ADD_STRING(L, PROJ_NAME, "eeprommer3");
   ADD_STRING(L, SD_GOOD,   "SD init success!");
@@ -182,16 +184,38 @@ namespace Strings {
   ADD_STRING(L, SOFTWARE,  "Please follow the\ninstructions on your\ncomputer.");
   ADD_STRING(L, FILE_SD,   "SD Card File");
   ADD_STRING(L, FILE_SER,  "Serial File");
+  ADD_STRING(L, FILE_RAM,  "RAM Disk (8K)");
+  ADD_STRING(L, FMT_RAW,   "Raw Binary");
+  ADD_STRING(L, FMT_IHEX,  "Intel HEX");
+  ADD_STRING(L, FMT_SREC,  "Motorola S-record");
+  ADD_STRING(L, CRC16,     "CRC-16");
+  ADD_STRING(L, CRC32,     "CRC-32");
+  ADD_STRING(L, FLETCHER,  "Fletcher-16");
   ADD_STRING(L, NO_FILES,  "Hmm, no files here...");
   ADD_STRING(L, X_CLOSE,   "x");
   ADD_STRING(L, INDIC_MAJ, "A");
   ADD_STRING(L, INDIC_MIN, "a");
   ADD_STRING(L, EMPTY_STR, "");
+  ADD_STRING(L, MEM_HEAP1, "Heap:  %5u used  %5u peak");
+  ADD_STRING(L, MEM_HEAP2, "       %5u top   %5u fails");
+  ADD_STRING(L, MEM_HEAP3, "       %5u free  %5u max %3u%%");
+  ADD_STRING(L, MEM_STACK, "Stack: %5u used  %5u peak /%u");
+  ADD_STRING(L, MEM_SERRX, "Ser RX:%5u lost  %5u peak /%u");
+  ADD_STRING(L, MEM_TAG,   "%-6s %5u allocs %7lu bytes");
+  ADD_STRING(L, XRAM_WAIT, "%u wait states: %s");
+  ADD_STRING(L, DUP_CRC,   "Master CRC-32: %08lX");
+  ADD_STRING(L, DUP_PASS,  "Passed: %u");
+  ADD_STRING(L, DUP_FAIL,  "Failed: %u");
+  ADD_STRING(L, DUP_NEXT,  "Insert a blank chip.");
+  ADD_STRING(L, PROGRAM,   "Program");
+  ADD_STRING(L, DONE,      "Done");
 
   ADD_STRING(G, W_BYTE,    "Wrote data %02X\nto address %04X.");
   ADD_STRING(G, W_VECTOR,  "Wrote value %04X\nto vector %s\nat %04X-%04X.");
   ADD_STRING(G, VERIFY_8,  "Expected: %02X\nActual:   %02X");
   ADD_STRING(G, VERIFY_16, "Expected: %04X\nActual:   %04X");
+  ADD_STRING(G, CSUM_16,   "%s of\n%04X-%04X:\n%04X");
+  ADD_STRING(G, CSUM_32,   "%s of\n%04X-%04X:\n%08lX");
   ADD_STRING(G, REPR_8,    "bin: " BYTE_FMT "\noct: %03o\nhex: %02X\ndec: %-3u\nchr: `%c'");
   ADD_STRING(G, REPR_16,   "bin: " BYTE_FMT "\n.... " BYTE_FMT "\noct: %06o\nhex: %04X\ndec: %-5u");
 
@@ -205,6 +229,8 @@ namespace Strings {
   ADD_STRING(A, W_MULTI,   "Write Multiple");
   ADD_STRING(A, DRAW_TEST, "Draw Test");
   ADD_STRING(A, DEBUGS,    "Debug Tools");
+  ADD_STRING(A, DUP,       "Duplicate Chip");
+  ADD_STRING(A, CHECKSUM,  "Checksum Range");
   ADD_STRING(A, INFO,      "i");
   ADD_STRING(A, X_CLOSE,   "x");
 
@@ -218,6 +244,8 @@ namespace Strings {
   ADD_STRING(H, W_MULTI,   "Write multiple bytes to EEPROM.");
   ADD_STRING(H, DRAW_TEST, "");
   ADD_STRING(H, DEBUGS,    "");
+  ADD_STRING(H, DUP,       "Copy a master chip to blanks.");
+  ADD_STRING(H, CHECKSUM,  "Identify a chip by its checksum.");
   ADD_STRING(H, INFO,      "Show info/about/credits menu.");
   ADD_STRING(H, X_CLOSE,   "Restart EEPROMMER3.");
 
@@ -226,16 +254,20 @@ namespace Strings {
   ADD_STRING(S, CODE_2,    "Unable to open file.");
   ADD_STRING(S, CODE_3,    "Verification failed.\nMismatch between written\nand read data.");
   ADD_STRING(S, CODE_4,    "Memory allocation failed.\nThere is not enough RAM\nfor the operation.");
+  ADD_STRING(S, CODE_5,    "Serial transfer failed.\nThe computer stopped\nresponding.");
 
   ADD_STRING(D, WE_HI,     "WE Hi (Disable)");
   ADD_STRING(D, WE_LO,     "WE Lo (Enable)");
   ADD_STRING(D, SET_ADDR,  "Set Address/OE");
+  ADD_STRING(D, MEM_STAT,  "Memory Stats");
   ADD_STRING(D, RD_DATA,   "Read Data Bus");
   ADD_STRING(D, WR_DATA,   "Write Data Bus");
   ADD_STRING(D, SET_DDIR,  "Set Data Dir");
   ADD_STRING(D, MON_DATA,  "Monitor Data");
   ADD_STRING(D, P_CHARSET, "Print Charset");
   ADD_STRING(D, SHOW_COL,  "Show Colors");
+  ADD_STRING(D, XRAM_TST,  "Test XRAM");
+  ADD_STRING(D, XRAM_TUNE, "Tune XRAM");
   ADD_STRING(D, AUX1,      "Aux1");
   ADD_STRING(D, AUX2,      "Aux2");
 
@@ -247,6 +279,7 @@ namespace Strings {
   ADD_STRING(I, LINE_5,    "Made by beaver700nh (GitHub) 2021-2023");
 
   inline const char *const M_FILE_DIR = "/ERMR3/";
+  inline const char *const M_CATALOG  = "CATALOG.E3C";  // In `M_FILE_DIR`, see `Catalog`
 
 #undef ADD_STRING
 }
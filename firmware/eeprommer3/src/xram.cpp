@@ -1,10 +1,17 @@
 #include <Arduino.h>
 #include "constants.hpp"
 
+#include <avr/eeprom.h>
+#include <util/atomic.h>
+
 #include "xram.hpp"
 
 static bool initialized = false;
 
+static uint16_t test_offset = 0;
+static unsigned long test_time_us = 0;
+static xram::TestResults results {0, 0, false};
+
 void xram::init(uint8_t waits, uint8_t portc_mask) {
   // Enable SRAM
   XMCRA |= (1 << SRE);
@@ -28,29 +35,243 @@ volatile uint8_t *xram::access(uint16_t addr) {
   return initialized ? reinterpret_cast<volatile uint8_t *>(addr) : nullptr;
 }
 
-xram::TestResults xram::test() {
-  auto buf = access(0x8000);
-  TestResults res {0, millis()};
+uint8_t xram::get_waits() {
+  return (XMCRA >> SRW10) & 0x03;
+}
+
+/*
+ * March C- over `len` bytes at `buf`, with data background `bg`:
+ *   up(w0); up(r0,w1); up(r1,w0); down(r0,w1); down(r1,w0); up(r0)
+ * Here "0" is `bg` and "1" is `~bg`. Calls `on_fail(i)` for every mismatching read of `buf[i]`.
+ */
+template<typename Func>
+static void march_c(volatile uint8_t *buf, uint16_t len, uint8_t bg, Func on_fail) {
+  const uint8_t zero = bg;
+  const uint8_t one  = ~bg;
+
+  for (uint16_t i = 0; i < len; ++i) {
+    buf[i] = zero;
+  }
+
+  for (uint16_t i = 0; i < len; ++i) {
+    if (buf[i] != zero) on_fail(i);
+    buf[i] = one;
+  }
+
+  for (uint16_t i = 0; i < len; ++i) {
+    if (buf[i] != one) on_fail(i);
+    buf[i] = zero;
+  }
 
-  constexpr const auto seed_pin = A14;
+  for (uint16_t i = len; i > 0; --i) {
+    if (buf[i - 1] != zero) on_fail(i - 1);
+    buf[i - 1] = one;
+  }
+
+  for (uint16_t i = len; i > 0; --i) {
+    if (buf[i - 1] != one) on_fail(i - 1);
+    buf[i - 1] = zero;
+  }
+
+  for (uint16_t i = 0; i < len; ++i) {
+    if (buf[i] != zero) on_fail(i);
+  }
+}
 
-  pinMode(seed_pin, INPUT);
-  auto seed = analogRead(seed_pin);
+// Solid background catches stuck-at and coupling faults, checkerboard catches shorted data lines
+static constexpr uint8_t MARCH_BGS[] = {0x00, 0x55};
 
-  srand(seed);
+uint16_t xram::march_test(uint16_t addr, uint16_t len) {
+  auto buf = access(addr);
+  if (buf == nullptr) return len;
 
-  for (uint16_t i = 0x0000; i < 0x8000; ++i) {
-    buf[i] = (rand() & 0xFF);
+  uint16_t errors = 0;
+
+  for (uint8_t bg : MARCH_BGS) {
+    march_c(buf, len, bg, [&errors](uint16_t i) { UNUSED_VAR(i); ++errors; });
   }
 
-  srand(seed);
+  return errors;
+}
+
+xram::TuneResults xram::tune(uint16_t addr, uint16_t len) {
+  TuneResults res {MAX_WAITS, 0x00};
+
+  const uint8_t prev_waits = get_waits();
+  const uint8_t portc_mask = XMCRB & 0x07;
+
+  for (uint8_t waits = 0; waits <= MAX_WAITS; ++waits) {
+    uint16_t errors = 0;
+
+    // Nothing else may touch XMEM while it might be running too fast
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      init(waits, portc_mask);
+      errors = march_test(addr, len);
+      init(prev_waits, portc_mask);
+    }
+
+    SER_LOG_PRINT("XRAM with %u wait states: %u errors.\n", waits, errors);
+
+    if (errors == 0) res.passed |= (1 << waits);
+  }
 
-  for (uint16_t i = 0x0000; i < 0x8000; ++i) {
-    if (buf[i] == (rand() & 0xFF)) {
-      ++(res.successes);
+  for (uint8_t waits = 0; waits <= MAX_WAITS; ++waits) {
+    if (res.passed & (1 << waits)) {
+      // Being the first to pass, any setting but 0 comes right after one that failed
+      res.waits = (waits == 0 ? 0 : MIN(waits + TUNE_MARGIN, MAX_WAITS));
+      break;
     }
   }
 
-  res.time = millis() - res.time;
+  init(res.waits, portc_mask);
+
   return res;
 }
+
+// Top nibble marks the byte as valid, since erased EEPROM reads 0xFF
+static constexpr uint8_t WAITS_MAGIC = 0xA0;
+
+bool xram::load_waits(uint8_t *waits) {
+  const uint8_t val = eeprom_read_byte((const uint8_t *) IEE_XRAM_WAITS);
+
+  if ((val & 0xF0) != WAITS_MAGIC) return false;
+
+  *waits = val & 0x03;
+  return true;
+}
+
+void xram::save_waits(uint8_t waits) {
+  eeprom_update_byte((uint8_t *) IEE_XRAM_WAITS, WAITS_MAGIC | (waits & 0x03));
+}
+
+bool xram::quick_test() {
+  auto buf = access(0x8000);
+  if (buf == nullptr) return false;
+
+  constexpr uint8_t NUM_LINES = 15;  // A0-A14
+  constexpr uint8_t PATTERN   = 0x55;
+  constexpr uint8_t ANTI      = 0xAA;
+
+  bool ok = true;
+
+  uint8_t saved[NUM_LINES + 1];
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    saved[0] = buf[0];
+
+    // Data lines
+    for (uint8_t bit = 0; bit < 8; ++bit) {
+      const uint8_t one = (1 << bit);
+
+      buf[0] = one;
+      if (buf[0] != one) ok = false;
+
+      buf[0] = ~one;
+      if (buf[0] != (uint8_t) ~one) ok = false;
+    }
+
+    // Address lines: each line gets its own byte, then make sure writing one doesn't disturb the others
+    for (uint8_t line = 0; line < NUM_LINES; ++line) {
+      saved[line + 1] = buf[1U << line];
+      buf[1U << line] = PATTERN;
+    }
+
+    buf[0] = PATTERN;
+
+    for (uint8_t line = 0; line < NUM_LINES; ++line) {
+      buf[1U << line] = ANTI;
+
+      if (buf[0] != PATTERN) ok = false;
+
+      for (uint8_t other = 0; other < NUM_LINES; ++other) {
+        if (other != line && buf[1U << other] != PATTERN) ok = false;
+      }
+
+      buf[1U << line] = PATTERN;
+    }
+
+    for (uint8_t line = 0; line < NUM_LINES; ++line) {
+      buf[1U << line] = saved[line + 1];
+    }
+
+    buf[0] = saved[0];
+  }
+
+  return ok;
+}
+
+// Runs March C- over `len` bytes at `buf`, restoring them afterwards. Returns number of good bytes.
+static uint8_t test_chunk(volatile uint8_t *buf, uint8_t len) {
+  static_assert(xram::TEST_CHUNK <= BIT_WIDTH(uint16_t), "Bad bytes must fit in the mask");
+
+  uint8_t saved[xram::TEST_CHUNK];
+  uint16_t bad = 0x0000;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (uint8_t i = 0; i < len; ++i) {
+      saved[i] = buf[i];
+    }
+
+    for (uint8_t bg : MARCH_BGS) {
+      march_c(buf, len, bg, [&bad](uint16_t i) { bad |= (1U << i); });
+    }
+
+    for (uint8_t i = 0; i < len; ++i) {
+      buf[i] = saved[i];
+    }
+  }
+
+  uint8_t good = len;
+
+  for (; bad != 0x0000; bad &= bad - 1) {
+    --good;
+  }
+
+  return good;
+}
+
+void xram::test_reset() {
+  test_offset  = 0;
+  test_time_us = 0;
+  results      = {0, 0, false};
+}
+
+bool xram::test_step() {
+  if (results.done) return true;
+
+  auto buf = access(0x8000 + test_offset);
+
+  if (buf == nullptr) {
+    results.done = true;  // Nothing to test
+    return true;
+  }
+
+  const unsigned long t1 = micros();
+
+  results.successes += test_chunk(buf, TEST_CHUNK);
+  test_offset += TEST_CHUNK;
+
+  test_time_us += micros() - t1;
+  results.time = test_time_us / 1000;
+
+  if (test_offset >= 0x8000) {
+    results.done = true;
+    SER_LOG_PRINT("XRAM test done, verified %u/32768 bytes in %lums.\n", results.successes, results.time);
+  }
+
+  return results.done;
+}
+
+const xram::TestResults &xram::test_results() {
+  return results;
+}
+
+xram::TestResults xram::test() {
+  test_reset();
+
+  while (!test_step()) {
+    /* keep testing */;
+  }
+
+  return results;
+}
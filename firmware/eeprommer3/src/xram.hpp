@@ -20,13 +20,65 @@ namespace xram {
   // Returns pointer to address in RAM (XMEM is 0x8000-0xFFFF)
   volatile uint8_t *access(uint16_t addr);
 
-  // Tests to see if XMEM is working
-  // WARNING: Overwrites contents of XMEM!
+  // Slowest setting of SRW11:SRW10 (wait for 2 cycles during read/write, then 1 cycle before new address)
+  constexpr uint8_t MAX_WAITS = 0x03;
+
+  // Wait states `tune()` adds to the fastest passing setting when the next faster one failed
+  constexpr uint8_t TUNE_MARGIN = 1;
+
+  // Returns the current setting of SRW11:SRW10
+  uint8_t get_waits();
+
+  // Runs a March C- test over `len` bytes at `addr`. This destroys their contents!
+  // Returns the number of reads that did not match.
+  uint16_t march_test(uint16_t addr, uint16_t len);
+
+  struct TuneResults {
+    uint8_t waits;   // Chosen setting of SRW11:SRW10
+    uint8_t passed;  // Bit n is set if setting n passed
+  };
+
+  /*
+   * Runs `march_test()` over `len` bytes at `addr` at every wait state setting and
+   * picks the fastest one that passed. If the next faster setting failed, the part is
+   * known to be close to the edge there, so `TUNE_MARGIN` more wait states are added
+   * (up to `MAX_WAITS`). Parts that pass at 0 wait states stay there, as every board
+   * used to run. If nothing passed, `passed` is 0 and `MAX_WAITS` is chosen.
+   *
+   * This destroys the tested bytes, so it must not be run over the heap once anything
+   * has been allocated. XMEM is left at the chosen setting.
+   */
+  TuneResults tune(uint16_t addr, uint16_t len);
+
+  // Reads the setting saved by `save_waits()`; returns false if nothing was saved
+  bool load_waits(uint8_t *waits);
+
+  // Saves `waits` into internal EEPROM at `IEE_XRAM_WAITS`
+  void save_waits(uint8_t waits);
+
+  // Walks a 1 and a 0 across the data lines and each address line.
+  // Takes a few hundred accesses and restores everything it touches.
+  bool quick_test();
+
   struct TestResults {
-    uint16_t successes;
-    unsigned long time;
+    uint16_t successes;  // Number of bytes that passed
+    unsigned long time;  // Time spent testing, in milliseconds
+    bool done;           // Whether all of XMEM has been tested
   };
 
+  // Number of bytes tested by each call to `test_step()`
+  constexpr uint8_t TEST_CHUNK = 16;
+
+  // Restarts the incremental test from the beginning of XMEM
+  void test_reset();
+
+  // Tests the next `TEST_CHUNK` bytes of XMEM without destroying their contents.
+  // Returns true once all of XMEM has been tested.
+  bool test_step();
+
+  const TestResults &test_results();
+
+  // Tests all of XMEM at once; contents are preserved
   TestResults test();
 }
 
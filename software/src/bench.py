@@ -0,0 +1,187 @@
+import argparse
+import collections
+import itertools
+import os
+import random
+import subprocess
+import tempfile
+import termios
+import threading
+import time
+import tty
+
+import comm
+import main
+
+class EmulatedLink:
+    """
+    Serial-port-like object for the computer's end of a pty pair. Both directions
+    are delayed as if the bytes went over a real UART at `baud` plus a fixed USB
+    `latency`, so round-trip gaps cost about as much as they would with a board.
+    Each byte has a chance of `errors` to get a random bit flipped on the way.
+
+    The device's baud rate is read back from its end of the pty, `device_fd`
+    (see `begin()` in the shim).
+    While the two ends disagree, or either goes above `max_baud`, everything
+    arrives as garbage.
+    """
+
+    # The nearest constants that the shim uses for the rates in `comm.BAUD_RATES`
+    PTY_SPEEDS = {
+        termios.B115200:  115200,
+        termios.B230400:  250000,
+        termios.B500000:  500000,
+        termios.B1000000: 1000000,
+        termios.B2000000: 2000000,
+    }
+
+    def __init__(self, fd: int, device_fd: int, baud: int, latency: float, errors: float, max_baud: int):
+        self.fd = fd
+        self.device_fd = device_fd
+        self.baudrate = baud
+        self.latency = latency
+        self.errors = errors
+        self.max_baud = max_baud
+        self.timeout = None
+
+        self.cond = threading.Condition()
+        self.rx = collections.deque()  # (deliver_at, byte)
+        self.tx = collections.deque()  # (deliver_at, byte)
+        self.rx_busy_until = 0.0
+        self.tx_busy_until = 0.0
+
+        threading.Thread(target=self._rx_loop, daemon=True).start()
+        threading.Thread(target=self._tx_loop, daemon=True).start()
+
+    @property
+    def device_baud(self):
+        return self.PTY_SPEEDS.get(termios.tcgetattr(self.device_fd)[5], 0)
+
+    def _corrupt(self, data: bytes):
+        if self.device_baud != self.baudrate or self.baudrate > self.max_baud:
+            return random.randbytes(len(data))
+
+        return bytes(b ^ (1 << random.randrange(8)) if random.random() < self.errors else b for b in data)
+
+    def _schedule(self, busy_until: float, data: bytes, baud: int):
+        """Returns when the UART will be done with `data`, and when each byte of it arrives."""
+        byte_time = 10 / max(baud, 1)  # 8N1
+        start = max(time.monotonic(), busy_until) + self.latency
+        times = [start + (i + 1) * byte_time for i in range(len(data))]
+
+        return times[-1] - self.latency, times
+
+    def _rx_loop(self):
+        while True:
+            try:
+                data = os.read(self.fd, 4096)
+            except OSError:
+                return
+
+            with self.cond:
+                self.rx_busy_until, times = self._schedule(self.rx_busy_until, data, self.device_baud)
+                self.rx.extend(zip(times, self._corrupt(data)))
+                self.cond.notify_all()
+
+    def _tx_loop(self):
+        while True:
+            with self.cond:
+                while not self.tx:
+                    self.cond.wait()
+
+                deliver_at = self.tx[0][0]
+
+            time.sleep(max(0.0, deliver_at - time.monotonic()))
+            now = time.monotonic()
+
+            with self.cond:
+                data = bytes(self.tx.popleft()[1] for _ in itertools.takewhile(lambda x: x[0] <= now, list(self.tx)))
+
+            os.write(self.fd, data)
+
+    @property
+    def in_waiting(self):
+        now = time.monotonic()
+
+        with self.cond:
+            return sum(1 for _ in itertools.takewhile(lambda x: x[0] <= now, self.rx))
+
+    def read(self, size: int = 1):
+        out = bytearray()
+        give_up = None if self.timeout is None else time.monotonic() + self.timeout
+
+        with self.cond:
+            while len(out) < size:
+                now = time.monotonic()
+
+                if give_up is not None and now >= give_up:
+                    break
+
+                deliver_at = self.rx[0][0] if self.rx else None
+                wait = None if deliver_at is None else deliver_at - now
+
+                if wait is None or wait > 0:
+                    if give_up is not None:
+                        wait = give_up - now if wait is None else min(wait, give_up - now)
+
+                    self.cond.wait(wait)
+                    continue
+
+                _, b = self.rx.popleft()
+                out.append(b)
+
+        return bytes(out)
+
+    def write(self, data: bytes):
+        with self.cond:
+            self.tx_busy_until, times = self._schedule(self.tx_busy_until, data, self.baudrate)
+            self.tx.extend(zip(times, self._corrupt(data)))
+            self.cond.notify_all()
+
+    def flush(self):
+        with self.cond:
+            while self.tx:
+                self.cond.wait(self.latency)
+
+def bench():
+    ap = argparse.ArgumentParser(description="Benchmark Comm transfers against a host build of the firmware")
+    ap.add_argument("--bench", help="path to commbench binary", default="../firmware/commbench/commbench")
+    ap.add_argument("--kib", help="amount of data to transfer each way", type=int, default=16)
+    ap.add_argument("--baud", help="emulated baud rate to start at", type=int, choices=comm.BAUD_RATES, default=comm.BAUD_RATES[0])
+    ap.add_argument("--max-baud", help="emulated limit of the link, faster rates garble everything", type=int, default=comm.BAUD_RATES[-1])
+    ap.add_argument("--latency", help="emulated one-way latency in ms", type=float, default=1.0)
+    ap.add_argument("--errors", help="chance of corrupting each byte, in either direction", type=float, default=0.0)
+    ap.add_argument("--raw", help="don't negotiate framed mode", action="store_true")
+    ap.add_argument("--verbose", help="show the program's output", action="store_true")
+
+    args = ap.parse_args()
+
+    master, slave = os.openpty()
+    tty.setraw(master)
+    tty.setraw(slave)
+
+    # Both ends start out at `--baud`, as if the device had been told to
+    attrs = termios.tcgetattr(slave)
+    attrs[4] = attrs[5] = next(k for k, v in EmulatedLink.PTY_SPEEDS.items() if v == args.baud)
+    termios.tcsetattr(slave, termios.TCSANOW, attrs)
+
+    link = EmulatedLink(master, slave, args.baud, args.latency / 1000, args.errors, args.max_baud)
+    com = comm.Comm(link)
+
+    with tempfile.NamedTemporaryFile() as f, open(os.devnull, "w") as devnull:
+        # Answer the file dialog with the temporary file, and keep the program quiet
+        main.file_dialog = lambda prompt, must_exist: f.name
+        main.input = lambda prompt: None
+
+        if not args.verbose:
+            main.print = lambda *a, **kw: print(*a, **kw, file=devnull)
+
+        threading.Thread(target=main.main_loop, args=(com,), daemon=True).start()
+
+        print(f"Emulating {args.baud} baud with {args.latency}ms latency, {args.kib} KiB each way.")
+        res = subprocess.run([args.bench, os.ttyname(slave), str(args.kib)] + (["raw"] if args.raw else []))
+
+    return res.returncode
+
+if __name__ == "__main__":
+    raise SystemExit(bench())
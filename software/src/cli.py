@@ -0,0 +1,417 @@
+"""
+Runs EEPROM operations on eeprommer3 from the command line, without touching
+the screen, e.g. to program chips on a production line. The firmware side is
+`ProgrammerRemoteCore` in `prog_core.hpp`.
+
+Opening the port resets the board, so every command waits for it to start up,
+asks it to ping, and then negotiates framing and baud rate as usual.
+"""
+
+import argparse
+import sys
+import time
+
+import comm
+import e3z
+import main
+
+STATUS_OK         = 0x00
+STATUS_ERR_VERIFY = 0x03
+
+STATUS_TEXT = [
+    "no errors",
+    "invalid request",
+    "unable to open file",
+    "verification failed",
+    "out of memory on the device",
+    "serial transfer failed",
+]
+
+TIMEOUT_BOOT    = 10.0
+TIMEOUT_SETTLE  = 1.0
+TIMEOUT_REPLY   = 5.0
+
+# Time for the device to write one byte (and read it back), for block timeouts
+T_WRITE_BYTE = 0.012
+T_READ_BYTE  = 0.002
+
+# Checksums the device can work out, in the order of the firmware's `Crc::Algo`: name, function, hex digits
+CHECKSUMS = {
+    "crc16":      ("CRC-16",      comm.crc16,      4),
+    "crc32":      ("CRC-32",      comm.crc32,      8),
+    "fletcher16": ("Fletcher-16", comm.fletcher16, 4),
+}
+
+class RemoteError(Exception):
+    pass
+
+class Remote:
+    def __init__(self, com: comm.Comm):
+        self.com = com
+        self.size = 0
+        self.block = 0
+
+    def connect(self):
+        """
+        Asks the device to ping until it does, and answers pings and baud rate
+        switches until it goes quiet (requests sent while it was still starting
+        up all get their own ping).
+        """
+        deadline = time.monotonic() + TIMEOUT_BOOT
+        pinged = False
+
+        while True:
+            if not pinged:
+                if time.monotonic() > deadline:
+                    raise RemoteError("device did not respond")
+
+                self.com.send(comm.PKT_PING)
+
+            pkt = self.com.recv(timeout=TIMEOUT_SETTLE)
+
+            if pkt is None:
+                if pinged:
+                    break
+
+                continue
+
+            if pkt[0] == comm.PKT_PING:
+                self.com.answer_ping(pkt[1:])
+                pinged = True
+            elif pkt[0] == comm.PKT_BAUD:
+                self.com.answer_baud(pkt[1])
+
+        info = self.info()
+
+        self.size  = info["size"]
+        self.block = info["block"]
+
+    def info(self):
+        _, args = self.request(comm.PKT_EEINFO)
+
+        return {
+            "version": args[0],
+            "size":    args[1] | (args[2] << 8),
+            "block":   args[3] | (args[4] << 8),
+            "caps":    args[5],
+            "baud":    int.from_bytes(args[6:10], "little"),
+        }
+
+    def read(self, addr: int, length: int):
+        self.request(comm.PKT_EEREAD, range_args(addr, length))
+
+        data = bytearray()
+
+        for start in range(0, length, self.block):
+            count = min(self.block, length - start)
+
+            for chunk in self.com.stream_recv(count, timeout=TIMEOUT_REPLY + count * T_READ_BYTE):
+                data += chunk
+
+            progress("Reading", len(data), length)
+
+        return bytes(data)
+
+    def dump(self, addr: int, length: int):
+        """
+        Reads a range with PKT_EEDUMP, which streams it without waiting for acks.
+        Blocks whose checksum doesn't match are read again with PKT_EEREAD.
+        """
+        self.request(comm.PKT_EEDUMP, range_args(addr, length))
+
+        data = bytearray()
+        bad = []
+        block_start = 0
+
+        while True:
+            pkt = self.com.recv(timeout=TIMEOUT_REPLY)
+
+            if pkt is None:
+                raise RemoteError("dump stopped")
+
+            if pkt[0] == comm.PKT_DUMPDT:
+                data += pkt[1:]
+            elif pkt[0] == comm.PKT_DUMPCK:
+                offset = pkt[1] | (pkt[2] << 8)
+                crc    = pkt[3] | (pkt[4] << 8)
+
+                if offset != len(data) or crc != comm.crc16(bytes(data[block_start:offset])):
+                    bad.append((block_start, offset))
+
+                block_start = offset
+                progress("Dumping", offset, length)
+            elif pkt[0] == comm.PKT_EEDUMP:
+                total_crc = pkt[2] | (pkt[3] << 8)
+                break
+            else:
+                raise RemoteError(f"unexpected packet {pkt[:8].hex()} in dump")
+
+        if len(data) != length:
+            raise RemoteError(f"dump has 0x{len(data) :04X} bytes instead of 0x{length :04X}")
+
+        for start, end in bad:
+            print(f"Reading 0x{addr + start :04X}-0x{addr + end - 1 :04X} again, checksum mismatch", file=sys.stderr)
+            data[start:end] = self.read(addr + start, end - start)
+
+        if total_crc != comm.crc16(bytes(data)):
+            raise RemoteError("checksum of the whole dump doesn't match")
+
+        return bytes(data)
+
+    def hashes(self, addr: int, length: int):
+        """Returns the page size and the CRC-32 of each page of a range, computed by the device."""
+        _, args = self.request(comm.PKT_EEHASH, range_args(addr, length), TIMEOUT_REPLY + length * T_READ_BYTE)
+
+        page  = args[0] | (args[1] << 8)
+        count = args[2]
+
+        raw = b"".join(self.com.stream_recv(count * 4, timeout=TIMEOUT_REPLY))
+
+        if len(raw) != count * 4:
+            raise RemoteError("page hashes cut off")
+
+        return page, [int.from_bytes(raw[i:i + 4], "little") for i in range(0, len(raw), 4)]
+
+    def write(self, addr: int, data: bytes, verify: bool):
+        flags = bytes([0x01 if verify else 0x00])
+        per_byte = T_WRITE_BYTE + (T_READ_BYTE if verify else 0)
+
+        return self.send_blocks(comm.PKT_EEWRIT, addr, data, flags, per_byte, "Writing")
+
+    def verify(self, addr: int, data: bytes):
+        return self.send_blocks(comm.PKT_EEVRFY, addr, data, b"", T_READ_BYTE, "Verifying")
+
+    def fill(self, addr: int, length: int, value: int):
+        self.request(comm.PKT_EEFILL, range_args(addr, length) + bytes([value]), TIMEOUT_REPLY + length * T_WRITE_BYTE)
+
+    def checksum(self, addr: int, length: int, algo: str = "crc16"):
+        algo_id = bytes([list(CHECKSUMS).index(algo)])
+        _, args = self.request(comm.PKT_EECSUM, range_args(addr, length) + algo_id, TIMEOUT_REPLY + length * T_READ_BYTE)
+
+        return int.from_bytes(args, "little")
+
+    def send_blocks(self, pkt_type: int, addr: int, data: bytes, flags: bytes, per_byte: float, what: str):
+        """
+        Streams `data` one block at a time for PKT_EEWRIT or PKT_EEVRFY.
+        Returns the number of mismatches and the address of the first one.
+        """
+        self.request(pkt_type, range_args(addr, len(data)) + flags)
+
+        mismatches, first = 0, None
+
+        for start in range(0, len(data), self.block):
+            block = data[start:start + self.block]
+
+            self.com.stream_send(block, comm.STREAM_WINDOW, timeout=TIMEOUT_REPLY)
+            status, args = self.reply(pkt_type, TIMEOUT_REPLY + len(block) * per_byte, STATUS_ERR_VERIFY)
+
+            if status == STATUS_ERR_VERIFY:
+                if first is None:
+                    first = args[2] | (args[3] << 8)
+
+                mismatches += args[0] | (args[1] << 8)
+
+            progress(what, start + len(block), len(data))
+
+        return mismatches, first
+
+    def request(self, pkt_type: int, args: bytes = b"", timeout: float = TIMEOUT_REPLY):
+        self.com.send(pkt_type, args)
+        return self.reply(pkt_type, timeout)
+
+    def reply(self, pkt_type: int, timeout: float, *allowed: int):
+        """Waits for the reply to `pkt_type`, and raises unless its status is OK or in `allowed`."""
+        pkt = self.com.recv(timeout=timeout)
+
+        if pkt is None:
+            raise RemoteError("device stopped responding")
+
+        if pkt[0] != pkt_type or len(pkt) < 2:
+            raise RemoteError(f"unexpected packet {pkt[:8].hex()}")
+
+        status = pkt[1]
+
+        if status != STATUS_OK and status not in allowed:
+            text = STATUS_TEXT[status] if status < len(STATUS_TEXT) else f"status {status}"
+            raise RemoteError(text)
+
+        return status, pkt[2:]
+
+def range_args(addr: int, length: int):
+    return addr.to_bytes(2, "little") + length.to_bytes(2, "little")
+
+def progress(what: str, done: int, total: int):
+    end = "\n" if done >= total else ""
+    print(f"\r{what}... 0x{done :04X}/0x{total :04X} bytes", end=end, file=sys.stderr, flush=True)
+
+def load_image(path: str):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    return e3z.decompress(data) if e3z.is_compressed(data) else data
+
+def report_mismatches(mismatches: int, first: int | None):
+    if mismatches == 0:
+        print("Verified, no mismatches.")
+        return 0
+
+    print(f"Verification failed: {mismatches} mismatches, first at 0x{first :04X}.")
+    return 1
+
+def cmd_info(remote: Remote, args):
+    info = remote.info()
+
+    print(f"Protocol version {info['version']}")
+    print(f"EEPROM size 0x{info['size'] :04X}, block size 0x{info['block'] :04X}")
+    print(f"Capabilities 0x{info['caps'] :02X} at {info['baud']} baud")
+
+    return 0
+
+def cmd_read(remote: Remote, args):
+    length = args.length if args.length is not None else remote.size - args.addr
+    data = remote.read(args.addr, length) if args.acked else remote.dump(args.addr, length)
+
+    with open(args.file, "wb") as f:
+        f.write(data)
+
+    print(f"Read 0x{len(data) :04X} bytes, CRC-16 0x{comm.crc16(data) :04X}.")
+    return 0
+
+def cmd_write(remote: Remote, args):
+    data = load_image(args.file)
+    result = remote.write(args.addr, data, args.verify)
+
+    print(f"Wrote 0x{len(data) :04X} bytes, CRC-16 0x{comm.crc16(data) :04X}.")
+    return report_mismatches(*result) if args.verify else 0
+
+def cmd_verify(remote: Remote, args):
+    data = load_image(args.file)
+    return report_mismatches(*remote.verify(args.addr, data))
+
+def cmd_sync(remote: Remote, args):
+    data = load_image(args.file)
+    page, hashes = remote.hashes(args.addr, len(data))
+
+    differ = [i for i, crc in enumerate(hashes) if crc != comm.crc32(data[i * page:(i + 1) * page])]
+    print(f"{len(differ)} of {len(hashes)} pages differ.")
+
+    # Neighboring pages are transferred together
+    runs = []
+
+    for i in differ:
+        if runs and runs[-1][1] == i * page:
+            runs[-1][1] = min((i + 1) * page, len(data))
+        else:
+            runs.append([i * page, min((i + 1) * page, len(data))])
+
+    failed = False
+
+    for start, end in runs:
+        where = f"0x{args.addr + start :04X}-0x{args.addr + end - 1 :04X}"
+
+        if args.write:
+            mismatches, first = remote.write(args.addr + start, data[start:end], verify=True)
+
+            if mismatches:
+                print(f"{where}: still {mismatches} mismatches after writing, first at 0x{first :04X}.")
+                failed = True
+            else:
+                print(f"{where}: rewritten.")
+        else:
+            actual = remote.dump(args.addr + start, end - start)
+            diff = [i for i in range(end - start) if actual[i] != data[start + i]]
+
+            if diff:
+                print(f"{where}: {len(diff)} mismatches, first at 0x{args.addr + start + diff[0] :04X}.")
+                failed = True
+
+    return 1 if failed else 0
+
+def cmd_fill(remote: Remote, args):
+    remote.fill(args.addr, args.length, args.value)
+
+    print(f"Filled 0x{args.length :04X} bytes with 0x{args.value :02X}.")
+    return 0
+
+def cmd_checksum(remote: Remote, args):
+    name, func, digits = CHECKSUMS[args.algo]
+
+    crc = remote.checksum(args.addr, args.length, args.algo)
+    print(f"{name} 0x{crc :0{digits}X}")
+
+    if args.expect is None:
+        return 0
+
+    expected = func(load_image(args.expect)[:args.length])
+
+    if crc != expected:
+        print(f"Mismatch, expected 0x{expected :0{digits}X}.")
+        return 1
+
+    print("Matches.")
+    return 0
+
+def number(text: str):
+    return int(text, 0)
+
+def main_cli():
+    ap = argparse.ArgumentParser(description="Run EEPROM operations on eeprommer3 without the touch screen")
+    ap.add_argument("-p", "--port", help="specify port connected to eeprommer3", required=True)
+    ap.add_argument("--max-baud", help="highest baud rate to agree to", type=int, default=comm.BAUD_RATES[-1])
+    ap.add_argument("--log", help="append the device's log to FILE (- for stderr)", metavar="FILE")
+
+    sub = ap.add_subparsers(dest="command", required=True)
+
+    sp = sub.add_parser("info", help="show device information")
+    sp.set_defaults(func=cmd_info)
+
+    sp = sub.add_parser("read", help="read a range to a file")
+    sp.add_argument("addr", type=number)
+    sp.add_argument("length", type=number, nargs="?", help="defaults to the rest of the EEPROM")
+    sp.add_argument("file")
+    sp.add_argument("--acked", help="stream in acknowledged blocks instead of dumping", action="store_true")
+    sp.set_defaults(func=cmd_read)
+
+    sp = sub.add_parser("write", help="write an image (raw or E3Z) at an address")
+    sp.add_argument("addr", type=number)
+    sp.add_argument("file")
+    sp.add_argument("--verify", help="read back and compare each block after writing it", action="store_true")
+    sp.set_defaults(func=cmd_write)
+
+    sp = sub.add_parser("verify", help="compare an image (raw or E3Z) with the EEPROM")
+    sp.add_argument("addr", type=number)
+    sp.add_argument("file")
+    sp.set_defaults(func=cmd_verify)
+
+    sp = sub.add_parser("sync", help="compare an image (raw or E3Z) with the EEPROM by page hashes")
+    sp.add_argument("addr", type=number)
+    sp.add_argument("file")
+    sp.add_argument("--write", help="rewrite the pages that differ", action="store_true")
+    sp.set_defaults(func=cmd_sync)
+
+    sp = sub.add_parser("fill", help="fill a range with a value")
+    sp.add_argument("addr", type=number)
+    sp.add_argument("length", type=number)
+    sp.add_argument("value", type=number)
+    sp.set_defaults(func=cmd_fill)
+
+    sp = sub.add_parser("checksum", help="compute a checksum of a range on the device")
+    sp.add_argument("addr", type=number)
+    sp.add_argument("length", type=number)
+    sp.add_argument("--algo", choices=CHECKSUMS, default="crc16", help="checksum to use (default: crc16)")
+    sp.add_argument("--expect", help="image to compare the checksum with", metavar="FILE")
+    sp.set_defaults(func=cmd_checksum)
+
+    args = ap.parse_args()
+
+    remote = Remote(comm.Comm(main.open_port(args.port), args.max_baud, main.open_log(args.log)))
+
+    try:
+        remote.connect()
+        return args.func(remote, args)
+    except (RemoteError, comm.StreamError) as e:
+        print(f"Error: {e}", file=sys.stderr)
+        return 2
+
+if __name__ == "__main__":
+    sys.exit(main_cli())
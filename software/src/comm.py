@@ -1,6 +1,11 @@
+import binascii
+import collections
+import time
+
 import serial
 
 PKT_PING     = 0x00
+PKT_BAUD     = 0x01
 PKT_FILEOPEN = 0x10
 PKT_FILECONF = 0x11
 PKT_FILESIZE = 0x12
@@ -9,21 +14,362 @@ PKT_FILEREAD = 0x14
 PKT_FILEWRIT = 0x15
 PKT_FILEFLUS = 0x16
 PKT_FILECLOS = 0x17
+PKT_STREAMRD = 0x18
+PKT_STREAMWR = 0x19
+PKT_STREAMDT = 0x1A
+PKT_STREAMAK = 0x1B
+PKT_MEMSTAT  = 0x20
+PKT_EEINFO   = 0x30
+PKT_EEREAD   = 0x31
+PKT_EEWRIT   = 0x32
+PKT_EEVRFY   = 0x33
+PKT_EEFILL   = 0x34
+PKT_EECSUM   = 0x35
+PKT_EEDUMP   = 0x36
+PKT_DUMPDT   = 0x37
+PKT_DUMPCK   = 0x38
+PKT_EEHASH   = 0x39
+PKT_LOGFMT   = 0x40
+PKT_LOGDATA  = 0x41
+
+STREAM_CHUNK  = 128
+STREAM_WINDOW = 4
+
+CAP_FRAMED   = 0x01
+CAP_OFFSET32 = 0x02
+CAP_LOG      = 0x04  # Only if there is somewhere for the log to go (see `devlog.py`)
+
+CAPS = CAP_FRAMED | CAP_OFFSET32
+
+# Index is the code used in PKT_PING and PKT_BAUD
+BAUD_RATES = [115200, 250000, 500000, 1000000, 2000000]
+
+FRAME_SOF = 0x7E
+FRAME_NAK = 0x7D
+FRAME_HISTORY = 8
+
+TIMEOUT_BYTE = 0.050
+TIMEOUT_NAK  = 0.100
+TIMEOUT_BAUD = 0.500
+
+class StreamError(Exception):
+    pass
+
+def crc16(data: bytes):
+    """CRC-16/CCITT-FALSE, same as the firmware's `Crc::crc16()`."""
+    return binascii.crc_hqx(data, 0xFFFF)
+
+def crc32(data: bytes):
+    """CRC-32 as in zlib, same as the firmware's `Crc::crc32()`."""
+    return binascii.crc32(data)
+
+def fletcher16(data: bytes):
+    """Fletcher-16 (sums modulo 255, the second one in the high byte), same as the firmware's `Crc::fletcher16_update()`."""
+    sum1, sum2 = 0, 0
+
+    for byte in data:
+        sum1 = (sum1 + byte) % 255
+        sum2 = (sum2 + sum1) % 255
+
+    return (sum2 << 8) | sum1
 
 class Comm:
-    def __init__(self, ser: serial.Serial):
+    """
+    Packets are a length byte (0x00 for 1 byte, 0xFF for 256 bytes) and the contents.
+    In framed mode (see `firmware/README.md` and `comm.hpp`), they are wrapped in
+    `[FRAME_SOF, seq, end, contents..., crc_lo, crc_hi]` and damaged or missing
+    frames are recovered with NAKs.
+    """
+
+    def __init__(self, ser: serial.Serial, max_baud: int = BAUD_RATES[-1], log=None):
+        """
+        `log` (a `devlog.LogDecoder`) is given the device's log packets, which can
+        come in between any others; without it, the device doesn't send them.
+        """
         self.ser = ser
+        self.rates = sum(1 << code for code, rate in enumerate(BAUD_RATES) if rate <= max_baud)
+        self.caps = 0x00
+        self.log = log
+        self.supported = CAPS | (CAP_LOG if log is not None else 0x00)
+        self.lookahead = None  # Byte read ahead of time by `_recv_framed()`, returned by the next `_read_byte()`
+        self.set_framed(False)
+
+    def set_framed(self, framed: bool):
+        self.framed = framed
+        self.tx_seq = 0
+        self.rx_seq = 0
+        self.history = collections.deque(maxlen=FRAME_HISTORY)
+        self.nak_time = None
+
+    def _read_byte(self, timeout: float | None):
+        if self.lookahead is not None:
+            val, self.lookahead = self.lookahead, None
+            return val
+
+        self.ser.timeout = timeout
+        data = self.ser.read(1)
+        return data[0] if data else None
+
+    def _send_frame(self, seq: int, data: bytes):
+        body = bytes([seq, len(data) - 1]) + data
+        crc = crc16(body)
+
+        self.ser.write(bytes([FRAME_SOF]) + body + bytes([crc & 0xFF, crc >> 8]))
+
+    def _send_nak(self):
+        now = time.monotonic()
+
+        if self.nak_time is not None and self.nak_time[0] == self.rx_seq and now - self.nak_time[1] < TIMEOUT_NAK:
+            return  # Already asked for this frame, wait for it
+
+        self.ser.write(bytes([FRAME_NAK, self.rx_seq, ~self.rx_seq & 0xFF]))
+        self.nak_time = (self.rx_seq, now)
+
+    def _handle_nak(self):
+        seq, chk = self._read_byte(TIMEOUT_BYTE), self._read_byte(TIMEOUT_BYTE)
+
+        if seq is None or chk is None or seq != ~chk & 0xFF:
+            return
+
+        # Resend every frame from `seq` on, if they are all still in the history
+        count = (self.tx_seq - seq) & 0xFF
+
+        if 0 < count <= len(self.history):
+            for frame in list(self.history)[-count:]:
+                self._send_frame(*frame)
+
+    def _read_frame(self):
+        self.ser.timeout = TIMEOUT_BYTE
+
+        header = self.ser.read(2)
+
+        if len(header) < 2:
+            return None
+
+        # Everything after the header, including the CRC
+        rest = self.ser.read(header[1] + 1 + 2)
+
+        if len(rest) < header[1] + 1 + 2:
+            return None
+
+        if crc16(header + rest[:-2]) != rest[-2] | (rest[-1] << 8):
+            return None
+
+        return header[0], rest[:-2]
+
+    def _recv_framed(self, idle_nak: bool, timeout: float | None):
+        start = time.monotonic()
+        noise = False
+
+        while True:
+            elapsed = time.monotonic() - start
+
+            if timeout is not None and elapsed > timeout:
+                return None
+
+            # If an answer is expected soon, or garbage came in, going without a frame
+            # for a while may mean one was lost entirely, so ask for it (again)
+            impatient = idle_nak or noise or timeout is not None
+
+            if impatient and elapsed > TIMEOUT_NAK:
+                self._send_nak()
+
+            val = self._read_byte(TIMEOUT_NAK if impatient else None)
+
+            if val is None:
+                if noise and not idle_nak and self.ser.baudrate != BAUD_RATES[0]:
+                    # Only garbage while waiting for a new packet, the device has probably gone back to the default rate
+                    self.ser.baudrate = BAUD_RATES[0]
+                    self.set_framed(False)
+                    return self.recv(idle_nak, timeout)
+
+                continue
+
+            if val == FRAME_NAK:
+                self._handle_nak()
+                continue
+
+            if val <= 0x02 and not noise:
+                # A ping is always unframed, and turns framing off until it is negotiated again.
+                # It can only start where a frame would, not in garbage, which may well contain `00 00`.
+                nxt = self._read_byte(TIMEOUT_BYTE)
+
+                if nxt == PKT_PING:
+                    self.set_framed(False)
+                    return bytes([PKT_PING]) + self.ser.read(val)
+
+                # Not a ping, so look at that byte again, as it may be the start of a frame
+                self.lookahead = nxt
 
-    def recv(self):
-        end = self.ser.read()
-        return self.ser.read(ord(end) + 1)
+            if val != FRAME_SOF:
+                noise = True
+                continue  # Skip to next start marker
+
+            frame = self._read_frame()
+
+            if frame is None:
+                self._send_nak()
+                continue
+
+            seq, data = frame
+
+            if seq != self.rx_seq:
+                # Ahead means frames went missing in between, behind is a repeat of one already received
+                if (seq - self.rx_seq) & 0xFF < 0x80:
+                    self._send_nak()
+
+                continue
+
+            self.rx_seq = (self.rx_seq + 1) & 0xFF
+            self.nak_time = None
+
+            return data
+
+    def recv(self, idle_nak: bool = False, timeout: float | None = None):
+        """
+        Reads one packet. Set `idle_nak` when the device is expected to be sending
+        something, so that a frame which vanished entirely is asked for again.
+        Returns None if nothing arrived within `timeout` seconds.
+        Log packets are passed on to `log` instead of being returned.
+        """
+        deadline = None if timeout is None else time.monotonic() + timeout
+
+        while True:
+            remaining = None if deadline is None else max(0.0, deadline - time.monotonic())
+            pkt = self._recv_packet(idle_nak, remaining)
+
+            if not pkt or pkt[0] not in (PKT_LOGFMT, PKT_LOGDATA):
+                return pkt
+
+            if self.log is not None:
+                self.log.feed(pkt)
+
+    def _recv_packet(self, idle_nak: bool, timeout: float | None):
+        if self.framed:
+            return self._recv_framed(idle_nak, timeout)
+
+        end = self._read_byte(timeout)
+
+        if end is None:
+            return None
+
+        return self.ser.read(end + 1)
+
+    def answer_ping(self, args: bytes):
+        """
+        Replies to a PKT_PING from the device with the capabilities and baud rates
+        both sides support, and switches framing accordingly. Returns the reply.
+        """
+        caps  = (args[0] if len(args) > 0 else 0x00) & self.supported
+        rates = (args[1] if len(args) > 1 else 0x00) & self.rates
+
+        self.send(PKT_PING, bytes([caps, rates]))
+        self.set_framed(bool(caps & CAP_FRAMED))
+        self.caps = caps
+
+        return caps, rates
+
+    def answer_baud(self, code: int):
+        """
+        Handles the computer's side of switching to baud rate `code` after the
+        device asked for it with PKT_BAUD. Returns whether the new rate is in use.
+        """
+        if not self.framed or not self.rates & (1 << code):
+            self.send(PKT_BAUD, bytes([0xFF]))
+            return False
+
+        old_baud = self.ser.baudrate
+
+        self.send(PKT_BAUD, bytes([code]))
+        self.ser.flush()
+        self.ser.baudrate = BAUD_RATES[code]
+
+        # The device sends a test pattern, which gets echoed back, and then confirms
+        test = self.recv(idle_nak=True, timeout=TIMEOUT_BAUD)
+
+        if test is not None and test[:2] == bytes([PKT_BAUD, code]):
+            self.send_raw(test)
+
+            if self.recv(idle_nak=True, timeout=TIMEOUT_BAUD) == bytes([PKT_BAUD, code]):
+                return True
+
+        self.ser.baudrate = old_baud
+        return False
 
     def send_raw(self, data: bytes):
-        self.ser.write(bytes([len(data) - 1]))
-        self.ser.write(data)
+        if self.framed:
+            self.history.append((self.tx_seq, data))
+            self._send_frame(self.tx_seq, data)
+            self.tx_seq = (self.tx_seq + 1) & 0xFF
+        else:
+            self.ser.write(bytes([len(data) - 1]) + data)
 
     def send(self, header: int, buffer: bytes | None = None):
         if buffer is None:
             buffer = b""
 
         self.send_raw(bytes([header]) + buffer)
+
+    def _recv_stream(self, timeout: float | None):
+        pkt = self.recv(idle_nak=True, timeout=timeout)
+
+        if pkt is None:
+            raise StreamError("timed out")
+
+        return pkt
+
+    def stream_send(self, data: bytes, window: int, eof: bool = False, timeout: float | None = None):
+        """
+        Streams `data` as PKT_STREAMDT packets, keeping up to `window` of them
+        unacknowledged. If `eof` is set, the stream is ended with a short packet
+        (an empty one if needed) so the receiver knows no more data is coming.
+        """
+        chunks = [data[i:i + STREAM_CHUNK] for i in range(0, len(data), STREAM_CHUNK)]
+
+        if eof and (not chunks or len(chunks[-1]) == STREAM_CHUNK):
+            chunks.append(b"")
+
+        sent = acked = 0
+
+        while acked < len(chunks):
+            if sent < len(chunks) and sent - acked < window:
+                self.send(PKT_STREAMDT, bytes([sent & 0xFF]) + chunks[sent])
+                sent += 1
+
+                if not self.ser.in_waiting and self.lookahead is None:
+                    continue
+
+            ack = self._recv_stream(timeout)
+
+            # Cumulative ack: everything up to and including `seq` has arrived
+            newly_acked = (ack[1] + 1 - acked) & 0xFF
+
+            if ack[0] != PKT_STREAMAK or newly_acked > sent - acked:
+                raise StreamError(f"bad ack {ack.hex()} with {acked}/{sent} acked")
+
+            acked += newly_acked
+
+    def stream_recv(self, length: int, timeout: float | None = None):
+        """
+        Receives `length` bytes of PKT_STREAMDT packets, acknowledging each one.
+        Yields each chunk as soon as it arrives.
+        """
+        seq = 0
+        received = 0
+
+        while received < length:
+            pkt = self._recv_stream(timeout)
+
+            if pkt[0] != PKT_STREAMDT or pkt[1] != seq:
+                raise StreamError(f"bad packet {pkt[:2].hex()}, expected seq {seq}")
+
+            chunk = pkt[2:]
+            received += len(chunk)
+
+            yield chunk
+
+            self.send(PKT_STREAMAK, bytes([seq]))
+            seq = (seq + 1) & 0xFF
+
+            if len(chunk) < STREAM_CHUNK:
+                break
@@ -0,0 +1,95 @@
+"""
+Puts the firmware's binary log back together (see `firmware/eeprommer3/src/log.hpp`).
+
+The device sends each log site's format string once, as
+`[PKT_LOGFMT, id(2), line(2), file name..., 0x00, format...]`, and then records of
+it in `[PKT_LOGDATA, dropped(2), records...]` packets. A record is
+`[len, id(2), time(4), args(len)...]`, `time` being the device's `millis()`, and
+the arguments are packed as the ATmega's `printf()` takes them: 4 bytes for `%l...`,
+a NUL-terminated string for `%s`, and 2 bytes (an `int`) for anything else.
+"""
+
+import re
+import struct
+import sys
+
+from comm import PKT_LOGFMT, PKT_LOGDATA
+
+SPEC = re.compile(r"%[-+ #0]*\d*(?:\.\d+)?(hh|h|ll|l)?([diouxXcsp%])")
+
+class LogDecoder:
+    def __init__(self, out=sys.stderr):
+        self.out = out
+        self.sites = {}
+
+        # Records are prefixed only at the start of a line, since one line may take several of them
+        self.line_start = True
+
+    def feed(self, pkt: bytes):
+        """Takes a PKT_LOGFMT or PKT_LOGDATA packet. Returns False for any other packet."""
+        if pkt[0] == PKT_LOGFMT:
+            site_id, line = struct.unpack_from("<HH", pkt, 1)
+            name, _, fmt = pkt[5:].partition(b"\0")
+            self.sites[site_id] = (name.decode("ascii", "replace"), line, fmt.decode("ascii", "replace"))
+        elif pkt[0] == PKT_LOGDATA:
+            dropped = struct.unpack_from("<H", pkt, 1)[0]
+
+            if dropped:
+                self.write(None, f"({dropped} records dropped)\n")
+
+            pos = 3
+
+            while pos + 7 <= len(pkt):
+                length, site_id, ms = struct.unpack_from("<BHI", pkt, pos)
+                args = pkt[pos + 7:pos + 7 + length]
+                pos += 7 + length
+
+                self.write(ms, self.format(site_id, args), site_id)
+        else:
+            return False
+
+        self.out.flush()
+        return True
+
+    def format(self, site_id: int, args: bytes):
+        if site_id not in self.sites:
+            return f"(unknown log site 0x{site_id :04X}: {args.hex()})\n"
+
+        fmt = self.sites[site_id][2]
+        values = []
+        pos = 0
+
+        for m in SPEC.finditer(fmt):
+            length, conv = m.group(1), m.group(2)
+
+            if conv == "%":
+                continue
+
+            if conv == "s":
+                end = args.find(b"\0", pos)
+                end = len(args) if end < 0 else end
+                values.append(args[pos:end].decode("ascii", "replace"))
+                pos = end + 1
+                continue
+
+            size = 4 if length in ("l", "ll") else 2
+            signed = conv in "di"
+            values.append(int.from_bytes(args[pos:pos + size], "little", signed=signed))
+            pos += size
+
+        # Python ignores the length modifiers, and has no %p
+        try:
+            return fmt.replace("%p", "%X") % tuple(values)
+        except (TypeError, ValueError):
+            return f"{fmt!r} % {values!r}\n"
+
+    def write(self, ms: int | None, text: str, site_id: int | None = None):
+        for piece in text.splitlines(keepends=True):
+            if self.line_start:
+                stamp = "" if ms is None else f"{ms / 1000 :10.3f} "
+                where = "log" if site_id not in self.sites else "{}:{}".format(*self.sites[site_id][:2])
+
+                self.out.write(f"[{stamp}{where}] ")
+
+            self.out.write(piece)
+            self.line_start = piece.endswith("\n")
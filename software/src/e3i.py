@@ -0,0 +1,146 @@
+"""
+E3I images, drawn by `TftCtrl::drawImageFromFile` in the firmware (e.g. `startup.e3i`).
+
+A file is the magic "E3I", a version byte, the width and height (16-bit LE) and
+the number of palette colors minus 1, followed by the palette (RGB565, 16-bit LE)
+and tokens of palette indices, row by row:
+- 0x00-0x7F: literal, the next `tag + 1` bytes are indices
+- 0x80-0xFF: run, `(tag & 0x7F) << 8 | next` + 1 pixels of the index after that
+
+Images are converted from raw RGB565 in big-endian order (the old `startup.bin`),
+or from any image file if Pillow is installed.
+"""
+
+import argparse
+
+MAGIC   = b"E3I"
+VERSION = 1
+HEADER_SIZE = 9
+
+MIN_RUN = 3  # Shorter runs are cheaper as literals
+MAX_LIT = 0x80
+MAX_RUN = 0x8000
+
+def encode(pixels: list, width: int, height: int):
+    if len(pixels) != width * height:
+        raise ValueError(f"expected {width * height} pixels, got {len(pixels)}")
+
+    colors = sorted(set(pixels))
+    if len(colors) > 256:
+        raise ValueError(f"{len(colors)} colors, at most 256 fit in the palette")
+
+    index = {color: i for i, color in enumerate(colors)}
+
+    out = bytearray(MAGIC + bytes([VERSION]) + width.to_bytes(2, "little") + height.to_bytes(2, "little"))
+    out.append(len(colors) - 1)
+
+    for color in colors:
+        out.extend(color.to_bytes(2, "little"))
+
+    data = [index[p] for p in pixels]
+    literals = bytearray()
+
+    def flush_literals():
+        for i in range(0, len(literals), MAX_LIT):
+            piece = literals[i:i + MAX_LIT]
+            out.append(len(piece) - 1)
+            out.extend(piece)
+
+        literals.clear()
+
+    pos = 0
+
+    while pos < len(data):
+        run = 1
+        while pos + run < len(data) and run < MAX_RUN and data[pos + run] == data[pos]:
+            run += 1
+
+        if run >= MIN_RUN:
+            flush_literals()
+            n = run - 1
+            out.extend([0x80 | (n >> 8), n & 0xFF, data[pos]])
+        else:
+            literals.extend(data[pos:pos + run])
+
+        pos += run
+
+    flush_literals()
+
+    return bytes(out)
+
+def decode(data: bytes):
+    if len(data) < HEADER_SIZE or data[:3] != MAGIC or data[3] != VERSION:
+        raise ValueError("not an E3I file")
+
+    width  = int.from_bytes(data[4:6], "little")
+    height = int.from_bytes(data[6:8], "little")
+
+    num_colors = data[8] + 1
+    palette = [int.from_bytes(data[HEADER_SIZE + i * 2:HEADER_SIZE + i * 2 + 2], "little") for i in range(num_colors)]
+
+    pixels = []
+    pos = HEADER_SIZE + num_colors * 2
+
+    while len(pixels) < width * height:
+        tag = data[pos]
+
+        if tag < 0x80:
+            pixels.extend(palette[i] for i in data[pos + 1:pos + tag + 2])
+            pos += tag + 2
+        else:
+            pixels.extend([palette[data[pos + 2]]] * ((((tag & 0x7F) << 8) | data[pos + 1]) + 1))
+            pos += 3
+
+    return pixels[:width * height], width, height
+
+def from_raw(data: bytes):
+    return [int.from_bytes(data[i:i + 2], "big") for i in range(0, len(data) - 1, 2)]
+
+def to_raw(pixels: list):
+    return b"".join(p.to_bytes(2, "big") for p in pixels)
+
+def from_image(path: str, width: int, height: int):
+    from PIL import Image
+
+    img = Image.open(path).convert("RGB")
+
+    if width and height:
+        img = img.resize((width, height))
+
+    # Colors that differ in 24 bits can be the same in 565, so quantize only if 565 needs it
+    pixels = [((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3) for r, g, b in img.getdata()]
+
+    if len(set(pixels)) > 256:
+        img = img.quantize(256).convert("RGB")
+        pixels = [((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3) for r, g, b in img.getdata()]
+
+    return pixels, img.width, img.height
+
+def main():
+    ap = argparse.ArgumentParser(description="Convert images for the eeprommer3 TFT")
+    ap.add_argument("input", help="file to read: raw RGB565 (.bin) or, with Pillow, any image")
+    ap.add_argument("output", help="file to write")
+    ap.add_argument("--width",  help="width of a raw image, or to scale to", type=int, default=320)
+    ap.add_argument("--height", help="height of a raw image, or to scale to", type=int, default=240)
+    ap.add_argument("-d", "--decode", help="decode to raw RGB565 instead", action="store_true")
+
+    args = ap.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+
+    if args.decode:
+        pixels, _, _ = decode(data)
+        result = to_raw(pixels)
+    elif args.input.lower().endswith(".bin"):
+        result = encode(from_raw(data), args.width, args.height)
+    else:
+        result = encode(*from_image(args.input, args.width, args.height))
+
+    with open(args.output, "wb") as f:
+        f.write(result)
+
+    print(f"{len(data)} -> {len(result)} bytes")
+
+if __name__ == "__main__":
+    main()
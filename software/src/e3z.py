@@ -0,0 +1,130 @@
+"""
+E3Z compression, decompressed by `FileCtrlCompressed` in the firmware.
+
+A file is the magic "E3Z", a version byte and the decompressed size (32-bit LE),
+followed by tokens:
+- 0x00-0x7F: literal, the next `tag + 1` bytes are copied as is
+- 0x80-0xBF: run, `(tag & 0x3F) << 8 | next` + 3 copies of the byte after that
+- 0xC0-0xFF: match, `(tag & 0x3F) + 3` bytes copied from `next + 1` bytes back
+"""
+
+import argparse
+
+MAGIC   = b"E3Z"
+VERSION = 1
+HEADER_SIZE = 8
+
+MIN_LEN   = 3
+MAX_LIT   = 0x80
+MAX_RUN   = 0x3FFF + MIN_LEN
+MAX_MATCH = 0x3F + MIN_LEN
+WINDOW    = 256
+
+def is_compressed(data: bytes):
+    return len(data) >= HEADER_SIZE and data[:3] == MAGIC and data[3] == VERSION
+
+def compress(data: bytes):
+    out = bytearray(MAGIC + bytes([VERSION]) + len(data).to_bytes(4, "little"))
+    literals = bytearray()
+
+    # Positions where each 3-byte sequence was last seen, most recent last
+    recent = {}
+
+    def flush_literals():
+        for i in range(0, len(literals), MAX_LIT):
+            piece = literals[i:i + MAX_LIT]
+            out.append(len(piece) - 1)
+            out.extend(piece)
+
+        literals.clear()
+
+    def remember(start: int, end: int):
+        for i in range(start, min(end, len(data) - MIN_LEN + 1)):
+            recent.setdefault(data[i:i + MIN_LEN], []).append(i)
+
+    pos = 0
+
+    while pos < len(data):
+        run = 1
+        while pos + run < len(data) and run < MAX_RUN and data[pos + run] == data[pos]:
+            run += 1
+
+        best_len, best_dist = 0, 0
+
+        for cand in reversed(recent.get(data[pos:pos + MIN_LEN], [])):
+            dist = pos - cand
+            if dist > WINDOW:
+                break
+
+            length = 0
+            while pos + length < len(data) and length < MAX_MATCH and data[cand + length] == data[pos + length]:
+                length += 1
+
+            if length > best_len:
+                best_len, best_dist = length, dist
+
+        if run >= MIN_LEN and run >= best_len:
+            flush_literals()
+            n = run - MIN_LEN
+            out.extend([0x80 | (n >> 8), n & 0xFF, data[pos]])
+            length = run
+        elif best_len >= MIN_LEN:
+            flush_literals()
+            out.extend([0xC0 | (best_len - MIN_LEN), best_dist - 1])
+            length = best_len
+        else:
+            literals.append(data[pos])
+            length = 1
+
+        remember(pos, pos + length)
+        pos += length
+
+    flush_literals()
+
+    return bytes(out)
+
+def decompress(data: bytes):
+    if not is_compressed(data):
+        raise ValueError("not an E3Z file")
+
+    size = int.from_bytes(data[4:8], "little")
+    out = bytearray()
+    pos = HEADER_SIZE
+
+    while len(out) < size:
+        tag = data[pos]
+
+        if tag < 0x80:
+            out.extend(data[pos + 1:pos + tag + 2])
+            pos += tag + 2
+        elif tag < 0xC0:
+            out.extend(data[pos + 2:pos + 3] * ((((tag & 0x3F) << 8) | data[pos + 1]) + MIN_LEN))
+            pos += 3
+        else:
+            dist = data[pos + 1] + 1
+            for _ in range((tag & 0x3F) + MIN_LEN):
+                out.append(out[-dist])
+            pos += 2
+
+    return bytes(out[:size])
+
+def main():
+    ap = argparse.ArgumentParser(description="Compress ROM images for eeprommer3")
+    ap.add_argument("input", help="file to read")
+    ap.add_argument("output", help="file to write")
+    ap.add_argument("-d", "--decompress", help="decompress instead", action="store_true")
+
+    args = ap.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+
+    result = decompress(data) if args.decompress else compress(data)
+
+    with open(args.output, "wb") as f:
+        f.write(result)
+
+    print(f"{len(data)} -> {len(result)} bytes")
+
+if __name__ == "__main__":
+    main()
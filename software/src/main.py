@@ -2,18 +2,28 @@ import argparse
 import os
 import os.path
 import serial
+import sys
+import tempfile
 import time
 
 import comm
+import devlog
+import e3z
 
 def main():
     ap = argparse.ArgumentParser()
     ap.add_argument("-p", "--port", help="specify port connected to eeprommer3", required=True)
+    ap.add_argument("--max-baud", help="highest baud rate to agree to", type=int, default=comm.BAUD_RATES[-1])
+    ap.add_argument("--compress", help="send files that the device reads in compressed form", action="store_true")
+    ap.add_argument("--log", help="append the device's log to FILE (- for stderr)", metavar="FILE")
 
     args = ap.parse_args()
 
+    global compress_reads
+    compress_reads = args.compress
+
     ser = open_port(args.port)
-    com = comm.Comm(ser)
+    com = comm.Comm(ser, args.max_baud, open_log(args.log))
 
     try:
         main_loop(com)
@@ -23,13 +33,19 @@ def main():
 def open_port(port: str):
     return serial.Serial(
         port=port,
-        baudrate=115200,
+        baudrate=comm.BAUD_RATES[0],
         bytesize=serial.EIGHTBITS,
         parity=serial.PARITY_NONE,
         stopbits=serial.STOPBITS_ONE,
         timeout=None
     )
 
+def open_log(path: str | None):
+    if path is None:
+        return None
+
+    return devlog.LogDecoder(sys.stderr if path == "-" else open(path, "a"))
+
 def main_loop(com: comm.Comm):
     print("Ready.")
 
@@ -37,23 +53,37 @@ def main_loop(com: comm.Comm):
 
     while True:
         pkt = com.recv()
-        cmds = commands[active]
+
+        # The device pings before every new transfer, so it is valid in any context
+        cmds = commands[None if pkt[0] == comm.PKT_PING else active]
 
         try:
             active = cmds[pkt[0]](com, pkt[1:])
         except KeyError:
             print(f"Error: Action 0x{pkt[0] :02x} is invalid in current context.")
+        except comm.StreamError as e:
+            print(f"Error: Stream aborted: {e}")
 
 def cmd_none_ping(com: comm.Comm, args: bytes):
-    print("Ping!")
-
-    com.send(comm.PKT_PING)
+    caps, rates = com.answer_ping(args)
+    print(f"Ping! Capabilities 0x{caps :02X}, baud rates 0x{rates :02X}")
     print("-> Pong!")
 
     return None
 
+def cmd_none_baud(com: comm.Comm, args: bytes):
+    rate = comm.BAUD_RATES[args[0]] if args[0] < len(comm.BAUD_RATES) else None
+    print(f"Switch to {rate} baud requested")
+
+    if rate is not None and com.answer_baud(args[0]):
+        print(f"-> Now at {rate} baud")
+    else:
+        print(f"-> Staying at {com.ser.baudrate} baud")
+
+    return None
+
 def cmd_none_fileopen(com: comm.Comm, args: bytes):
-    prompt = com.recv().decode("ascii")
+    prompt = com.recv(idle_nak=True).decode("ascii")
     input(f"Prompt: `{prompt}' (press enter)")
 
     path = file_dialog(prompt, args[0])
@@ -72,6 +102,9 @@ def cmd_fileopen_fileconf(com: comm.Comm, args: bytes):
     current_file.descriptor = os.open(current_file.path, flags, 0o666)
     print(f"-> File descriptor: {current_file.descriptor}")
 
+    if compress_reads and (args[0] & 0x03) == 0x01:  # O_RDONLY
+        compress_file()
+
     return comm.PKT_FILECONF
 
 def cmd_fileconf_filesize(com: comm.Comm, args: bytes):
@@ -80,12 +113,15 @@ def cmd_fileconf_filesize(com: comm.Comm, args: bytes):
     size = os.fstat(current_file.descriptor).st_size
     print(f"-> Size is 0x{size :04X} bytes")
 
-    com.send(comm.PKT_FILESIZE, bytes([size & 0xFF, size >> 8]))
+    if com.caps & comm.CAP_OFFSET32:
+        com.send(comm.PKT_FILESIZE, min(size, 0xFFFFFFFF).to_bytes(4, "little"))
+    else:
+        com.send(comm.PKT_FILESIZE, min(size, 0xFFFF).to_bytes(2, "little"))
 
     return comm.PKT_FILECONF
 
 def cmd_fileconf_fileseek(com: comm.Comm, args: bytes):
-    position = args[0] | (args[1] << 8)
+    position = int.from_bytes(args, "little")  # 16 or 32 bits, see CAP_OFFSET32
 
     print(f"Seeking to position 0x{position :04X}")
     os.lseek(current_file.descriptor, position, os.SEEK_SET)
@@ -109,7 +145,7 @@ def cmd_fileconf_fileread(com: comm.Comm, args: bytes):
 def cmd_fileconf_filewrit(com: comm.Comm, args: bytes):
     print(f"Writing bytes to file")
 
-    pkt = com.recv()
+    pkt = com.recv(idle_nak=True)
     print(f"-> Count 0x{len(pkt) :04X} bytes")
     print(f"-> Data is {hexdump(pkt, '-- ....... ')}")
 
@@ -119,6 +155,29 @@ def cmd_fileconf_filewrit(com: comm.Comm, args: bytes):
 
     return comm.PKT_FILECONF
 
+def cmd_fileconf_streamrd(com: comm.Comm, args: bytes):
+    length = args[0] | (args[1] << 8)
+    window = args[2]
+
+    print(f"Streaming 0x{length :04X} bytes from file, window {window}")
+
+    data = os.read(current_file.descriptor, length)
+    print(f"-> Got 0x{len(data) :04X} bytes")
+
+    com.stream_send(data, window, eof=(len(data) < length))
+
+    return comm.PKT_FILECONF
+
+def cmd_fileconf_streamwr(com: comm.Comm, args: bytes):
+    length = args[0] | (args[1] << 8)
+
+    print(f"Streaming 0x{length :04X} bytes to file")
+
+    for chunk in com.stream_recv(length):
+        os.write(current_file.descriptor, chunk)
+
+    return comm.PKT_FILECONF
+
 def cmd_fileconf_fileflus(com: comm.Comm, args: bytes):
     print("Flushing file")
 
@@ -133,6 +192,26 @@ def cmd_fileconf_fileclos(com: comm.Comm, args: bytes):
 
     return None
 
+def compress_file():
+    """Swaps the current file for a compressed copy, which the device decompresses as it reads."""
+    data = os.read(current_file.descriptor, os.fstat(current_file.descriptor).st_size)
+
+    if e3z.is_compressed(data):
+        os.lseek(current_file.descriptor, 0, os.SEEK_SET)
+        return
+
+    packed = e3z.compress(data)
+    print(f"-> Compressed 0x{len(data) :04X} bytes to 0x{len(packed) :04X}")
+
+    with tempfile.TemporaryFile() as f:
+        f.write(packed)
+        f.flush()
+
+        os.close(current_file.descriptor)
+        current_file.descriptor = os.dup(f.fileno())
+
+    os.lseek(current_file.descriptor, 0, os.SEEK_SET)
+
 def file_dialog(prompt: str, must_exist: bool):
     while True:
         h, w = os.popen("stty size").read().split()
@@ -172,6 +251,7 @@ def hexdump(data: bytes, prefix: str):
 commands = {
     None:              {
         comm.PKT_PING:     cmd_none_ping,
+        comm.PKT_BAUD:     cmd_none_baud,
         comm.PKT_FILEOPEN: cmd_none_fileopen,
     },
     comm.PKT_FILEOPEN: {
@@ -182,6 +262,8 @@ commands = {
         comm.PKT_FILESEEK: cmd_fileconf_fileseek,
         comm.PKT_FILEREAD: cmd_fileconf_fileread,
         comm.PKT_FILEWRIT: cmd_fileconf_filewrit,
+        comm.PKT_STREAMRD: cmd_fileconf_streamrd,
+        comm.PKT_STREAMWR: cmd_fileconf_streamwr,
         comm.PKT_FILEFLUS: cmd_fileconf_fileflus,
         comm.PKT_FILECLOS: cmd_fileconf_fileclos,
     },
@@ -192,6 +274,8 @@ class File:
 
 current_file = File()
 
+compress_reads = False
+
 if __name__ == "__main__":
     try:
         main()